@@ -0,0 +1,71 @@
+#pragma once
+
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+
+namespace e57
+{
+	// Thread safe FIFO queue with a fixed capacity, used to connect the stages of a producer/consumer pipeline.
+	// Push blocks while the queue is full, Pop blocks while the queue is empty, so the capacity bounds the memory held between two stages.
+	template <typename T>
+	class BoundedQueue
+	{
+	protected:
+		std::deque<T> items;
+		std::size_t capacity;
+		bool closed;
+		std::mutex mutex;
+		std::condition_variable notFull;
+		std::condition_variable notEmpty;
+
+	public:
+		BoundedQueue(const std::size_t capacity) : capacity((capacity > 0) ? capacity : 1), closed(false) {}
+
+		// Return false if the queue has been closed, the item is dropped in this case.
+		bool Push(T item)
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			notFull.wait(lock, [this]() { return closed || (items.size() < capacity); });
+			if (closed)
+				return false;
+
+			items.push_back(std::move(item));
+			notEmpty.notify_one();
+			return true;
+		}
+
+		// Return false if the queue has been closed and all the remaining items have been popped.
+		bool Pop(T& item)
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			notEmpty.wait(lock, [this]() { return closed || !items.empty(); });
+			if (items.empty())
+				return false;
+
+			item = std::move(items.front());
+			items.pop_front();
+			notFull.notify_one();
+			return true;
+		}
+
+		// Wake up all waiting producers and consumers. Later Push will fail, and Pop will drain the remaining items.
+		void Close()
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			closed = true;
+			notFull.notify_all();
+			notEmpty.notify_all();
+		}
+
+		// Close the queue and drop the remaining items, used to shut down the pipeline on error.
+		void Abort()
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			closed = true;
+			items.clear();
+			notFull.notify_all();
+			notEmpty.notify_all();
+		}
+	};
+}
@@ -1,5 +1,12 @@
+#include <Eigen/Dense>
+#include <pcl/exceptions.h>
+
 #include "Common.h"
 
+#if defined(__AVX512F__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
 std::string ToUpper(const std::string& s)
 {
 	std::string rs = s;
@@ -362,4 +369,330 @@ Eigen::Vector2d RAEToUV(RAEMode type, const Eigen::Vector3d& rae)
 		throw std::runtime_error("RAEMode is not support.");
 		break;
 	}
-}
\ No newline at end of file
+}
+RAEBasis::RAEBasis(RAEMode type) : elevationMode(GetElevationMode(type))
+{
+	Eigen::Vector3d a0 = GetAzimuth0DegreeVector(type);
+	Eigen::Vector3d a90 = GetAzimuth90DegreeVector(type);
+	uv_a0 = a0.cast<float>();
+	uv_a90 = a90.cast<float>();
+	uv_n = a0.cross(a90).cast<float>();
+
+	switch (elevationMode)
+	{
+	case ElevationMode::N:
+		nSin = 0.0f; nCos = 1.0f;
+		eSin = 1.0f; eCos = 0.0f;
+		break;
+	case ElevationMode::S:
+		nSin = 0.0f; nCos = -1.0f;
+		eSin = 1.0f; eCos = 0.0f;
+		break;
+	case ElevationMode::E:
+		nSin = 1.0f; nCos = 0.0f;
+		eSin = 0.0f; eCos = 1.0f;
+		break;
+	default:
+		throw std::runtime_error("ElevationMode is not support.");
+		break;
+	}
+}
+
+// Single precision sincos (Cephes sinf/cosf polynomials), accurate to a few ulp for |x| < 8192
+#define SINCOS_FOPI 1.27323954473516f // 4 / PI
+#define SINCOS_DP1 0.78515625f
+#define SINCOS_DP2 2.4187564849853515625e-4f
+#define SINCOS_DP3 3.77489497744594108e-8f
+#define SINCOS_S0 -1.9515295891e-4f
+#define SINCOS_S1 8.3321608736e-3f
+#define SINCOS_S2 -1.6666654611e-1f
+#define SINCOS_C0 2.443315711809948e-5f
+#define SINCOS_C1 -1.388731625493765e-3f
+#define SINCOS_C2 4.166664568298827e-2f
+
+inline void SinCos(const float x, float& s, float& c)
+{
+	float ax = std::abs(x);
+	int j = (int)(ax * SINCOS_FOPI);
+	j = (j + 1) & ~1;
+	float y = (float)j;
+	ax = ((ax - y * SINCOS_DP1) - y * SINCOS_DP2) - y * SINCOS_DP3;
+
+	float z = ax * ax;
+	float pc = ((SINCOS_C0 * z + SINCOS_C1) * z + SINCOS_C2) * z * z - 0.5f * z + 1.0f;
+	float ps = ((SINCOS_S0 * z + SINCOS_S1) * z + SINCOS_S2) * z * ax + ax;
+
+	bool swap = (j & 2) != 0;
+	s = swap ? pc : ps;
+	c = swap ? ps : pc;
+	if (((j & 4) != 0) != (x < 0.0f))
+		s = -s;
+	if (((j - 2) & 4) == 0)
+		c = -c;
+}
+
+inline void RAEToXYZ(const RAEBasis& basis, const float r, const float a, const float e, float& x, float& y, float& z)
+{
+	float s_e, c_e, s_a, c_a;
+	SinCos(e, s_e, c_e);
+	SinCos(a, s_a, c_a);
+	float len_n = r * (basis.nSin * s_e + basis.nCos * c_e);
+	float len_e = r * (basis.eSin * s_e + basis.eCos * c_e);
+	float len_a0 = len_e * c_a;
+	float len_a90 = len_e * s_a;
+	x = basis.uv_a0.x() * len_a0 + basis.uv_a90.x() * len_a90 + basis.uv_n.x() * len_n;
+	y = basis.uv_a0.y() * len_a0 + basis.uv_a90.y() * len_a90 + basis.uv_n.y() * len_n;
+	z = basis.uv_a0.z() * len_a0 + basis.uv_a90.z() * len_a90 + basis.uv_n.z() * len_n;
+}
+
+#if defined(__AVX512F__)
+inline void SinCos(const __m512 x, __m512& s, __m512& c)
+{
+	__m512i sinSign = _mm512_and_si512(_mm512_castps_si512(x), _mm512_set1_epi32(0x80000000));
+	__m512 ax = _mm512_abs_ps(x);
+	__m512i j = _mm512_cvttps_epi32(_mm512_mul_ps(ax, _mm512_set1_ps(SINCOS_FOPI)));
+	j = _mm512_and_si512(_mm512_add_epi32(j, _mm512_set1_epi32(1)), _mm512_set1_epi32(~1));
+	__m512 y = _mm512_cvtepi32_ps(j);
+	ax = _mm512_fnmadd_ps(y, _mm512_set1_ps(SINCOS_DP1), ax);
+	ax = _mm512_fnmadd_ps(y, _mm512_set1_ps(SINCOS_DP2), ax);
+	ax = _mm512_fnmadd_ps(y, _mm512_set1_ps(SINCOS_DP3), ax);
+
+	__m512 z = _mm512_mul_ps(ax, ax);
+	__m512 pc = _mm512_fmadd_ps(_mm512_set1_ps(SINCOS_C0), z, _mm512_set1_ps(SINCOS_C1));
+	pc = _mm512_fmadd_ps(pc, z, _mm512_set1_ps(SINCOS_C2));
+	pc = _mm512_mul_ps(pc, _mm512_mul_ps(z, z));
+	pc = _mm512_fnmadd_ps(_mm512_set1_ps(0.5f), z, pc);
+	pc = _mm512_add_ps(pc, _mm512_set1_ps(1.0f));
+	__m512 ps = _mm512_fmadd_ps(_mm512_set1_ps(SINCOS_S0), z, _mm512_set1_ps(SINCOS_S1));
+	ps = _mm512_fmadd_ps(ps, z, _mm512_set1_ps(SINCOS_S2));
+	ps = _mm512_fmadd_ps(_mm512_mul_ps(ps, z), ax, ax);
+
+	__mmask16 swap = _mm512_test_epi32_mask(j, _mm512_set1_epi32(2));
+	sinSign = _mm512_xor_si512(sinSign, _mm512_slli_epi32(_mm512_and_si512(j, _mm512_set1_epi32(4)), 29));
+	__m512i cosSign = _mm512_slli_epi32(_mm512_andnot_si512(_mm512_sub_epi32(j, _mm512_set1_epi32(2)), _mm512_set1_epi32(4)), 29);
+	s = _mm512_castsi512_ps(_mm512_xor_si512(_mm512_castps_si512(_mm512_mask_blend_ps(swap, ps, pc)), sinSign));
+	c = _mm512_castsi512_ps(_mm512_xor_si512(_mm512_castps_si512(_mm512_mask_blend_ps(swap, pc, ps)), cosSign));
+}
+#elif defined(__AVX2__)
+inline void SinCos(const __m256 x, __m256& s, __m256& c)
+{
+	const __m256 signMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x80000000));
+	__m256 sinSign = _mm256_and_ps(x, signMask);
+	__m256 ax = _mm256_andnot_ps(signMask, x);
+	__m256i j = _mm256_cvttps_epi32(_mm256_mul_ps(ax, _mm256_set1_ps(SINCOS_FOPI)));
+	j = _mm256_and_si256(_mm256_add_epi32(j, _mm256_set1_epi32(1)), _mm256_set1_epi32(~1));
+	__m256 y = _mm256_cvtepi32_ps(j);
+	ax = _mm256_fnmadd_ps(y, _mm256_set1_ps(SINCOS_DP1), ax);
+	ax = _mm256_fnmadd_ps(y, _mm256_set1_ps(SINCOS_DP2), ax);
+	ax = _mm256_fnmadd_ps(y, _mm256_set1_ps(SINCOS_DP3), ax);
+
+	__m256 z = _mm256_mul_ps(ax, ax);
+	__m256 pc = _mm256_fmadd_ps(_mm256_set1_ps(SINCOS_C0), z, _mm256_set1_ps(SINCOS_C1));
+	pc = _mm256_fmadd_ps(pc, z, _mm256_set1_ps(SINCOS_C2));
+	pc = _mm256_mul_ps(pc, _mm256_mul_ps(z, z));
+	pc = _mm256_fnmadd_ps(_mm256_set1_ps(0.5f), z, pc);
+	pc = _mm256_add_ps(pc, _mm256_set1_ps(1.0f));
+	__m256 ps = _mm256_fmadd_ps(_mm256_set1_ps(SINCOS_S0), z, _mm256_set1_ps(SINCOS_S1));
+	ps = _mm256_fmadd_ps(ps, z, _mm256_set1_ps(SINCOS_S2));
+	ps = _mm256_fmadd_ps(_mm256_mul_ps(ps, z), ax, ax);
+
+	__m256 swap = _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(j, _mm256_set1_epi32(2)), _mm256_set1_epi32(2)));
+	sinSign = _mm256_xor_ps(sinSign, _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(j, _mm256_set1_epi32(4)), 29)));
+	__m256 cosSign = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_andnot_si256(_mm256_sub_epi32(j, _mm256_set1_epi32(2)), _mm256_set1_epi32(4)), 29));
+	s = _mm256_xor_ps(_mm256_blendv_ps(ps, pc, swap), sinSign);
+	c = _mm256_xor_ps(_mm256_blendv_ps(pc, ps, swap), cosSign);
+}
+#endif
+
+void RAEToXYZ(const RAEBasis& basis, const float* r, const float* a, const float* e, float* x, float* y, float* z, const std::size_t size)
+{
+	std::size_t i = 0;
+
+#if defined(__AVX512F__)
+	const __m512 nSin = _mm512_set1_ps(basis.nSin), nCos = _mm512_set1_ps(basis.nCos);
+	const __m512 eSin = _mm512_set1_ps(basis.eSin), eCos = _mm512_set1_ps(basis.eCos);
+	const __m512 a0x = _mm512_set1_ps(basis.uv_a0.x()), a0y = _mm512_set1_ps(basis.uv_a0.y()), a0z = _mm512_set1_ps(basis.uv_a0.z());
+	const __m512 a90x = _mm512_set1_ps(basis.uv_a90.x()), a90y = _mm512_set1_ps(basis.uv_a90.y()), a90z = _mm512_set1_ps(basis.uv_a90.z());
+	const __m512 nx = _mm512_set1_ps(basis.uv_n.x()), ny = _mm512_set1_ps(basis.uv_n.y()), nz = _mm512_set1_ps(basis.uv_n.z());
+	for (; i + 16 <= size; i += 16)
+	{
+		__m512 _r = _mm512_loadu_ps(r + i);
+		__m512 s_e, c_e, s_a, c_a;
+		SinCos(_mm512_loadu_ps(e + i), s_e, c_e);
+		SinCos(_mm512_loadu_ps(a + i), s_a, c_a);
+		__m512 len_n = _mm512_mul_ps(_r, _mm512_fmadd_ps(nSin, s_e, _mm512_mul_ps(nCos, c_e)));
+		__m512 len_e = _mm512_mul_ps(_r, _mm512_fmadd_ps(eSin, s_e, _mm512_mul_ps(eCos, c_e)));
+		__m512 len_a0 = _mm512_mul_ps(len_e, c_a);
+		__m512 len_a90 = _mm512_mul_ps(len_e, s_a);
+		_mm512_storeu_ps(x + i, _mm512_fmadd_ps(a0x, len_a0, _mm512_fmadd_ps(a90x, len_a90, _mm512_mul_ps(nx, len_n))));
+		_mm512_storeu_ps(y + i, _mm512_fmadd_ps(a0y, len_a0, _mm512_fmadd_ps(a90y, len_a90, _mm512_mul_ps(ny, len_n))));
+		_mm512_storeu_ps(z + i, _mm512_fmadd_ps(a0z, len_a0, _mm512_fmadd_ps(a90z, len_a90, _mm512_mul_ps(nz, len_n))));
+	}
+#elif defined(__AVX2__)
+	const __m256 nSin = _mm256_set1_ps(basis.nSin), nCos = _mm256_set1_ps(basis.nCos);
+	const __m256 eSin = _mm256_set1_ps(basis.eSin), eCos = _mm256_set1_ps(basis.eCos);
+	const __m256 a0x = _mm256_set1_ps(basis.uv_a0.x()), a0y = _mm256_set1_ps(basis.uv_a0.y()), a0z = _mm256_set1_ps(basis.uv_a0.z());
+	const __m256 a90x = _mm256_set1_ps(basis.uv_a90.x()), a90y = _mm256_set1_ps(basis.uv_a90.y()), a90z = _mm256_set1_ps(basis.uv_a90.z());
+	const __m256 nx = _mm256_set1_ps(basis.uv_n.x()), ny = _mm256_set1_ps(basis.uv_n.y()), nz = _mm256_set1_ps(basis.uv_n.z());
+	for (; i + 8 <= size; i += 8)
+	{
+		__m256 _r = _mm256_loadu_ps(r + i);
+		__m256 s_e, c_e, s_a, c_a;
+		SinCos(_mm256_loadu_ps(e + i), s_e, c_e);
+		SinCos(_mm256_loadu_ps(a + i), s_a, c_a);
+		__m256 len_n = _mm256_mul_ps(_r, _mm256_fmadd_ps(nSin, s_e, _mm256_mul_ps(nCos, c_e)));
+		__m256 len_e = _mm256_mul_ps(_r, _mm256_fmadd_ps(eSin, s_e, _mm256_mul_ps(eCos, c_e)));
+		__m256 len_a0 = _mm256_mul_ps(len_e, c_a);
+		__m256 len_a90 = _mm256_mul_ps(len_e, s_a);
+		_mm256_storeu_ps(x + i, _mm256_fmadd_ps(a0x, len_a0, _mm256_fmadd_ps(a90x, len_a90, _mm256_mul_ps(nx, len_n))));
+		_mm256_storeu_ps(y + i, _mm256_fmadd_ps(a0y, len_a0, _mm256_fmadd_ps(a90y, len_a90, _mm256_mul_ps(ny, len_n))));
+		_mm256_storeu_ps(z + i, _mm256_fmadd_ps(a0z, len_a0, _mm256_fmadd_ps(a90z, len_a90, _mm256_mul_ps(nz, len_n))));
+	}
+#endif
+
+	// Scalar kernel for the remaining points
+	for (; i < size; ++i)
+		RAEToXYZ(basis, r[i], a[i], e[i], x[i], y[i], z[i]);
+}
+
+void XYZToRAE(const RAEBasis& basis, const float* x, const float* y, const float* z, float* r, float* a, float* e, const std::size_t size)
+{
+	for (std::size_t i = 0; i < size; ++i)
+	{
+		float _x = x[i];
+		float _y = y[i];
+		float _z = z[i];
+		float len_n = _x * basis.uv_n.x() + _y * basis.uv_n.y() + _z * basis.uv_n.z();
+		float len_a0 = _x * basis.uv_a0.x() + _y * basis.uv_a0.y() + _z * basis.uv_a0.z();
+		float len_a90 = _x * basis.uv_a90.x() + _y * basis.uv_a90.y() + _z * basis.uv_a90.z();
+		float len_e = std::sqrt(len_a0 * len_a0 + len_a90 * len_a90);
+
+		// The elevation coefficients form an orthogonal matrix, so sin(e) and cos(e) are recovered by its transpose
+		r[i] = std::sqrt(_x * _x + _y * _y + _z * _z);
+		a[i] = std::atan2(len_a90, len_a0);
+		e[i] = std::atan2(basis.nSin * len_n + basis.eSin * len_e, basis.nCos * len_n + basis.eCos * len_e);
+	}
+}
+
+void RAEToUV(RAEMode type, const float* a, const float* e, float* u, float* v, const std::size_t size)
+{
+	switch (type)
+	{
+	case RAEMode::E_X_Y:
+		for (std::size_t i = 0; i < size; ++i)
+		{
+			u[i] = std::min(std::max(0.5f * (1.0f - a[i] * (float)(1.0 / M_PI)), 0.0f), 1.0f);
+			v[i] = std::min(std::max(0.5f * (1.0f + e[i] * (float)(2.0 / M_PI)), 0.0f), 1.0f);
+		}
+		break;
+	default:
+		throw std::runtime_error("RAEMode is not support.");
+		break;
+	}
+}
+
+// Spread the lower 21 bits of v to every 3rd bit
+inline uint64_t MortonSpreadBits(uint64_t v)
+{
+	v &= 0x1fffff;
+	v = (v | v << 32) & 0x1f00000000ffff;
+	v = (v | v << 16) & 0x1f0000ff0000ff;
+	v = (v | v << 8) & 0x100f00f00f00f00f;
+	v = (v | v << 4) & 0x10c30c30c30c30c3;
+	v = (v | v << 2) & 0x1249249249249249;
+	return v;
+}
+
+uint64_t MortonEncode(const uint64_t x, const uint64_t y, const uint64_t z)
+{
+	return MortonSpreadBits(x) | (MortonSpreadBits(y) << 1) | (MortonSpreadBits(z) << 2);
+}
+
+double BeamFalloff(const double hitDistance)
+{
+	// Ref - BLK 360 Spec - laser wavelength & Beam divergence : https://lasers.leica-geosystems.com/global/sites/lasers.leica-geosystems.com.global/files/leica_media/product_documents/blk/853811_leica_blk360_um_v2.0.0_en.pdf
+	// Ref - Gaussian beam : https://en.wikipedia.org/wiki/Gaussian_beam
+	// Ref - Beam divergence to Beam waist(w0) : http://www2.nsysu.edu.tw/optics/laser/angle.htm
+	double temp = hitDistance / 26.2854504782;
+	return 1.0 / (1.0 + temp * temp);
+}
+
+// Min ratio of the smallest to the largest eigenvalue of the normal matrix for EIGEN_NE_FIXED
+const double scannLaserInfosMinConditionRatio = 1e-10;
+
+Eigen::Vector3d SolveScannLaserInfos(const std::vector<ScannLaserInfo>& scannLaserInfos, const LinearSolver linearSolver)
+{
+	if (linearSolver == LinearSolver::EIGEN_NE_FIXED)
+	{
+		Eigen::Matrix3d ATA = Eigen::Matrix3d::Zero();
+		Eigen::Vector3d ATB = Eigen::Vector3d::Zero();
+		for (std::vector<ScannLaserInfo>::const_iterator it = scannLaserInfos.begin(); it != scannLaserInfos.end(); ++it)
+		{
+			double w2 = it->weight * it->weight;
+			ATA += w2 * (it->incidentDirection * it->incidentDirection.transpose() + it->hitTangent * it->hitTangent.transpose() + it->hitBitangent * it->hitBitangent.transpose());
+			ATB += w2 * (it->intensity / it->beamFalloff) * it->incidentDirection;
+		}
+
+		// Closed form eigen decomposition of the 3x3 symmetric normal matrix
+		Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> es;
+		es.computeDirect(ATA);
+		const Eigen::Vector3d& eigenValues = es.eigenvalues();
+		if ((es.info() == Eigen::Success) && (eigenValues(0) > scannLaserInfosMinConditionRatio * eigenValues(2)))
+			return es.eigenvectors() * (es.eigenvectors().transpose() * ATB).cwiseQuotient(eigenValues);
+	}
+
+	Eigen::MatrixXf A;
+	Eigen::MatrixXf B;
+
+	A = Eigen::MatrixXf(scannLaserInfos.size() * 3, 3);
+	B = Eigen::MatrixXf(scannLaserInfos.size() * 3, 1);
+
+	std::size_t shifter = 0;
+	for (std::vector<ScannLaserInfo>::const_iterator it = scannLaserInfos.begin(); it != scannLaserInfos.end(); ++it)
+	{
+		A(shifter, 0) = it->weight * it->incidentDirection.x();
+		A(shifter, 1) = it->weight * it->incidentDirection.y();
+		A(shifter, 2) = it->weight * it->incidentDirection.z();
+		B(shifter, 0) = it->weight * (it->intensity / it->beamFalloff);
+
+		A(shifter + 1, 0) = it->weight * it->hitTangent.x();
+		A(shifter + 1, 1) = it->weight * it->hitTangent.y();
+		A(shifter + 1, 2) = it->weight * it->hitTangent.z();
+		B(shifter + 1, 0) = 0.0;
+
+		A(shifter + 2, 0) = it->weight * it->hitBitangent.x();
+		A(shifter + 2, 1) = it->weight * it->hitBitangent.y();
+		A(shifter + 2, 2) = it->weight * it->hitBitangent.z();
+		B(shifter + 2, 0) = 0.0;
+
+		shifter += 3;
+	}
+
+	Eigen::MatrixXf X;
+	switch (linearSolver)
+	{
+	case LinearSolver::EIGEN_QR:
+	{
+		X = A.colPivHouseholderQr().solve(B);
+	}
+	break;
+	case LinearSolver::EIGEN_SVD:
+	case LinearSolver::EIGEN_NE_FIXED:
+	{
+		X = A.bdcSvd(Eigen::ComputeThinU | Eigen::ComputeThinV).solve(B);
+	}
+	break;
+	case LinearSolver::EIGEN_NE:
+	{
+		Eigen::MatrixXf localAT = A.transpose();
+		X = (localAT * A).ldlt().solve(localAT * B);
+	}
+	break;
+	default:
+	{
+		throw pcl::PCLException("LinearSolver is not supported.");
+	}
+	break;
+	}
+	return Eigen::Vector3d(X(0, 0), X(1, 0), X(2, 0));
+}
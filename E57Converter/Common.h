@@ -1,6 +1,7 @@
 #pragma once
 
 #include <string>
+#include <vector>
 #include <boost/filesystem.hpp>
 #include <pcl/common/transforms.h>
 #include <Eigen/Core>
@@ -24,6 +25,7 @@ enum LinearSolver : unsigned int
 	EIGEN_QR = 1,
 	EIGEN_SVD = 2,
 	EIGEN_NE = 3,
+	EIGEN_NE_FIXED = 4, // Normal equations accumulated in fixed size 3x3 matrices, falls back to EIGEN_SVD if ill-conditioned
 };
 
 // http://www.libe57.org/bestCoordinates.html
@@ -199,6 +201,32 @@ Eigen::Vector3d RAEToXYZ(RAEMode type, const Eigen::Vector3d& rae);
 Eigen::Vector3d XYZToRAE(RAEMode type, const Eigen::Vector3d& xyz);
 Eigen::Vector2d RAEToUV(RAEMode type, const Eigen::Vector3d& rae);
 
+// RAEMode resolved once for batch conversion, so the per point work does not decode the mode or branch on it
+struct RAEBasis
+{
+	ElevationMode elevationMode;
+	Eigen::Vector3f uv_a0;
+	Eigen::Vector3f uv_a90;
+	Eigen::Vector3f uv_n;
+
+	// len_n = r * (nSin * sin(e) + nCos * cos(e)), len_e = r * (eSin * sin(e) + eCos * cos(e))
+	float nSin;
+	float nCos;
+	float eSin;
+	float eCos;
+
+	RAEBasis(RAEMode type);
+};
+
+// Batch conversion of SoA float arrays, use AVX-512 or AVX2 kernels if the program is compiled with them, or a scalar kernel.
+// Output arrays can be the same as input arrays.
+void RAEToXYZ(const RAEBasis& basis, const float* r, const float* a, const float* e, float* x, float* y, float* z, const std::size_t size);
+void XYZToRAE(const RAEBasis& basis, const float* x, const float* y, const float* z, float* r, float* a, float* e, const std::size_t size);
+void RAEToUV(RAEMode type, const float* a, const float* e, float* u, float* v, const std::size_t size);
+
+// Morton code of a 3D grid cell, uses the lower 21 bits of each coordinate
+uint64_t MortonEncode(const uint64_t x, const uint64_t y, const uint64_t z);
+
 struct ScannLaserInfo
 {
 	Eigen::Vector3d incidentDirection;
@@ -212,3 +240,10 @@ struct ScannLaserInfo
 	double weight;
 	double beamFalloff;
 };
+
+// Falloff of the laser beam irradiance at hitDistance meters, by the Gaussian beam model of BLK360.
+double BeamFalloff(const double hitDistance);
+
+// Solve the albedo scaled normal X from scannLaserInfos, each info gives 3 rows:
+// weight * incidentDirection.X = weight * intensity / beamFalloff, weight * hitTangent.X = 0, weight * hitBitangent.X = 0
+Eigen::Vector3d SolveScannLaserInfos(const std::vector<ScannLaserInfo>& scannLaserInfos, const LinearSolver linearSolver);
@@ -66,11 +66,7 @@ namespace e57
 								scannLaserInfo.incidentDirection *= -1.0;
 							scannLaserInfo.reflectedDirection = scannLaserInfo.incidentDirection; // BLK360 
 
-							// Ref - BLK 360 Spec - laser wavelength & Beam divergence : https://lasers.leica-geosystems.com/global/sites/lasers.leica-geosystems.com.global/files/leica_media/product_documents/blk/853811_leica_blk360_um_v2.0.0_en.pdf
-							// Ref - Gaussian beam : https://en.wikipedia.org/wiki/Gaussian_beam
-							// Ref - Beam divergence to Beam waist(w0) : http://www2.nsysu.edu.tw/optics/laser/angle.htm
-							double temp = scannLaserInfo.hitDistance / 26.2854504782;
-							scannLaserInfo.beamFalloff = 1.0f / (1 + temp * temp);
+							scannLaserInfo.beamFalloff = BeamFalloff(scannLaserInfo.hitDistance);
 							if ((scannLaserInfo.beamFalloff > cutFalloff))
 							{
 								scannLaserInfo.hitTangent = scannLaserInfo.hitNormal.cross(tempVec);
@@ -104,61 +100,7 @@ namespace e57
 	inline bool AlbedoEstimation::ComputePointAlbedo(const std::vector<ScannLaserInfo>& scannLaserInfos, const PointExchange& inPoint, PointPCD& outPoint)
 	{
 #ifdef POINT_PCD_WITH_INTENSITY
-		Eigen::MatrixXf A;
-		Eigen::MatrixXf B;
-
-		A = Eigen::MatrixXf(scannLaserInfos.size() * 3, 3);
-		B = Eigen::MatrixXf(scannLaserInfos.size() * 3, 1);
-
-		std::size_t shifter = 0;
-		for (std::vector<ScannLaserInfo>::const_iterator it = scannLaserInfos.begin(); it != scannLaserInfos.end(); ++it)
-		{
-			A(shifter, 0) = it->weight * it->incidentDirection.x();
-			A(shifter, 1) = it->weight * it->incidentDirection.y();
-			A(shifter, 2) = it->weight * it->incidentDirection.z();
-			B(shifter, 0) = it->weight * (it->intensity / it->beamFalloff);
-
-			A(shifter + 1, 0) = it->weight * it->hitTangent.x();
-			A(shifter + 1, 1) = it->weight * it->hitTangent.y();
-			A(shifter + 1, 2) = it->weight * it->hitTangent.z();
-			B(shifter + 1, 0) = 0.0;
-
-			A(shifter + 2, 0) = it->weight * it->hitBitangent.x();
-			A(shifter + 2, 1) = it->weight * it->hitBitangent.y();
-			A(shifter + 2, 2) = it->weight * it->hitBitangent.z();
-			B(shifter + 2, 0) = 0.0;
-
-			shifter += 3;
-		}
-
-		Eigen::MatrixXf X;
-		switch (linearSolver)
-		{
-		case LinearSolver::EIGEN_QR:
-		{
-			X = A.colPivHouseholderQr().solve(B);
-		}
-		break;
-		case LinearSolver::EIGEN_SVD:
-		{
-			X = A.bdcSvd(Eigen::ComputeThinU | Eigen::ComputeThinV).solve(B);
-		}
-		break;
-		case LinearSolver::EIGEN_NE:
-		{
-			Eigen::MatrixXf localAT = A.transpose();
-			X = (localAT * A).ldlt().solve(localAT * B);
-		}
-		break;
-		default:
-		{
-			throw pcl::PCLException("LinearSolver is not supported.");
-		}
-		break;
-		}
-
-		//
-		Eigen::Vector3d xVec(X(0, 0), X(1, 0), X(2, 0));
+		Eigen::Vector3d xVec = SolveScannLaserInfos(scannLaserInfos, linearSolver);
 		if (std::isfinite(xVec.x()) && std::isfinite(xVec.y()) && std::isfinite(xVec.z()))
 		{
 			double xVecNorm = xVec.norm();
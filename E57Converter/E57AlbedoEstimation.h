@@ -10,20 +10,6 @@
 
 namespace e57
 {
-	struct ScannLaserInfo
-	{
-		Eigen::Vector3d incidentDirection;
-		Eigen::Vector3d reflectedDirection;
-		double intensity;
-		Eigen::Vector3d hitPosition;
-		Eigen::Vector3d hitNormal;
-		Eigen::Vector3d hitTangent;
-		Eigen::Vector3d hitBitangent;
-		double hitDistance;
-		double weight;
-		double beamFalloff;
-	};
-
 	class AlbedoEstimation : public pcl::Feature<PointExchange, PointPCD>
 	{
 	public:
@@ -43,7 +29,7 @@ namespace e57
 
 	public:
 		AlbedoEstimation(const std::vector<ScanInfo>& scanInfos, 
-			const LinearSolver linearSolver = LinearSolver::EIGEN_SVD, const double distInterParm = 10.0, const double angleInterParm = 20.0, const double frontInterParm = 5.0, const double cutFalloff = 0.33, const double cutGrazing = 0.86602540378)
+			const LinearSolver linearSolver = LinearSolver::EIGEN_NE_FIXED, const double distInterParm = 10.0, const double angleInterParm = 20.0, const double frontInterParm = 5.0, const double cutFalloff = 0.33, const double cutGrazing = 0.86602540378)
 			: scanInfos(scanInfos), linearSolver(linearSolver), distInterParm(distInterParm), angleInterParm(angleInterParm), frontInterParm(frontInterParm), cutFalloff(cutFalloff), cutGrazing(cutGrazing)
 		{
 			feature_name_ = "AlbedoEstimation";
@@ -95,7 +81,7 @@ namespace e57
 		typedef typename AlbedoEstimation::PointCloudOut PointCloudOut;
 
 		AlbedoEstimationOMP(const std::vector<ScanInfo>& scanInfos, 
-			const LinearSolver linearSolver = LinearSolver::EIGEN_SVD, const double distInterParm = 10.0, const double angleInterParm = 20.0, const double frontInterParm = 5.0, const double cutFalloff = 0.33, const double cutGrazing = 0.86602540378,
+			const LinearSolver linearSolver = LinearSolver::EIGEN_NE_FIXED, const double distInterParm = 10.0, const double angleInterParm = 20.0, const double frontInterParm = 5.0, const double cutFalloff = 0.33, const double cutGrazing = 0.86602540378,
 			unsigned int nr_threads = 0)
 			: AlbedoEstimation(scanInfos, linearSolver, distInterParm, angleInterParm, frontInterParm, cutFalloff, cutGrazing)
 		{
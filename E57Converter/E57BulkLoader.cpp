@@ -0,0 +1,208 @@
+#include <fstream>
+#include <queue>
+#include <algorithm>
+
+#include <pcl/outofcore/outofcore_impl.h>
+
+#include "E57BulkLoader.h"
+
+namespace e57
+{
+	// for asyc
+	int MortonBulkLoader_WriteRun(const MortonBulkLoader* loader, const pcl::PointCloud<PointE57>::Ptr cloud, const boost::filesystem::path runFile)
+	{
+		std::vector<std::pair<uint64_t, uint32_t>> order(cloud->size());
+		for (std::size_t pi = 0; pi < cloud->size(); ++pi)
+			order[pi] = std::pair<uint64_t, uint32_t>(loader->MortonCode((*cloud)[pi]), (uint32_t)pi);
+		std::sort(order.begin(), order.end());
+
+		std::ofstream file(runFile.string(), std::ios_base::out | std::ios_base::binary);
+		if (!file)
+			throw pcl::PCLException("Create file " + runFile.string() + " failed.");
+
+		const std::size_t blockSize = 16384;
+		MortonBulkLoader::MortonPointVector block;
+		block.reserve(blockSize);
+		for (std::size_t oi = 0; oi < order.size(); ++oi)
+		{
+			MortonBulkLoader::MortonPoint mp;
+			mp.key = order[oi].first;
+			mp.point = (*cloud)[order[oi].second];
+			block.push_back(mp);
+			if ((block.size() == blockSize) || ((oi + 1) == order.size()))
+			{
+				file.write(reinterpret_cast<const char*>(block.data()), block.size() * sizeof(MortonBulkLoader::MortonPoint));
+				block.clear();
+			}
+		}
+		if (!file)
+			throw pcl::PCLException("Write file " + runFile.string() + " failed.");
+		file.close();
+		return 0;
+	}
+
+	// Buffered sequential reader of one sorted run
+	class MortonRunReader
+	{
+	protected:
+		std::ifstream file;
+		MortonBulkLoader::MortonPointVector block;
+		std::size_t pos;
+
+	public:
+		MortonRunReader(const boost::filesystem::path& runFile) : file(runFile.string(), std::ios_base::in | std::ios_base::binary), block(16384), pos(0)
+		{
+			if (!file)
+				throw pcl::PCLException("Load file " + runFile.string() + " failed.");
+			Fill();
+		}
+
+		void Fill()
+		{
+			block.resize(block.capacity());
+			file.read(reinterpret_cast<char*>(block.data()), block.size() * sizeof(MortonBulkLoader::MortonPoint));
+			block.resize(file.gcount() / sizeof(MortonBulkLoader::MortonPoint));
+			pos = 0;
+		}
+
+		bool Empty() const { return pos >= block.size(); }
+		const MortonBulkLoader::MortonPoint& Top() const { return block[pos]; }
+
+		void Next()
+		{
+			++pos;
+			if (Empty())
+				Fill();
+		}
+	};
+
+	MortonBulkLoader::MortonBulkLoader(const Converter::OCT::Ptr& oct, const boost::filesystem::path& runPath, const std::size_t runSize)
+		: oct(oct), runPath(runPath), runSize(std::max(runSize, (std::size_t)1)), buffer(new pcl::PointCloud<PointE57>)
+	{
+		Eigen::Vector3d max;
+		oct->getBoundingBox(min, max);
+		numCells = ((int64_t)1) << std::min(oct->getDepth(), (uint64_t)21);
+		scale = Eigen::Vector3d(numCells, numCells, numCells).cwiseQuotient(max - min);
+
+		if (!boost::filesystem::exists(runPath))
+			boost::filesystem::create_directories(runPath);
+		buffer->reserve(this->runSize);
+	}
+
+	MortonBulkLoader::~MortonBulkLoader()
+	{
+		try
+		{
+			WaitSpill();
+		}
+		catch (...)
+		{
+		}
+
+		boost::system::error_code ec;
+		boost::filesystem::remove_all(runPath, ec);
+	}
+
+	uint64_t MortonBulkLoader::MortonCode(const PointE57& p) const
+	{
+		int64_t ix = std::min(std::max((int64_t)((p.x - min.x()) * scale.x()), (int64_t)0), numCells - 1);
+		int64_t iy = std::min(std::max((int64_t)((p.y - min.y()) * scale.y()), (int64_t)0), numCells - 1);
+		int64_t iz = std::min(std::max((int64_t)((p.z - min.z()) * scale.z()), (int64_t)0), numCells - 1);
+		return MortonEncode(ix, iy, iz);
+	}
+
+	void MortonBulkLoader::WaitSpill()
+	{
+		if (spill.valid())
+		{
+			int rWriteRun = spill.get();
+			if (rWriteRun != 0) throw pcl::PCLException("MortonBulkLoader_WriteRun failed - " + std::to_string(rWriteRun));
+		}
+	}
+
+	void MortonBulkLoader::Spill()
+	{
+		if (buffer->empty())
+			return;
+
+		// Sort and write the run in background while the next run is filled
+		WaitSpill();
+		boost::filesystem::path runFile = runPath / boost::filesystem::path("run" + std::to_string(runs.size()) + ".bin");
+		runs.push_back(runFile);
+		spill = std::async(std::launch::async, MortonBulkLoader_WriteRun, this, buffer, runFile);
+
+		buffer = pcl::PointCloud<PointE57>::Ptr(new pcl::PointCloud<PointE57>);
+		buffer->reserve(runSize);
+	}
+
+	void MortonBulkLoader::Add(const pcl::PointCloud<PointE57>& cloud)
+	{
+		std::size_t pi = 0;
+		while (pi < cloud.size())
+		{
+			std::size_t numPoints = std::min(cloud.size() - pi, runSize - buffer->size());
+			buffer->points.insert(buffer->points.end(), cloud.points.begin() + pi, cloud.points.begin() + pi + numPoints);
+			buffer->width = buffer->points.size();
+			buffer->height = 1;
+			pi += numPoints;
+
+			if (buffer->size() >= runSize)
+				Spill();
+		}
+	}
+
+	uint64_t MortonBulkLoader::Flush()
+	{
+		Spill();
+		WaitSpill();
+
+		{
+			std::stringstream ss;
+			ss << "[e57::%s::Flush] Merge " << runs.size() << " runs.\n";
+			PCL_INFO(ss.str().c_str(), "MortonBulkLoader");
+		}
+
+		// K-way merge of the runs
+		std::vector<std::shared_ptr<MortonRunReader>> readers;
+		std::priority_queue<std::pair<uint64_t, std::size_t>, std::vector<std::pair<uint64_t, std::size_t>>, std::greater<std::pair<uint64_t, std::size_t>>> heap;
+		for (std::size_t ri = 0; ri < runs.size(); ++ri)
+		{
+			readers.push_back(std::shared_ptr<MortonRunReader>(new MortonRunReader(runs[ri])));
+			if (!readers[ri]->Empty())
+				heap.push(std::pair<uint64_t, std::size_t>(readers[ri]->Top().key, ri));
+		}
+
+		uint64_t numPoints = 0;
+		uint64_t leafKey = 0;
+		pcl::PointCloud<PointE57>::Ptr leaf(new pcl::PointCloud<PointE57>);
+		while (!heap.empty())
+		{
+			std::pair<uint64_t, std::size_t> top = heap.top();
+			heap.pop();
+
+			// Write the leaf once all its points are gathered, or once it reaches runSize to bound the memory usage
+			if (!leaf->empty() && ((top.first != leafKey) || (leaf->size() >= runSize)))
+			{
+				numPoints += oct->addPointCloud(leaf);
+				leaf = pcl::PointCloud<PointE57>::Ptr(new pcl::PointCloud<PointE57>);
+			}
+			leafKey = top.first;
+
+			MortonRunReader& reader = *readers[top.second];
+			leaf->push_back(reader.Top().point);
+			reader.Next();
+			if (!reader.Empty())
+				heap.push(std::pair<uint64_t, std::size_t>(reader.Top().key, top.second));
+		}
+		if (!leaf->empty())
+			numPoints += oct->addPointCloud(leaf);
+
+		// Remove the merged runs
+		readers.clear();
+		for (std::size_t ri = 0; ri < runs.size(); ++ri)
+			boost::filesystem::remove(runs[ri]);
+		runs.clear();
+
+		return numPoints;
+	}
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <vector>
+#include <future>
+
+#include <pcl/point_cloud.h>
+
+#include "E57Utils.h"
+#include "E57Converter.h"
+
+namespace e57
+{
+	// Bulk load points into OCT leaf by leaf.
+	// Added points are spilled to runs sorted by the Morton code of the OCT leaf containing them, Flush merges the runs and writes each leaf in Morton order, so leaf files are written once and sequentially instead of being appended by every scan.
+	class MortonBulkLoader
+	{
+	public:
+		struct MortonPoint
+		{
+			uint64_t key;
+			PointE57 point;
+
+			EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+		};
+		using MortonPointVector = std::vector<MortonPoint, Eigen::aligned_allocator<MortonPoint>>;
+
+	protected:
+		Converter::OCT::Ptr oct;
+		boost::filesystem::path runPath;
+		std::size_t runSize;
+		Eigen::Vector3d min;
+		Eigen::Vector3d scale;
+		int64_t numCells;
+		std::vector<boost::filesystem::path> runs;
+		pcl::PointCloud<PointE57>::Ptr buffer;
+		std::future<int> spill;
+
+		void Spill();
+		void WaitSpill();
+
+	public:
+		// runPath: A folder to store the sorted runs, it is removed with the loader.
+		// runSize: Number of points of each sorted run, this bounds the memory usage.
+		MortonBulkLoader(const Converter::OCT::Ptr& oct, const boost::filesystem::path& runPath, const std::size_t runSize);
+		~MortonBulkLoader();
+
+		// Morton code of the OCT leaf containing the point, points outside OCT are clamped to the border leaves
+		uint64_t MortonCode(const PointE57& p) const;
+
+		void Add(const pcl::PointCloud<PointE57>& cloud);
+
+		// Merge all runs into OCT, return the number of points written
+		uint64_t Flush();
+	};
+}
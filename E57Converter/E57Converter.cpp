@@ -3,7 +3,15 @@
 #include <future>
 #include <fstream>
 #include <limits>
+#include <cmath>
+#include <tuple>
+#include <functional>
 #include <algorithm> 
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <unordered_map>
+#include <condition_variable>
 
 #include <pcl/common/common.h>
 #include <pcl/common/io.h>
@@ -26,11 +34,24 @@
 
 #include "E57Utils.h"
 #include "E57Converter.h"
+#include "BoundedQueue.h"
+#include "E57BulkLoader.h"
+#include "TaskScheduler.h"
+#include "E57LeafCache.h"
+#include "E57LeafReader.h"
+#include "PCDStreamWriter.h"
+#include "E57VoxelGrid.h"
+#include "GridSearch.h"
 //#include "E57AlbedoEstimation.h"
 #include "E57BLK360HDRI.h"
+#include "E57LODBuilder.h"
 
 namespace e57
 {
+	// EstimateBounds samples scans without bounds with this stride, block by block
+	static const std::size_t estimateBoundsSampleStride = 64;
+	static const std::size_t estimateBoundsBlockSize = 1 << 20;
+
 	bool ScanInfoDirCompare(const ScanInfo& i, const ScanInfo& j) { return (i.ID < j.ID); }
 
 	void Converter::LoadScanInfo(const boost::filesystem::path& octPath)
@@ -61,14 +82,114 @@ namespace e57
 		file.close();
 	}
 
-	Converter::Converter(const boost::filesystem::path& octPath, const Eigen::Vector3d& min, const Eigen::Vector3d& max, const double resolution, const std::string& coordSys) : octPath(octPath)
+	void Converter::LoadLeafFormat(const boost::filesystem::path& octPath)
+	{
+		// OCTs created before leafFormat.txt are PCD
+		LeafFormat leafFormat;
+		std::ifstream file((octPath / boost::filesystem::path("leafFormat.txt")).string(), std::ios_base::in);
+		if (file)
+		{
+			nlohmann::json leafFormatJson;
+			file >> leafFormatJson;
+			file.close();
+			leafFormat.precision = leafFormatJson["precision"];
+			leafFormat.compress = leafFormatJson["compress"];
+		}
+		OutofcoreLeafContainer::Format() = leafFormat;
+	}
+
+	void Converter::DumpLeafFormat(const boost::filesystem::path& octPath)
+	{
+		std::ofstream file((octPath / boost::filesystem::path("leafFormat.txt")).string(), std::ios_base::out);
+		if (!file)
+			throw pcl::PCLException("Create file " + (octPath / boost::filesystem::path("leafFormat.txt")).string() + " failed.");
+
+		nlohmann::json leafFormatJson;
+		leafFormatJson["precision"] = OutofcoreLeafContainer::Format().precision;
+		leafFormatJson["compress"] = OutofcoreLeafContainer::Format().compress;
+
+		file << leafFormatJson;
+		file.close();
+	}
+
+	void Converter::LoadOCT(const bool loadAll)
+	{
+		oct.reset();
+		oct = OCT::Ptr(new OCT(octPath / boost::filesystem::path("octRoot.oct_idx"), loadAll));
+		octLoadAll = loadAll;
+	}
+
+	void Converter::UpdateNodeIndex()
+	{
+		if (!octLoadAll)
+			LoadOCT(true);
+
+		// Leaves of the previous index, by node file name
+		std::vector<OCTNodeIndex::Node>& nodes = nodeIndex.Nodes();
+		std::vector<OCTNodeIndex::Node> previousNodes;
+		previousNodes.swap(nodes);
+		std::unordered_map<std::string, const OCTNodeIndex::Node*> previousLeaves;
+		for (std::size_t i = 0; i < previousNodes.size(); ++i)
+			if (previousNodes[i].leaf)
+				previousLeaves[previousNodes[i].pcdPath.filename().string()] = &previousNodes[i];
+
+		OCT::Iterator it(*oct);
+		while (*it != nullptr)
+		{
+			OCTNodeIndex::Node node;
+			(*it)->getBoundingBox(node.minBB, node.maxBB);
+			node.depth = (*it)->getDepth();
+			node.leaf = ((*it)->getNodeType() == pcl::octree::LEAF_NODE);
+			node.numPoints = (*it)->getDataSize();
+			node.pcdPath = (*it)->getPCDFilename();
+			nodes.push_back(node);
+			it++;
+		}
+
+		// Scans of each leaf. A leaf with the same size as in the previous index keeps its scans (the same test as lodState.txt), so an append only counts the touched leaves.
+		// Others are taken from the header of compact leaves, PCD leaves are read.
+		std::size_t numCountedLeaves = 0;
+		TaskScheduler scheduler(std::max(std::thread::hardware_concurrency(), 1u));
+		for (std::size_t i = 0; i < nodes.size(); ++i)
+		{
+			if (!nodes[i].leaf || (nodes[i].numPoints == 0))
+				continue;
+			std::unordered_map<std::string, const OCTNodeIndex::Node*>::const_iterator previous = previousLeaves.find(nodes[i].pcdPath.filename().string());
+			if ((previous != previousLeaves.end()) && (previous->second->numPoints == nodes[i].numPoints))
+			{
+				nodes[i].scanBits = previous->second->scanBits;
+				nodes[i].scanCounts = previous->second->scanCounts;
+				continue;
+			}
+			if (!boost::filesystem::exists(nodes[i].pcdPath))
+				continue;
+			numCountedLeaves++;
+			scheduler.Submit([&nodes, i]()
+			{
+				std::vector<std::pair<uint32_t, uint64_t>> counts;
+				LeafReader(nodes[i].pcdPath).CountScans(counts);
+				nodes[i].SetScans(counts);
+			});
+		}
+		scheduler.Run();
+		{
+			std::stringstream ss;
+			ss << "[e57::%s::UpdateNodeIndex] Nodes " << nodes.size() << ", scans counted for " << numCountedLeaves << " leaves.\n";
+			PCL_INFO(ss.str().c_str(), "Converter");
+		}
+		nodeIndex.Dump(octPath);
+	}
+
+	Converter::Converter(const boost::filesystem::path& octPath, const Eigen::Vector3d& min, const Eigen::Vector3d& max, const double resolution, const std::string& coordSys, const LeafFormat& leafFormat) : octLoadAll(true), octPath(octPath)
 	{
 		try
 		{
+			OutofcoreLeafContainer::Format() = leafFormat;
 			oct = OCT::Ptr(new OCT(min, max, resolution, octPath / boost::filesystem::path("octRoot.oct_idx"), coordSys));
 
-			// Init scanInfo file
+			// Init scanInfo and leafFormat files
 			DumpScanInfo(octPath);
+			DumpLeafFormat(octPath);
 		}
 		catch (std::exception& ex)
 		{
@@ -82,11 +203,21 @@ namespace e57
 		}
 	}
 
-	Converter::Converter(const boost::filesystem::path& octPath) : octPath(octPath)
+	Converter::Converter(const boost::filesystem::path& octPath) : octLoadAll(true), octPath(octPath)
 	{
 		try
 		{
-			oct = OCT::Ptr(new OCT(octPath / boost::filesystem::path("octRoot.oct_idx"), true));
+			LoadLeafFormat(octPath);
+
+			// OCTs without a valid index are loaded once in full to create it
+			if (nodeIndex.Load(octPath))
+				LoadOCT(false);
+			else
+			{
+				PCL_WARN("[e57::%s::Converter] octIndex.bin is not found, load all OCT nodes and create it.\n", "Converter");
+				LoadOCT(true);
+				UpdateNodeIndex();
+			}
 
 			// Load scanInfo file
 			LoadScanInfo(octPath);
@@ -103,78 +234,290 @@ namespace e57
 		}
 	}
 
+	// Shared state of the LoadE57 pipeline: decoders -> scanQueue -> filters -> cloudQueue -> octree writer
+	struct LoadE57_Block
+	{
+		int64_t scanID;
+		std::shared_ptr<Scan> scan;
+	};
+
+	struct LoadE57_Cloud
+	{
+		int64_t scanID;
+		pcl::PointCloud<PointE57>::Ptr cloud;
+	};
+
+	struct LoadE57_Pipeline
+	{
+		BoundedQueue<LoadE57_Block> scanQueue;
+		BoundedQueue<LoadE57_Cloud> cloudQueue;
+		std::atomic<int64_t> nextScanID;
+		int64_t scanIDOffset; // ID of the first scan of the E57 in the OCT, larger than zero when appending
+		std::atomic<unsigned int> numActiveDecoders;
+		std::atomic<unsigned int> numActiveFilters;
+		std::atomic<bool> aborted;
+		std::vector<std::size_t> numValidPoints; // only accessed by the octree writer
+
+		LoadE57_Pipeline(const std::size_t queueDepth, const unsigned int numDecoders, const unsigned int numFilters, const int64_t numScans, const int64_t scanIDOffset) :
+			scanQueue(queueDepth), cloudQueue(queueDepth), nextScanID(0), scanIDOffset(scanIDOffset), numActiveDecoders(numDecoders), numActiveFilters(numFilters), aborted(false), numValidPoints(numScans, 0) {}
+
+		// Stop all stages, return true only for the first caller so that only the first error is reported
+		bool Abort()
+		{
+			bool first = !aborted.exchange(true);
+			scanQueue.Abort();
+			cloudQueue.Abort();
+			return first;
+		}
+	};
+
 	// for asyc
-	int LoadE57_LoadScan(const e57::ImageFile* imf, const e57::VectorNode* data3D, int64_t scanID, const Scanner& scanner, std::vector<std::shared_ptr<Scan>>* scanBuffer, bool p)
+	int LoadE57_DecodeScans(e57::ImageFile* imf, const Scanner& scanner, const std::size_t blockSize, const IngestFilter* filter, LoadE57_Pipeline* pipeline, std::vector<ScanInfo>* scanInfo)
 	{
-		if (scanID >= data3D->childCount())
+		try
+		{
+			// Each decoder reads through its own handle, opened and closed by LoadE57
+			e57::VectorNode data3D(imf->root().get("data3D"));
+
+			for (int64_t scanID = pipeline->nextScanID++; scanID < data3D.childCount(); scanID = pipeline->nextScanID++)
+			{
+				// Filtered out scans are not decoded
+				if (!filter->AcceptScan(scanID))
+				{
+					Scan scan(scanner);
+					scan.ID = pipeline->scanIDOffset + scanID;
+					(*scanInfo)[scan.ID] = scan;
+					std::stringstream ss;
+					ss << "[e57::LoadE57_DecodeScans] Skip - scann" << scanID << ".\n";
+					PCL_INFO(ss.str().c_str());
+					continue;
+				}
+
+				std::stringstream ss;
+				ss << "[e57::LoadE57_DecodeScans] Start - scann" << scanID << ".\n";
+				PCL_INFO(ss.str().c_str());
+
+				// The queued copy shares the point buffers, LoadBlocks allocates new buffers for the next block
+				Scan scan(scanner);
+				std::function<void(Scan&)> pushBlock = [pipeline, scanID](Scan& block)
+				{
+					// Points are labeled by the OCT scan ID
+					std::shared_ptr<Scan> queued(new Scan(block));
+					queued->ID = pipeline->scanIDOffset + scanID;
+					if (!pipeline->scanQueue.Push(LoadE57_Block{ scanID, queued }))
+						throw pcl::PCLException("LoadE57 pipeline aborted.");
+				};
+				if (blockSize > 0)
+					scan.LoadBlocks(*imf, data3D, scanID, blockSize, pushBlock);
+				else
+				{
+					scan.Load(*imf, data3D, scanID);
+					if (scan.numBufferPoints > 0)
+						pushBlock(scan);
+				}
+
+				scan.ID = pipeline->scanIDOffset + scanID;
+				(*scanInfo)[scan.ID] = scan;
+				PCL_INFO("[e57::LoadE57_DecodeScans] End.\n");
+			}
+
+			if (--pipeline->numActiveDecoders == 0)
+				pipeline->scanQueue.Close();
 			return 0;
-		
-		std::stringstream ss;
-		ss << "[e57::LoadE57_LoadScan] Start - scann" << scanID << ".\n";
-		PCL_INFO(ss.str().c_str());
-		(*scanBuffer)[p] = std::shared_ptr<Scan>(new Scan(scanner));
-		(*scanBuffer)[p]->Load(*imf, *data3D, scanID);
-		PCL_INFO("[e57::LoadE57_LoadScan] End.\n");
-		return 0;
+		}
+		catch (...)
+		{
+			if (pipeline->Abort())
+				throw;
+			return 1;
+		}
 	}
 
-	int LoadE57_MergeScan(const Converter::OCT::Ptr* oct, const uint8_t minRGB, std::vector<std::shared_ptr<Scan>>* scanBuffer, bool p)
+	int LoadE57_FilterScans(const uint8_t minRGB, const unsigned int numThreads, const IngestFilter* filter, LoadE57_Pipeline* pipeline)
 	{
-		if (!(*scanBuffer)[p])
-			return 1;
+		try
+		{
+			LoadE57_Block block;
+			while (pipeline->scanQueue.Pop(block))
+			{
+				LoadE57_Cloud cloud{ block.scanID, pcl::PointCloud<PointE57>::Ptr(new pcl::PointCloud<PointE57>) };
+				block.scan->ExtractValidPointCloud(*cloud.cloud, minRGB, numThreads, *filter);
+				block.scan.reset(); // release the point buffers before waiting on the writer
 
-		PCL_INFO("[e57::LoadE57_MergeScan] Start.\n");
+				if (!cloud.cloud->empty() && !pipeline->cloudQueue.Push(cloud))
+					return 1;
+			}
 
-		pcl::PointCloud<PointE57>::Ptr scanCloud = pcl::PointCloud<PointE57>::Ptr(new pcl::PointCloud<PointE57>);
-		(*scanBuffer)[p]->ExtractValidPointCloud(*scanCloud, minRGB);
-		(*oct)->addPointCloud(scanCloud);
+			if (--pipeline->numActiveFilters == 0)
+				pipeline->cloudQueue.Close();
+			return 0;
+		}
+		catch (...)
+		{
+			if (pipeline->Abort())
+				throw;
+			return 1;
+		}
+	}
 
-		//
-		PCL_INFO("[e57::LoadE57_MergeScan] End.\n");
-		return 0;
+	int LoadE57_WriteClouds(const Converter::OCT::Ptr* oct, MortonBulkLoader* bulkLoader, LoadE57_Pipeline* pipeline)
+	{
+		try
+		{
+			// OutofcoreOctreeBase is not thread safe, so all the clouds are merged by this single writer
+			LoadE57_Cloud cloud;
+			while (pipeline->cloudQueue.Pop(cloud))
+			{
+				if (bulkLoader)
+					bulkLoader->Add(*cloud.cloud);
+				else
+					(*oct)->addPointCloud(cloud.cloud);
+				pipeline->numValidPoints[cloud.scanID] += cloud.cloud->size();
+			}
+			return 0;
+		}
+		catch (...)
+		{
+			if (pipeline->Abort())
+				throw;
+			return 1;
+		}
 	}
 
-	void Converter::LoadE57(const boost::filesystem::path& e57Path, const double LODSamplePercent, const uint8_t minRGB, const Scanner& scanner)
+	void Converter::LoadE57(const boost::filesystem::path& e57Path, const double LODSamplePercent, const uint8_t minRGB, const Scanner& scanner, const std::size_t blockSize, const unsigned int numDecoders, const unsigned int numFilters, const std::size_t queueDepth, const std::size_t bulkRunSize, const IngestFilter& filter, const bool append)
 	{
 		try
 		{
-			e57::ImageFile imf(e57Path.string().c_str(), "r");
-			e57::VectorNode data3D(imf.root().get("data3D"));
-			e57::VectorNode images2D(imf.root().get("images2D"));
+			// Nodes are changed, the index is rebuilt by BuildLOD
+			if (!octLoadAll)
+				LoadOCT(true);
+			OCTNodeIndex::Remove(octPath);
+
+			int64_t numScans = 0;
+			{
+				e57::ImageFile imf(e57Path.string().c_str(), "r");
+				e57::VectorNode data3D(imf.root().get("data3D"));
+				numScans = data3D.childCount();
+				imf.close();
+			}
 
+			// Auto thread counts, each worker holds a whole scan (or block), so only a few decoders and filters are used, filters spread the cores over their points, the calling thread writes the octree
+			unsigned int numProcs = std::max(std::thread::hardware_concurrency(), 1u);
+			unsigned int _numDecoders = (numDecoders > 0) ? numDecoders : std::min(numProcs, 2u);
+			_numDecoders = std::max((unsigned int)std::min((int64_t)_numDecoders, numScans), 1u);
+			unsigned int _numFilters = (numFilters > 0) ? numFilters : std::min(numProcs, 2u);
+			{
+				// A decoder blocked in Push and a filter each hold one more scan (or block) than the two queues
+				std::stringstream ss;
+				ss << "[e57::%s::LoadE57] Pipeline - scans " << numScans << ", decoders " << _numDecoders << ", filters " << _numFilters << ", queueDepth " << queueDepth << ", blockSize " << blockSize << ", max scans (or blocks) in memory " << (_numDecoders + _numFilters + 2 * queueDepth + 1) << ".\n";
+				PCL_INFO(ss.str().c_str(), "Converter");
+			}
+
+			// Grid normals are estimated from the whole range image of a scan
+			std::size_t _blockSize = blockSize;
+			if (E57_CAN_CONTAIN_NORMAL && (_blockSize > 0))
+			{
+				PCL_WARN("[e57::%s::LoadE57] blockSize is ignored, scans are loaded at once to estimate normals from the scan grid.\n", "Converter");
+				_blockSize = 0;
+			}
+
+			// Points outside the OCT are rejected with the crop box, instead of being dropped by the OCT after transforming and sorting them
+			IngestFilter _filter = filter;
+			{
+				Eigen::Vector3d octMin, octMax;
+				oct->getBoundingBox(octMin, octMax);
+				_filter.cropMin = _filter.cropMin.cwiseMax(octMin);
+				_filter.cropMax = _filter.cropMax.cwiseMin(octMax);
+
+				std::stringstream ss;
+				ss << "[e57::%s::LoadE57] Filter - scanRanges " << _filter.scanRanges.size() << ", cropMin (" << _filter.cropMin.transpose() << "), cropMax (" << _filter.cropMax.transpose() << "), polygon " << _filter.polygon.size() << ", maxRange " << _filter.maxRange << ", stride " << _filter.stride << ".\n";
+				PCL_INFO(ss.str().c_str(), "Converter");
+			}
+
+			// New scans are numbered after the scans already in the OCT
+			// scanInfo is indexed by scan ID, which is also the label of points
+			int64_t scanIDOffset = 0;
+			std::vector<ScanInfo> existingScanInfo;
+			if (append)
+			{
+				existingScanInfo.swap(scanInfo);
+				for (std::vector<ScanInfo>::const_iterator it = existingScanInfo.begin(); it != existingScanInfo.end(); ++it)
+					scanIDOffset = std::max(scanIDOffset, (int64_t)it->ID + 1);
+
+				std::stringstream ss;
+				ss << "[e57::%s::LoadE57] Append - existing scans " << existingScanInfo.size() << ", first new scan ID " << scanIDOffset << ".\n";
+				PCL_INFO(ss.str().c_str(), "Converter");
+			}
 			scanInfo.clear();
+			scanInfo.resize(scanIDOffset + numScans);
+			for (std::size_t i = 0; i < scanInfo.size(); ++i)
+				scanInfo[i].ID = i;
+			for (std::vector<ScanInfo>::const_iterator it = existingScanInfo.begin(); it != existingScanInfo.end(); ++it)
+				scanInfo[it->ID] = *it;
+
+			std::shared_ptr<MortonBulkLoader> bulkLoader;
+			if (bulkRunSize > 0)
+				bulkLoader = std::shared_ptr<MortonBulkLoader>(new MortonBulkLoader(oct, octPath / boost::filesystem::path("bulkRuns"), bulkRunSize));
+
+			// Opening and closing an ImageFile initializes and terminates Xerces, which is not thread safe, so the decoder handles are only opened and closed on this thread
+			std::vector<std::shared_ptr<e57::ImageFile>> decoderFiles;
+			for (unsigned int t = 0; t < _numDecoders; ++t)
+				decoderFiles.push_back(std::shared_ptr<e57::ImageFile>(new e57::ImageFile(e57Path.string().c_str(), "r")));
+
+			LoadE57_Pipeline pipeline(queueDepth, _numDecoders, _numFilters, numScans, scanIDOffset);
+			std::vector<std::future<int>> workers;
+			try
+			{
+				for (unsigned int t = 0; t < _numDecoders; ++t)
+					workers.push_back(std::async(std::launch::async, LoadE57_DecodeScans, decoderFiles[t].get(), scanner, _blockSize, &_filter, &pipeline, &scanInfo));
+				for (unsigned int t = 0; t < _numFilters; ++t)
+					workers.push_back(std::async(std::launch::async, LoadE57_FilterScans, minRGB, std::max(numProcs / _numFilters, 1u), &_filter, &pipeline));
 
-			bool p = false;
-			std::vector<std::shared_ptr<Scan>> scanBuffer (2);
+				int rWriteClouds = LoadE57_WriteClouds(&oct, bulkLoader.get(), &pipeline);
+				for (std::size_t t = 0; t < workers.size(); ++t)
+				{
+					int rWorker = workers[t].get();
+					if (rWorker != 0) throw pcl::PCLException("LoadE57 pipeline worker failed - " + std::to_string(rWorker));
+				}
+				if (rWriteClouds != 0) throw pcl::PCLException("LoadE57_WriteClouds failed - " + std::to_string(rWriteClouds));
+
+				for (std::size_t t = 0; t < decoderFiles.size(); ++t)
+					decoderFiles[t]->close();
+			}
+			catch (...)
 			{
-				int rLoadScan = LoadE57_LoadScan(&imf, &data3D, 0, scanner, &scanBuffer, p);
-				if (rLoadScan != 0) throw pcl::PCLException("LoadE57_LoadScan failed - " + std::to_string(rLoadScan));
+				// Unblock and join the remaining workers before the pipeline goes out of scope, then release the handles they read through
+				pipeline.Abort();
+				for (std::size_t t = 0; t < workers.size(); ++t)
+					if (workers[t].valid())
+						workers[t].wait();
+				for (std::size_t t = 0; t < decoderFiles.size(); ++t)
+					if (decoderFiles[t]->isOpen())
+						decoderFiles[t]->cancel();
+				throw;
 			}
-			for (int64_t scanID = 0; scanID < data3D.childCount(); ++scanID)
+
+			for (int64_t scanID = 0; scanID < numScans; ++scanID)
+				scanInfo[scanIDOffset + scanID].numValidPoints = pipeline.numValidPoints[scanID];
+
+			// Write the OCT leaves in Morton order
+			if (bulkLoader)
 			{
-				std::future<int> loadScan = std::async(LoadE57_LoadScan, &imf, &data3D, scanID + 1, scanner, &scanBuffer, !p);
-				std::future<int> mergeScan = std::async(LoadE57_MergeScan, &oct, minRGB, &scanBuffer, p);
-				int rLoadScan = loadScan.get();
-				int rMergeScan = mergeScan.get();
-				if (rLoadScan != 0) throw pcl::PCLException("LoadE57_LoadScan failed - " + std::to_string(rLoadScan));
-				if (rMergeScan != 0) throw pcl::PCLException("LoadE57_MergeScan failed - " + std::to_string(rMergeScan));
-
-				scanInfo.push_back(*scanBuffer[p]);
-				p = !p;
+				PCL_INFO("[e57::%s::LoadE57] MortonBulkLoader flush.\n", "Converter");
+				bulkLoader->Flush();
+				bulkLoader.reset();
 			}
 
 			// Save scanInfo
 			DumpScanInfo(octPath);
 
-			// OCT buildLOD
+			// OCT buildLOD, only the branches above the leaves touched by new points are resampled
 			{
 				std::stringstream ss;
 				ss << "[e57::%s::Converter] OutOfCoreOctree buildLOD - LODSamplePercent " << LODSamplePercent << ".\n";
 				PCL_INFO(ss.str().c_str(), "Converter");
 			}
-			oct->setSamplePercent(LODSamplePercent);
-			oct->buildLOD();
-			imf.close();
+			BuildLOD(LODSamplePercent);
 		}
 		catch (e57::E57Exception& ex)
 		{
@@ -194,6 +537,126 @@ namespace e57
 		}
 	}
 
+	// Fraction of the AABB [min, max] inside the crop box and the polygon AABB of filter, assuming points spread over the AABB. Axes without extent count as inside.
+	double EstimateBounds_AcceptedFraction(const IngestFilter& filter, const Eigen::Vector3d& min, const Eigen::Vector3d& max)
+	{
+		Eigen::Vector3d clipMin = filter.cropMin;
+		Eigen::Vector3d clipMax = filter.cropMax;
+		if (filter.polygon.size() >= 3)
+		{
+			Eigen::Vector2d polygonMin = filter.polygon[0];
+			Eigen::Vector2d polygonMax = filter.polygon[0];
+			for (std::size_t i = 1; i < filter.polygon.size(); ++i)
+			{
+				polygonMin = polygonMin.cwiseMin(filter.polygon[i]);
+				polygonMax = polygonMax.cwiseMax(filter.polygon[i]);
+			}
+			clipMin.head<2>() = clipMin.head<2>().cwiseMax(polygonMin);
+			clipMax.head<2>() = clipMax.head<2>().cwiseMin(polygonMax);
+		}
+
+		double fraction = 1.0;
+		for (int a = 0; a < 3; ++a)
+		{
+			double overlap = std::min(max[a], clipMax[a]) - std::max(min[a], clipMin[a]);
+			if (overlap < 0.0)
+				return 0.0;
+			double extent = max[a] - min[a];
+			if (extent > 0.0)
+				fraction *= std::min(overlap / extent, 1.0);
+		}
+		return fraction;
+	}
+
+	bool Converter::EstimateBounds(const boost::filesystem::path& e57Path, const IngestFilter& filter, const std::size_t pointsPerLeaf, Eigen::Vector3d& min, Eigen::Vector3d& max, double& resolution)
+	{
+		try
+		{
+			e57::ImageFile imf(e57Path.string().c_str(), "r");
+			e57::VectorNode data3D(imf.root().get("data3D"));
+
+			Eigen::Vector3d _min = Eigen::Vector3d::Constant(std::numeric_limits<double>::max());
+			Eigen::Vector3d _max = Eigen::Vector3d::Constant(std::numeric_limits<double>::lowest());
+			std::size_t numPoints = 0;
+			std::size_t numSampledScans = 0;
+			for (int64_t scanID = 0; scanID < data3D.childCount(); ++scanID)
+			{
+				if (!filter.AcceptScan(scanID))
+					continue;
+
+				// Points of the scan kept by the filters, estimated from the clipped AABB or the sampled acceptance ratio
+				Scan scan;
+				Eigen::Vector3d scanMin, scanMax;
+				double acceptedFraction = 1.0;
+				if (scan.LoadBounds(data3D, scanID, filter.maxRange, scanMin, scanMax))
+				{
+					_min = _min.cwiseMin(scanMin);
+					_max = _max.cwiseMax(scanMax);
+					acceptedFraction = EstimateBounds_AcceptedFraction(filter, scanMin, scanMax);
+				}
+				else
+				{
+					// No bounds in the file, sample every estimateBoundsSampleStride-th point, only the bounds of the samples are computed
+					IngestFilter sampleFilter = filter;
+					sampleFilter.stride = filter.stride * estimateBoundsSampleStride;
+					std::size_t numTested = 0;
+					std::size_t numAccepted = 0;
+					std::function<void(Scan&)> sampleBlock = [&](Scan& block)
+					{
+						block.ExtendValidBounds(sampleFilter, _min, _max, numTested, numAccepted);
+					};
+					scan.LoadBlocks(imf, data3D, scanID, estimateBoundsBlockSize, sampleBlock);
+					acceptedFraction = (numTested > 0) ? (double)numAccepted / (double)numTested : 0.0;
+					numSampledScans++;
+				}
+				numPoints += (std::size_t)((double)(scan.numPoints / std::max(filter.stride, (std::size_t)1)) * acceptedFraction);
+			}
+			imf.close();
+
+			_min = _min.cwiseMax(filter.cropMin);
+			_max = _max.cwiseMin(filter.cropMax);
+			if ((numPoints == 0) || (_min.array() > _max.array()).any())
+				throw pcl::PCLException("No point to estimate bounds.");
+
+			// Pad the AABB, so points on the bounds of scans are inside
+			Eigen::Vector3d pad = (_max - _min) * 1e-3 + Eigen::Vector3d::Constant(1e-3);
+			_min -= pad;
+			_max += pad;
+
+			// Points of scans lie on surfaces, so the number of occupied leaves grows by 4 per level
+			double side = (_max - _min).maxCoeff();
+			int depth = 0;
+			while ((depth < 20) && ((double)numPoints / std::pow(4.0, depth) > (double)std::max(pointsPerLeaf, (std::size_t)1)))
+				depth++;
+
+			min = _min;
+			max = _max;
+			resolution = side / std::pow(2.0, depth);
+
+			std::stringstream ss;
+			ss << "[e57::%s::EstimateBounds] min (" << min.transpose() << "), max (" << max.transpose() << "), res " << resolution << ", depth " << depth << ", points " << numPoints << ", sampled scans " << numSampledScans << ".\n";
+			PCL_INFO(ss.str().c_str(), "Converter");
+			return true;
+		}
+		catch (e57::E57Exception& ex)
+		{
+			std::stringstream ss;
+			ss << "[e57::%s::EstimateBounds] Got an e57::E57Exception, what=" << ex.what() << ".\n";
+			PCL_INFO(ss.str().c_str(), "Converter");
+		}
+		catch (std::exception& ex)
+		{
+			std::stringstream ss;
+			ss << "[e57::%s::EstimateBounds] Got an std::exception, what=" << ex.what() << ".\n";
+			PCL_INFO(ss.str().c_str(), "Converter");
+		}
+		catch (...)
+		{
+			PCL_INFO("[e57::%s::EstimateBounds] Got an unknown exception.\n", "Converter");
+		}
+		return false;
+	}
+
 	struct Color
 	{
 		unsigned char r;
@@ -264,44 +727,48 @@ namespace e57
 				//
 				Eigen::Matrix4d wordToScan = it->transform.inverse();
 
-				for (pcl::PointCloud<PointPCD>::iterator cloudIT = cloud.begin(); cloudIT != cloud.end(); ++cloudIT)
-				{
-					Eigen::Vector4d scanPos(cloudIT->x, cloudIT->y, cloudIT->z, 1.0);
-					scanPos = wordToScan * scanPos;
+				if (coodSys != CoodSys::RAE)
+					throw pcl::PCLException("coodSys is not support.");
 
-					Eigen::Vector2d uv;
-					double depth = 0;
-					switch (coodSys)
-					{
-					case CoodSys::RAE:
+				// Project the cloud chunk by chunk with the batch conversion kernels
+				const std::size_t chunkSize = 65536;
+				RAEBasis raeBasis(raeMode);
+				std::vector<float> x(chunkSize), y(chunkSize), z(chunkSize), r(chunkSize), a(chunkSize), e(chunkSize), u(chunkSize), v(chunkSize);
+				for (std::size_t chunkStart = 0; chunkStart < cloud.size(); chunkStart += chunkSize)
+				{
+					std::size_t chunkPoints = std::min(chunkSize, cloud.size() - chunkStart);
+					for (std::size_t pi = 0; pi < chunkPoints; ++pi)
 					{
-						Eigen::Vector3d rae = XYZToRAE(raeMode, Eigen::Vector3d(scanPos.x(), scanPos.y(), scanPos.z()));
-						depth = rae.x();
-						uv = RAEToUV(raeMode, rae);
+						const PointPCD& cloudP = cloud[chunkStart + pi];
+						Eigen::Vector4d scanPos = wordToScan * Eigen::Vector4d(cloudP.x, cloudP.y, cloudP.z, 1.0);
+						x[pi] = scanPos.x();
+						y[pi] = scanPos.y();
+						z[pi] = scanPos.z();
 					}
-					break;
+					XYZToRAE(raeBasis, x.data(), y.data(), z.data(), r.data(), a.data(), e.data(), chunkPoints);
+					RAEToUV(raeMode, a.data(), e.data(), u.data(), v.data(), chunkPoints);
 
-					default:
-						throw pcl::PCLException("coodSys is not support.");
-						break;
-					}
-
-					std::size_t col = uv.x() * (width - 1);
-					std::size_t row = (1.0-uv.y()) * (height - 1);
-					std::size_t index = row * width + col;
-					PointPCD& scanImageP = (*scanImage)[index];
-					if (depth < scanImageP.data[3])
+					for (std::size_t pi = 0; pi < chunkPoints; ++pi)
 					{
-						scanImageP = *cloudIT;
-						scanImageP.x = uv.x();
-						scanImageP.y = uv.y();
-						scanImageP.z = depth;
-						scanImageP.data[3] = depth;
-
-						std::size_t colorIndex = cloudIT->label % colorTable.size();
-						scanImageP.r = colorTable[colorIndex].r;
-						scanImageP.g = colorTable[colorIndex].g;
-						scanImageP.b = colorTable[colorIndex].b;
+						const PointPCD& cloudP = cloud[chunkStart + pi];
+						float depth = r[pi];
+						std::size_t col = u[pi] * (width - 1);
+						std::size_t row = (1.0f - v[pi]) * (height - 1);
+						std::size_t index = row * width + col;
+						PointPCD& scanImageP = (*scanImage)[index];
+						if (depth < scanImageP.data[3])
+						{
+							scanImageP = cloudP;
+							scanImageP.x = u[pi];
+							scanImageP.y = v[pi];
+							scanImageP.z = depth;
+							scanImageP.data[3] = depth;
+
+							std::size_t colorIndex = cloudP.label % colorTable.size();
+							scanImageP.r = colorTable[colorIndex].r;
+							scanImageP.g = colorTable[colorIndex].g;
+							scanImageP.b = colorTable[colorIndex].b;
+						}
 					}
 				}
 
@@ -412,8 +879,28 @@ namespace e57
 	{
 		try
 		{
-			oct->setSamplePercent(sample_percent_arg);
-			oct->buildLOD();
+			// The builder writes the node files, so the OCT is released during the build and reloaded after it
+			if (!octLoadAll)
+				LoadOCT(true);
+			OCTNodeIndex::Remove(octPath);
+			std::size_t numSampled = 0;
+			OCTLODBuilder builder(*oct, octPath);
+			oct.reset();
+			try
+			{
+				numSampled = builder.Build(sample_percent_arg, 0);
+			}
+			catch (...)
+			{
+				LoadOCT(true);
+				throw;
+			}
+			LoadOCT(true);
+			UpdateNodeIndex();
+
+			std::stringstream ss;
+			ss << "[e57::%s::BuildLOD] Resampled nodes " << numSampled << ".\n";
+			PCL_INFO(ss.str().c_str(), "Converter");
 		}
 		catch (std::exception& ex)
 		{
@@ -526,13 +1013,218 @@ namespace e57
 		int polynomialOrder;
 		bool reconstructAlbedo;
 		bool reconstructNDF;
+		bool dedupScans = false;
 		Eigen::Vector3d minBB;
 		Eigen::Vector3d maxBB;
+		std::vector<std::pair<Eigen::Vector3d, Eigen::Vector3d>> ownedBBs;
+		std::vector<std::pair<Eigen::Vector3d, Eigen::Vector3d>> haloLeafBBs; // AABBs of all OCT leaves overlapping the halo, owned by this or other units
 		std::size_t depth;
 		double searchRadius;
+		uint64_t numPoints = 0; // points of the work unit, used to estimate the memory usage
+		std::vector<uint64_t> scanBits; // scans of the leaves in the halo (see OCTNodeIndex::Node), empty if unknown
 	};
 
-	int ExportToPCD_Query(const Converter::OCT::Ptr* oct, const std::vector<OCTQuery>* querys, const int64_t queryID, std::vector<pcl::PointCloud<PointE57>::Ptr>* rawE57CloudBuffer, bool p)
+	// Scanners of the scans in the halo of a query, packed so the per-neighbor lookups of albedo and NDF stages stay in cache.
+	struct ExportToPCD_ScannerTable
+	{
+		std::vector<int32_t> slots; // slot of each scan ID, -1 if the scan is not in the halo
+		std::vector<Eigen::Vector3d> positions;
+		std::vector<Scanner> scanners;
+
+		ExportToPCD_ScannerTable(const OCTQuery& query, const std::vector<ScanInfo>& scanInfos) : slots(scanInfos.size(), -1)
+		{
+			for (std::size_t scanID = 0; scanID < scanInfos.size(); ++scanID)
+			{
+				if (!query.scanBits.empty() && !((scanID / 64 < query.scanBits.size()) && ((query.scanBits[scanID / 64] >> (scanID % 64)) & 1)))
+					continue;
+				slots[scanID] = (int32_t)positions.size();
+				positions.push_back(scanInfos[scanID].position);
+				scanners.push_back(scanInfos[scanID].scanner);
+			}
+		}
+
+		// Slot of a scan ID, -1 if it is not in the halo
+		int32_t Slot(const uint32_t scanID) const { return (scanID < slots.size()) ? slots[scanID] : -1; }
+	};
+
+	// Create a copy of query per work unit of the leaves, in Morton order, and a halo cache for them.
+	// If the leaves have different depths, return nullptr and create a query per leaf, unitPoints is ignored.
+	std::shared_ptr<LeafHaloCache> ExportToPCD_WorkUnits(const OCTNodeIndex* nodeIndex, const OCTQuery& query, const std::size_t unitPoints, std::vector<OCTQuery>* querys)
+	{
+		std::vector<const LeafHaloCache::Node*> nodes;
+		for (const OCTNodeIndex::Node& node : nodeIndex->Nodes())
+			if (node.leaf)
+				nodes.push_back(&node);
+
+		querys->clear();
+		if (!LeafHaloCache::IsUniform(nodes))
+		{
+			Eigen::Vector3d extXYZ(query.searchRadius, query.searchRadius, query.searchRadius);
+			for (std::size_t i = 0; i < nodes.size(); ++i)
+			{
+				OCTQuery leafQuery = query;
+				leafQuery.minBB = nodes[i]->minBB;
+				leafQuery.maxBB = nodes[i]->maxBB;
+				leafQuery.ownedBBs.push_back(std::pair<Eigen::Vector3d, Eigen::Vector3d>(nodes[i]->minBB, nodes[i]->maxBB));
+				leafQuery.depth = nodes[i]->depth;
+				leafQuery.numPoints = nodes[i]->numPoints;
+				Eigen::Vector3d extMinBB = leafQuery.minBB - extXYZ;
+				Eigen::Vector3d extMaxBB = leafQuery.maxBB + extXYZ;
+				for (std::size_t ni = 0; ni < nodes.size(); ++ni)
+					if ((nodes[ni]->minBB.array() <= extMaxBB.array()).all() && (nodes[ni]->maxBB.array() >= extMinBB.array()).all())
+						leafQuery.haloLeafBBs.push_back(std::pair<Eigen::Vector3d, Eigen::Vector3d>(nodes[ni]->minBB, nodes[ni]->maxBB));
+				querys->push_back(leafQuery);
+			}
+			return std::shared_ptr<LeafHaloCache>();
+		}
+
+		std::vector<WorkUnit> workUnits = LeafHaloCache::PlanWorkUnits(nodes, unitPoints, query.searchRadius);
+		for (std::size_t i = 0; i < workUnits.size(); ++i)
+		{
+			OCTQuery unitQuery = query;
+			unitQuery.minBB = workUnits[i].minBB;
+			unitQuery.maxBB = workUnits[i].maxBB;
+			unitQuery.ownedBBs = workUnits[i].ownedBBs;
+			unitQuery.depth = nodes.empty() ? 0 : nodes[0]->depth;
+			unitQuery.numPoints = workUnits[i].numPoints;
+			querys->push_back(unitQuery);
+		}
+		std::shared_ptr<LeafHaloCache> cache(new LeafHaloCache(nodes, workUnits, query.searchRadius));
+
+		// Scans of a unit are the scans of the leaves in its halo, known from the index without reading points
+		for (std::size_t i = 0; i < querys->size(); ++i)
+		{
+			const std::vector<std::size_t>& neighbors = cache->Neighbors(i);
+			for (std::size_t ni = 0; ni < neighbors.size(); ++ni)
+			{
+				OCTNodeIndex::OrScanBits(nodes[neighbors[ni]]->scanBits, (*querys)[i].scanBits);
+				(*querys)[i].haloLeafBBs.push_back(std::pair<Eigen::Vector3d, Eigen::Vector3d>(nodes[neighbors[ni]]->minBB, nodes[neighbors[ni]]->maxBB));
+			}
+		}
+		return cache;
+	}
+
+	// Estimated peak bytes per leaf point of ExportToPCD_Query and ExportToPCD_Process, the queried halo is read straight into PointExchange
+	const std::size_t ExportToPCD_PointBytes = sizeof(PointE57) + 2 * sizeof(PointExchange) + sizeof(PointPCD);
+
+	// Work units start and are committed in unit order, a unit keeps its memory until it is committed, so finished units waiting for a slower one stay in the budget.
+	// Decoded leaves resident in the halo cache are charged to the budget too. A unit always starts if no other unit holds memory, so a unit larger than the budget still runs alone.
+	// Units must be submitted to a TaskScheduler in unit order, so the next unit to start is always taken by a worker.
+	template<typename CommitFunc>
+	struct ExportToPCD_CommitQueue
+	{
+		std::size_t capacity;
+		std::size_t used;
+		std::size_t nextStart;
+		std::size_t nextCommit;
+		bool failed;
+		std::vector<pcl::PointCloud<PointPCD>::Ptr> clouds;
+		std::vector<std::size_t> amounts;
+		const LeafHaloCache* cache;
+		CommitFunc commit;
+		std::mutex mutex;
+		std::condition_variable changed;
+
+		ExportToPCD_CommitQueue(const std::size_t capacity, const std::size_t numUnits, const LeafHaloCache* cache, CommitFunc commit) :
+			capacity(capacity), used(0), nextStart(0), nextCommit(0), failed(false), clouds(numUnits), amounts(numUnits, 0), cache(cache), commit(commit) {}
+
+		std::size_t CacheBytes() const { return (cache != nullptr) ? (std::size_t)cache->NumResidentPoints() * sizeof(PointE57) : 0; }
+
+		// Wait for the turn of unitID and for its memory, throw if another unit failed
+		void Start(const std::size_t unitID, const std::size_t amount)
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			changed.wait(lock, [&]()
+			{
+				if (failed)
+					return true;
+				if (nextStart != unitID)
+					return false;
+				std::size_t inUse = used + CacheBytes();
+				return (used == 0) || ((inUse <= capacity) && (amount <= capacity - inUse));
+			});
+			if (failed)
+				throw pcl::PCLException("ExportToPCD another work unit failed");
+			used += amount;
+			amounts[unitID] = amount;
+			nextStart++;
+			changed.notify_all();
+		}
+
+		// Commit the finished units in unit order and release their memory
+		void Finish(const std::size_t unitID, const pcl::PointCloud<PointPCD>::Ptr& cloud)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			clouds[unitID] = cloud;
+			for (; (nextCommit < clouds.size()) && clouds[nextCommit]; ++nextCommit)
+			{
+				commit(*clouds[nextCommit]);
+				clouds[nextCommit].reset();
+				used -= amounts[nextCommit];
+			}
+			changed.notify_all();
+		}
+
+		// Wake the waiting units so they stop
+		void Fail()
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			failed = true;
+			changed.notify_all();
+		}
+	};
+
+	// Index of the half open AABB containing p, -1 if none
+	inline int64_t ExportToPCD_FindBB(const std::vector<std::pair<Eigen::Vector3d, Eigen::Vector3d>>& BBs, const Eigen::Vector3d& p)
+	{
+		for (std::size_t i = 0; i < BBs.size(); ++i)
+			if ((p.array() >= BBs[i].first.array()).all() && (p.array() < BBs[i].second.array()).all())
+				return (int64_t)i;
+		return -1;
+	}
+
+	// Each voxel with points has exactly one owner work unit. Owned AABBs tile the OCT leaves and are half open, so a voxel on a seam has one owner.
+	// A voxel whose centre is in a leaf is owned by the unit containing the centre. Otherwise (the centre is in an empty cell or outside the OCT) the centre is clamped into the leaf of the smallest point of the voxel,
+	// only units seeing the whole voxel in their halo decide it, so they all see the same smallest point. This needs searchRadius >= voxelUnit.
+	inline bool ExportToPCD_OwnsVoxel(const OCTQuery& query, const Eigen::Vector3d& voxelCentre, const Eigen::Vector3d& voxelMinPoint)
+	{
+		if (ExportToPCD_FindBB(query.haloLeafBBs, voxelCentre) >= 0)
+			return ExportToPCD_FindBB(query.ownedBBs, voxelCentre) >= 0;
+
+		Eigen::Vector3d halfVoxel = Eigen::Vector3d::Constant(0.5 * query.voxelUnit);
+		Eigen::Vector3d extXYZ(query.searchRadius, query.searchRadius, query.searchRadius);
+		if (!((voxelCentre - halfVoxel).array() >= (query.minBB - extXYZ).array()).all() || !((voxelCentre + halfVoxel).array() <= (query.maxBB + extXYZ).array()).all())
+			return false;
+
+		// Leaf of the smallest point, a point on a face next to an empty cell is taken by the nearest leaf, ties are broken by the leaf AABB
+		int64_t leafID = ExportToPCD_FindBB(query.haloLeafBBs, voxelMinPoint);
+		if (leafID < 0)
+		{
+			double minDistance = std::numeric_limits<double>::max();
+			for (std::size_t i = 0; i < query.haloLeafBBs.size(); ++i)
+			{
+				const std::pair<Eigen::Vector3d, Eigen::Vector3d>& BB = query.haloLeafBBs[i];
+				double distance = (voxelMinPoint - voxelMinPoint.cwiseMax(BB.first).cwiseMin(BB.second)).norm();
+				if ((leafID < 0) || (distance < minDistance) || ((distance == minDistance) &&
+					(std::make_tuple(BB.first.x(), BB.first.y(), BB.first.z()) < std::make_tuple(query.haloLeafBBs[leafID].first.x(), query.haloLeafBBs[leafID].first.y(), query.haloLeafBBs[leafID].first.z()))))
+				{
+					leafID = (int64_t)i;
+					minDistance = distance;
+				}
+			}
+			if (leafID < 0)
+				return false;
+		}
+
+		// The clamped centre is inside the half open leaf, so it is in exactly one owned AABB
+		const std::pair<Eigen::Vector3d, Eigen::Vector3d>& leafBB = query.haloLeafBBs[leafID];
+		Eigen::Vector3d clampedCentre;
+		for (int a = 0; a < 3; ++a)
+			clampedCentre[a] = std::min(std::max(voxelCentre[a], leafBB.first[a]), std::nextafter(leafBB.second[a], leafBB.first[a]));
+		return ExportToPCD_FindBB(query.ownedBBs, clampedCentre) >= 0;
+	}
+
+	int ExportToPCD_Query(const OCTNodeIndex* nodeIndex, LeafHaloCache* cache, const std::vector<OCTQuery>* querys, const int64_t queryID, std::vector<pcl::PointCloud<PointExchange>::Ptr>* rawE57CloudBuffer, bool p)
 	{
 		if (queryID >= querys->size())
 			return 0;
@@ -542,21 +1234,38 @@ namespace e57
 		PCL_INFO(ss.str().c_str());
 
 		//
-		Eigen::Vector3d extMinBB;
-		Eigen::Vector3d extMaxBB;
-		Eigen::Vector3d extXYZ((*querys)[queryID].searchRadius, (*querys)[queryID].searchRadius, (*querys)[queryID].searchRadius);
-		extMinBB = (*querys)[queryID].minBB - extXYZ;
-		extMaxBB = (*querys)[queryID].maxBB + extXYZ;
-
-		pcl::PCLPointCloud2::Ptr blob(new pcl::PCLPointCloud2);
-		(*oct)->queryBoundingBox(extMinBB, extMaxBB, (*querys)[queryID].depth, blob);
-		(*rawE57CloudBuffer)[p] = pcl::PointCloud<PointE57>::Ptr(new pcl::PointCloud<PointE57>());
-		pcl::fromPCLPointCloud2(*blob, *(*rawE57CloudBuffer)[p]);
+		(*rawE57CloudBuffer)[p] = pcl::PointCloud<PointExchange>::Ptr(new pcl::PointCloud<PointExchange>());
+		if (cache != nullptr)
+		{
+			cache->Query(queryID, *(*rawE57CloudBuffer)[p]);
+		}
+		else
+		{
+			Eigen::Vector3d extMinBB;
+			Eigen::Vector3d extMaxBB;
+			Eigen::Vector3d extXYZ((*querys)[queryID].searchRadius, (*querys)[queryID].searchRadius, (*querys)[queryID].searchRadius);
+			extMinBB = (*querys)[queryID].minBB - extXYZ;
+			extMaxBB = (*querys)[queryID].maxBB + extXYZ;
+
+			// Same points as OCT::queryBoundingBox, read by LeafReader instead of through pcl::PCLPointCloud2
+			std::vector<const OCTNodeIndex::Node*> leafNodes;
+			nodeIndex->QueryBBIntersects(extMinBB, extMaxBB, (*querys)[queryID].depth, leafNodes);
+			for (std::size_t i = 0; i < leafNodes.size(); ++i)
+				if (boost::filesystem::exists(leafNodes[i]->pcdPath))
+					LeafReader(leafNodes[i]->pcdPath).Read(*(*rawE57CloudBuffer)[p], &extMinBB, &extMaxBB);
+		}
 		PCL_INFO("[e57::ExportToPCD_Query] End.\n");
 		return 0;
 	}
 	
-	int ExportToPCD_Process(const std::vector<OCTQuery>* querys, const int64_t queryID, std::vector<pcl::PointCloud<PointE57>::Ptr>* rawE57CloudBuffer, bool p, const std::vector<ScanInfo>* scanInfos, pcl::PointCloud<PointPCD>::Ptr* outPointCloud)
+	GridSearch<PointExchange>::Ptr ExportToPCD_BuildIndex(const pcl::PointCloud<PointExchange>::ConstPtr cloud, const double searchRadius)
+	{
+		GridSearch<PointExchange>::Ptr index(new GridSearch<PointExchange>(searchRadius));
+		index->setInputCloud(cloud);
+		return index;
+	}
+
+	int ExportToPCD_Process(const std::vector<OCTQuery>* querys, const int64_t queryID, std::vector<pcl::PointCloud<PointExchange>::Ptr>* rawE57CloudBuffer, bool p, const std::vector<ScanInfo>* scanInfos, const int numThreads, pcl::PointCloud<PointPCD>::Ptr* outPointCloud)
 	{
 		if (queryID >= querys->size())
 			return 0;
@@ -571,24 +1280,44 @@ namespace e57
 		PCL_INFO(ss.str().c_str());
 
 		//
-		pcl::PointCloud<PointExchange>::Ptr rawE57Cloud(new pcl::PointCloud<PointExchange>());
-		rawE57Cloud->resize((*rawE57CloudBuffer)[p]->size());
-		for (std::size_t pi = 0; pi < rawE57Cloud->size(); ++pi)
-			(*rawE57Cloud)[pi] = (*(*rawE57CloudBuffer)[p])[pi];
-		pcl::search::KdTree<PointExchange>::Ptr rawE57Cloud_tree(new pcl::search::KdTree<PointExchange>());
+		pcl::PointCloud<PointExchange>::Ptr rawE57Cloud = (*rawE57CloudBuffer)[p];
+
+		// Overlap Deduplication, keep only the best scan of each voxel before all other stages. A halo of a single scan has no overlap.
+		if ((*querys)[queryID].dedupScans && (OCTNodeIndex::CountScanBits((*querys)[queryID].scanBits) == 1))
+			PCL_INFO("[e57::ExportToPCD_Process] Overlap Deduplication - skipped, the halo has a single scan.\n");
+		else if ((*querys)[queryID].dedupScans)
+		{
+			PCL_INFO("[e57::ExportToPCD_Process] Overlap Deduplication.\n");
+
+			pcl::PointCloud<PointExchange>::Ptr rawE57Cloud_BS(new pcl::PointCloud<PointExchange>());
+			VoxelGridBestScan(*rawE57Cloud, (*querys)[queryID].voxelUnit, *scanInfos, *rawE57Cloud_BS, numThreads);
+
+			std::stringstream ss;
+			ss << "[e57::ExportToPCD_Process] Overlap Deduplication - inSize, outSize: " << rawE57Cloud->size() << ", " << rawE57Cloud_BS->size() << ".\n";
+			PCL_INFO(ss.str().c_str());
+			rawE57Cloud = rawE57Cloud_BS;
+		}
+
+		// Spatial indexes are built once per cloud and shared by all stages, the index of rawE57Cloud is only used by albedo so it is built in background
+		std::future<GridSearch<PointExchange>::Ptr> rawE57Cloud_index;
+		if ((*querys)[queryID].reconstructAlbedo)
+			rawE57Cloud_index = std::async(std::launch::async, ExportToPCD_BuildIndex, pcl::PointCloud<PointExchange>::ConstPtr(rawE57Cloud), (*querys)[queryID].searchRadius);
 
 		pcl::PointCloud<PointExchange>::Ptr e57Cloud(new pcl::PointCloud<PointExchange>);
-		pcl::search::KdTree<PointExchange>::Ptr e57Cloud_tree(new pcl::search::KdTree<PointExchange>());
+		GridSearch<PointExchange>::Ptr e57Cloud_index;
 
-		// DownSampling
+		// DownSampling, owned tells if each point of e57Cloud is in a voxel owned by this leaf
+		std::vector<uint8_t> owned;
 		{
 			PCL_INFO("[e57::ExportToPCD_Process] DownSampling.\n");
-			pcl::VoxelGrid<PointExchange> vf;
-			vf.setLeafSize((*querys)[queryID].voxelUnit, (*querys)[queryID].voxelUnit, (*querys)[queryID].voxelUnit);
-			vf.setInputCloud(rawE57Cloud);
-			vf.filter(*e57Cloud);
+			std::vector<Eigen::Vector3d> voxelCentres;
+			std::vector<Eigen::Vector3d> voxelMinPoints;
+			VoxelGridDownsample(*rawE57Cloud, (*querys)[queryID].voxelUnit, *e57Cloud, numThreads, &voxelCentres, &voxelMinPoints);
+			owned.resize(voxelCentres.size());
+			for (std::size_t pi = 0; pi < voxelCentres.size(); ++pi)
+				owned[pi] = ExportToPCD_OwnsVoxel((*querys)[queryID], voxelCentres[pi], voxelMinPoints[pi]);
 			std::stringstream ss;
-			ss << "[e57::ExportToPCD_Process] DownSampling - inSize, outSize: " << (*rawE57CloudBuffer)[p]->size() << ", " << e57Cloud->size() << ".\n";
+			ss << "[e57::ExportToPCD_Process] DownSampling - inSize, outSize: " << rawE57Cloud->size() << ", " << e57Cloud->size() << ".\n";
 			PCL_INFO(ss.str().c_str());
 		}
 
@@ -601,8 +1330,17 @@ namespace e57
 			pcl::StatisticalOutlierRemoval<PointExchange> olr;
 			olr.setMeanK((*querys)[queryID].meanK);
 			olr.setStddevMulThresh(1.0);
+			e57Cloud_index = ExportToPCD_BuildIndex(e57Cloud, (*querys)[queryID].searchRadius);
+			olr.setSearchMethod(e57Cloud_index);
 			olr.setInputCloud(e57Cloud);
-			olr.filter(*e57Cloud_OLR);
+			std::vector<int> indices;
+			olr.filter(indices);
+			pcl::copyPointCloud(*e57Cloud, indices, *e57Cloud_OLR);
+
+			std::vector<uint8_t> owned_OLR(indices.size());
+			for (std::size_t i = 0; i < indices.size(); ++i)
+				owned_OLR[i] = owned[indices[i]];
+			owned.swap(owned_OLR);
 
 			std::stringstream ss;
 			ss << "[e57::ExportToPCD_Process] Outlier Removal - inSize, outSize: " << e57Cloud->size() << ", " << e57Cloud_OLR->size() << ".\n";
@@ -610,7 +1348,9 @@ namespace e57
 			e57Cloud = e57Cloud_OLR;
 		}
 
-		
+		if (!e57Cloud_index || (e57Cloud_index->getInputCloud() != e57Cloud))
+			e57Cloud_index = ExportToPCD_BuildIndex(e57Cloud, (*querys)[queryID].searchRadius);
+
 		// Estimat Surface
 		if ((*querys)[queryID].polynomialOrder > 0)
 		{
@@ -620,37 +1360,85 @@ namespace e57
 			pcl::MovingLeastSquares<PointExchange, PointExchange> mls;
 			mls.setComputeNormals(PCD_CAN_CONTAIN_NORMAL);
 			mls.setPolynomialOrder((*querys)[queryID].polynomialOrder);
-			mls.setSearchMethod(e57Cloud_tree);
+			mls.setSearchMethod(e57Cloud_index);
 			mls.setSearchRadius((*querys)[queryID].searchRadius);
 			mls.setInputCloud(e57Cloud);
-			mls.process(*e57Cloud);			
+			pcl::PointCloud<PointExchange>::Ptr e57Cloud_MLS(new pcl::PointCloud<PointExchange>);
+			mls.process(*e57Cloud_MLS);
+
+			pcl::PointIndicesPtr indices = mls.getCorrespondingIndices();
+			std::vector<uint8_t> owned_MLS(indices->indices.size());
+			for (std::size_t i = 0; i < indices->indices.size(); ++i)
+				owned_MLS[i] = owned[indices->indices[i]];
+			owned.swap(owned_MLS);
+			e57Cloud = e57Cloud_MLS;
 		}
 		else // Estimat Normal
 		{
 			if (PCD_CAN_CONTAIN_NORMAL)
 			{
-				PCL_INFO("[e57::ExportToPCD_Process] Estimat Normal.\n");
+				// Points with normals estimated from the scan grid at ingest are kept, the others are estimated here
+				pcl::IndicesPtr missingNormals(new std::vector<int>);
+				if (E57_CAN_CONTAIN_NORMAL)
+				{
+					for (std::size_t pi = 0; pi < e57Cloud->size(); ++pi)
+					{
+						const PointExchange& point = (*e57Cloud)[pi];
+						if ((point.normal_x == 0.f) && (point.normal_y == 0.f) && (point.normal_z == 0.f))
+							missingNormals->push_back(static_cast<int>(pi));
+					}
+				}
+
+				std::stringstream ss;
+				ss << "[e57::ExportToPCD_Process] Estimat Normal - size, gridNormals: " << e57Cloud->size() << ", " << (E57_CAN_CONTAIN_NORMAL ? e57Cloud->size() - missingNormals->size() : 0) << ".\n";
+				PCL_INFO(ss.str().c_str());
 
 				//
-				pcl::NormalEstimationOMP<PointExchange, PointExchange> ne;
-				ne.setSearchMethod(e57Cloud_tree);
-				ne.setRadiusSearch((*querys)[queryID].searchRadius);
-				ne.setSearchSurface(e57Cloud);
-				ne.setInputCloud(e57Cloud);
-				ne.compute(*e57Cloud);
+				if (!E57_CAN_CONTAIN_NORMAL || (missingNormals->size() == e57Cloud->size()))
+				{
+					pcl::NormalEstimationOMP<PointExchange, PointExchange> ne;
+					ne.setNumberOfThreads(numThreads);
+					ne.setSearchMethod(e57Cloud_index);
+					ne.setRadiusSearch((*querys)[queryID].searchRadius);
+					ne.setSearchSurface(e57Cloud);
+					ne.setInputCloud(e57Cloud);
+					ne.compute(*e57Cloud);
+				}
+				else if (!missingNormals->empty())
+				{
+					pcl::PointCloud<PointExchange> e57Cloud_NE;
+					pcl::NormalEstimationOMP<PointExchange, PointExchange> ne;
+					ne.setNumberOfThreads(numThreads);
+					ne.setSearchMethod(e57Cloud_index);
+					ne.setRadiusSearch((*querys)[queryID].searchRadius);
+					ne.setSearchSurface(e57Cloud);
+					ne.setInputCloud(e57Cloud);
+					ne.setIndices(missingNormals);
+					ne.compute(e57Cloud_NE);
+
+					for (std::size_t i = 0; i < missingNormals->size(); ++i)
+					{
+						PointExchange& point = (*e57Cloud)[(*missingNormals)[i]];
+						point.normal_x = e57Cloud_NE[i].normal_x;
+						point.normal_y = e57Cloud_NE[i].normal_y;
+						point.normal_z = e57Cloud_NE[i].normal_z;
+						point.curvature = e57Cloud_NE[i].curvature;
+					}
+				}
 			}
 		}
 
-		// Crop Box
+		// Crop owned voxels
 		pcl::PointCloud<PointExchange>::Ptr e57Cloud_CB(new pcl::PointCloud<PointExchange>);
 		{
 			PCL_INFO("[e57::ExportToPCD_Process] Crop Box.\n");
 
-			pcl::CropBox<PointExchange> cb;
-			cb.setMin(Eigen::Vector4f((*querys)[queryID].minBB.x(), (*querys)[queryID].minBB.y(), (*querys)[queryID].minBB.z(), 1.0));
-			cb.setMax(Eigen::Vector4f((*querys)[queryID].maxBB.x(), (*querys)[queryID].maxBB.y(), (*querys)[queryID].maxBB.z(), 1.0));
-			cb.setInputCloud(e57Cloud);
-			cb.filter(*e57Cloud_CB);
+			e57Cloud_CB->reserve(e57Cloud->size());
+			for (std::size_t pi = 0; pi < e57Cloud->size(); ++pi)
+			{
+				if (owned[pi])
+					e57Cloud_CB->push_back((*e57Cloud)[pi]);
+			}
 
 			std::stringstream ss;
 			ss << "[e57::ExportToPCD_Process] Crop Box - inSize, outSize: " << e57Cloud->size() << ", " << e57Cloud_CB->size() << ".\n";
@@ -665,11 +1453,11 @@ namespace e57
 			//
 			PCL_INFO("[e57::ExportToPCD_Process] Estimat Albedo - Upsampling Normal.\n");
 			{
-				if (e57Cloud_tree->getInputCloud() != e57Cloud)
-					e57Cloud_tree->setInputCloud(e57Cloud);
+				if (e57Cloud_index->getInputCloud() != e57Cloud)
+					e57Cloud_index = ExportToPCD_BuildIndex(e57Cloud, (*querys)[queryID].searchRadius);
 
 #ifdef _OPENMP
-#pragma omp parallel for num_threads(omp_get_num_procs())
+#pragma omp parallel for num_threads(numThreads)
 #endif
 				// Iterating over the entire index vector
 				for (int px = 0; px < static_cast<int> (rawE57Cloud->size()); ++px)
@@ -677,7 +1465,7 @@ namespace e57
 					PointExchange& point = (*rawE57Cloud)[px];
 					std::vector<int> ki;
 					std::vector<float> kd;
-					if (e57Cloud_tree->nearestKSearch(point, 1, ki, kd) > 0)
+					if (e57Cloud_index->nearestKSearch(point, 1, ki, kd) > 0)
 					{
 						PointExchange& kPoint = (*e57Cloud)[ki[0]];
 						point.normal_x = kPoint.normal_x;
@@ -704,11 +1492,10 @@ namespace e57
 				ae.setInputCloud(e57Cloud_CB);
 				ae.compute(*(*outPointCloud));*/
 
-				if (rawE57Cloud_tree->getInputCloud() != rawE57Cloud)
-					rawE57Cloud_tree->setInputCloud(rawE57Cloud);
+				GridSearch<PointExchange>::Ptr rawE57Cloud_tree = rawE57Cloud_index.get();
 
 				//
-				LinearSolver linearSolver = LinearSolver::EIGEN_SVD;
+				LinearSolver linearSolver = LinearSolver::EIGEN_NE_FIXED;
 				double distInterParm = 10.0;
 				double angleInterParm = 20.0;
 				double frontInterParm = 5.0;
@@ -717,9 +1504,10 @@ namespace e57
 				double radius = (*querys)[queryID].searchRadius;
 				Eigen::Vector3d tempVec(1.0, 1.0, 1.0);
 				tempVec /= tempVec.norm();
+				const ExportToPCD_ScannerTable scannerTable((*querys)[queryID], *scanInfos);
 
 #ifdef _OPENMP
-#pragma omp parallel for shared (e57Cloud_CB) num_threads(omp_get_num_procs())
+#pragma omp parallel for shared (e57Cloud_CB) num_threads(numThreads)
 #endif
 				for (int px = 0; px < static_cast<int> (e57Cloud_CB->size()); ++px)
 				{
@@ -743,14 +1531,18 @@ namespace e57
 							{
 								PointExchange& kPoint = (*rawE57Cloud)[ki[k]];
 								double d = std::sqrt(kd[k]);
+								const int32_t scanSlot = scannerTable.Slot(kPoint.label);
 								if (d > radius)
 								{
 									PCL_WARN("[e57::ExportToPCD_Process] distance is larger then radius!!? Ignore.\n");
 								}
+								else if (scanSlot < 0)
+								{
+									PCL_WARN("[e57::ExportToPCD_Process] point label is not a scan of the halo!!? Ignore.\n");
+								}
 								else
 								{
 									ScannLaserInfo scannLaserInfo;
-									const ScanInfo& scanScanInfo = (*scanInfos)[kPoint.label];
 									scannLaserInfo.hitNormal = Eigen::Vector3d(kPoint.normal_x, kPoint.normal_y, kPoint.normal_z);
 									if (std::abs(scannLaserInfo.hitNormal.norm() - 1.0) > 0.05)
 									{
@@ -762,22 +1554,18 @@ namespace e57
 										if (dotNN > cutGrazing)
 										{
 											scannLaserInfo.hitPosition = Eigen::Vector3d(kPoint.x, kPoint.y, kPoint.z);
-											switch (scanScanInfo.scanner)
+											switch (scannerTable.scanners[scanSlot])
 											{
 											case Scanner::BLK360:
 											{
-												scannLaserInfo.incidentDirection = scanScanInfo.position - scannLaserInfo.hitPosition;
+												scannLaserInfo.incidentDirection = scannerTable.positions[scanSlot] - scannLaserInfo.hitPosition;
 												scannLaserInfo.hitDistance = scannLaserInfo.incidentDirection.norm();
 												scannLaserInfo.incidentDirection /= scannLaserInfo.hitDistance;
 												if (scannLaserInfo.incidentDirection.dot(pointNormal) < 0)
 													scannLaserInfo.incidentDirection *= -1.0;
 												scannLaserInfo.reflectedDirection = scannLaserInfo.incidentDirection; // BLK360 
 
-												// Ref - BLK 360 Spec - laser wavelength & Beam divergence : https://lasers.leica-geosystems.com/global/sites/lasers.leica-geosystems.com.global/files/leica_media/product_documents/blk/853811_leica_blk360_um_v2.0.0_en.pdf
-												// Ref - Gaussian beam : https://en.wikipedia.org/wiki/Gaussian_beam
-												// Ref - Beam divergence to Beam waist(w0) : http://www2.nsysu.edu.tw/optics/laser/angle.htm
-												double temp = scannLaserInfo.hitDistance / 26.2854504782;
-												scannLaserInfo.beamFalloff = 1.0f / (1 + temp * temp);
+												scannLaserInfo.beamFalloff = BeamFalloff(scannLaserInfo.hitDistance);
 												if ((scannLaserInfo.beamFalloff > cutFalloff))
 												{
 													scannLaserInfo.hitTangent = scannLaserInfo.hitNormal.cross(tempVec);
@@ -810,60 +1598,7 @@ namespace e57
 						}
 						if (scannLaserInfos.size() > 0)
 						{
-							Eigen::MatrixXf A;
-							Eigen::MatrixXf B;
-							A = Eigen::MatrixXf(scannLaserInfos.size() * 3, 3);
-							B = Eigen::MatrixXf(scannLaserInfos.size() * 3, 1);
-
-							std::size_t shifter = 0;
-							for (std::vector<ScannLaserInfo>::const_iterator it = scannLaserInfos.begin(); it != scannLaserInfos.end(); ++it)
-							{
-								A(shifter, 0) = it->weight * it->incidentDirection.x();
-								A(shifter, 1) = it->weight * it->incidentDirection.y();
-								A(shifter, 2) = it->weight * it->incidentDirection.z();
-								B(shifter, 0) = it->weight * (it->intensity / it->beamFalloff);
-
-								A(shifter + 1, 0) = it->weight * it->hitTangent.x();
-								A(shifter + 1, 1) = it->weight * it->hitTangent.y();
-								A(shifter + 1, 2) = it->weight * it->hitTangent.z();
-								B(shifter + 1, 0) = 0.0;
-
-								A(shifter + 2, 0) = it->weight * it->hitBitangent.x();
-								A(shifter + 2, 1) = it->weight * it->hitBitangent.y();
-								A(shifter + 2, 2) = it->weight * it->hitBitangent.z();
-								B(shifter + 2, 0) = 0.0;
-
-								shifter += 3;
-							}
-
-							Eigen::MatrixXf X;
-							switch (linearSolver)
-							{
-							case LinearSolver::EIGEN_QR:
-							{
-								X = A.colPivHouseholderQr().solve(B);
-							}
-							break;
-							case LinearSolver::EIGEN_SVD:
-							{
-								X = A.bdcSvd(Eigen::ComputeThinU | Eigen::ComputeThinV).solve(B);
-							}
-							break;
-							case LinearSolver::EIGEN_NE:
-							{
-								Eigen::MatrixXf localAT = A.transpose();
-								X = (localAT * A).ldlt().solve(localAT * B);
-							}
-							break;
-							default:
-							{
-								throw pcl::PCLException("LinearSolver is not supported.");
-							}
-							break;
-							}
-
-							//
-							Eigen::Vector3d xVec(X(0, 0), X(1, 0), X(2, 0));
+							Eigen::Vector3d xVec = SolveScannLaserInfos(scannLaserInfos, linearSolver);
 							if (std::isfinite(xVec.x()) && std::isfinite(xVec.y()) && std::isfinite(xVec.z()))
 							{
 								double xVecNorm = xVec.norm();
@@ -917,16 +1652,20 @@ namespace e57
 			}
 
 		}
-		(*outPointCloud)->resize(e57Cloud_CB->size());
-				for (std::size_t pi = 0; pi < e57Cloud_CB->size(); ++pi)
-					(*(*outPointCloud))[pi] = (*e57Cloud_CB)[pi];
+		else
+		{
+			(*outPointCloud)->resize(e57Cloud_CB->size());
+			for (std::size_t pi = 0; pi < e57Cloud_CB->size(); ++pi)
+				(*(*outPointCloud))[pi] = (*e57Cloud_CB)[pi];
+		}
 		//
 		PCL_INFO("[e57::ExportToPCD_Process] End. \n");
 		return 0;
 	}
 
-	void Converter::ExportToPCD(const double voxelUnit, const unsigned int searchRadiusNumVoxels, const int meanK, const int polynomialOrder, bool reconstructAlbedo, bool reconstructNDF, const pcl::PointCloud<PointPCD>::Ptr& out, std::vector<pcl::PointCloud<PointNDF>::Ptr>& NDFs)
+	bool Converter::ExportToPCD(const double voxelUnit, const unsigned int searchRadiusNumVoxels, const int meanK, const int polynomialOrder, bool reconstructAlbedo, bool reconstructNDF, const bool dedupScans, const pcl::PointCloud<PointPCD>::Ptr& out, std::vector<pcl::PointCloud<PointNDF>::Ptr>& NDFs, const unsigned int numWorkers, const unsigned int ioConcurrency, const std::size_t memoryBudgetMB, const std::size_t unitPoints, PCDStreamWriter<PointPCD>* writer)
 	{
+		bool success = false;
 		try
 		{		
 			if (reconstructNDF)
@@ -936,6 +1675,9 @@ namespace e57
 					throw pcl::PCLException("You must compile the program with POINT_PCD_WITH_LABEL definition to enable reconstructNDF");
 			}
 
+			if (dedupScans && !E57_CAN_CONTAIN_LABEL)
+				throw pcl::PCLException("You must compile the program with POINT_E57_WITH_LABEL definition to enable dedupScans");
+
 			if (reconstructAlbedo)
 			{
 				if (!E57_CAN_CONTAIN_LABEL)
@@ -950,55 +1692,91 @@ namespace e57
 
 			//
 			out->clear();
-			std::vector<OCTQuery> querys;
-			OCT::Iterator it(*oct);
-			while (*it != nullptr)
+			OCTQuery query;
+			query.voxelUnit = voxelUnit;
+			query.meanK = meanK;
+			query.polynomialOrder = polynomialOrder;
+			query.reconstructAlbedo = reconstructAlbedo;
+			query.reconstructNDF = reconstructNDF;
+			query.dedupScans = dedupScans;
+			query.searchRadius = voxelUnit * searchRadiusNumVoxels;
+
+			// Halos must hold whole voxels, so every voxel on a leaf border gets an owner (see ExportToPCD_OwnsVoxel)
+			if (searchRadiusNumVoxels < 1)
 			{
-				if ((*it)->getNodeType() == pcl::octree::LEAF_NODE)
-				{
-					OCTQuery query;
-					query.voxelUnit = voxelUnit;
-					query.meanK = meanK;
-					query.polynomialOrder = polynomialOrder;
-					query.reconstructAlbedo = reconstructAlbedo;
-					query.reconstructNDF = reconstructNDF;
-					(*it)->getBoundingBox(query.minBB, query.maxBB);
-					query.depth = (*it)->getDepth();
-					query.searchRadius = voxelUnit * searchRadiusNumVoxels;
-					querys.push_back(query);
-				}
-				it++;
+				PCL_WARN("[e57::%s::ExportToPCD] searchRadiusNumVoxels is smaller than 1, use 1.\n", "Converter");
+				query.searchRadius = voxelUnit;
 			}
 
-			//
-			bool p = false;
-			std::vector<pcl::PointCloud<PointE57>::Ptr> rawE57CloudBuffer(2);
+			// Work units are visited in Morton order, so the decoded neighbor leaves of a halo are reused by the next units
+			std::vector<OCTQuery> querys;
+			std::shared_ptr<LeafHaloCache> cache = ExportToPCD_WorkUnits(&nodeIndex, query, unitPoints, &querys);
+			if (!cache)
+				PCL_WARN("[e57::%s::ExportToPCD] Leaves have different depths, query each halo from OCT and process each leaf as a work unit.\n", "Converter");
+
+			// Work units are processed concurrently, each unit gets an equal share of the cores for its OpenMP stages
+			unsigned int numProcs = std::max(std::thread::hardware_concurrency(), 1u);
+			unsigned int _numWorkers = (numWorkers > 0) ? numWorkers : numProcs;
+			_numWorkers = std::max((unsigned int)std::min((std::size_t)_numWorkers, querys.size()), 1u);
+			int numLeafThreads = std::max(numProcs / _numWorkers, 1u);
 			{
-				int rQuery = ExportToPCD_Query(&oct, &querys, 0, &rawE57CloudBuffer, p);
-				if (rQuery != 0) throw pcl::PCLException("ExportToPCD_Query failed - " + std::to_string(rQuery));
+				std::stringstream ss;
+				ss << "[e57::%s::ExportToPCD] Process " << querys.size() << " work units - workers " << _numWorkers << ", threads per unit " << numLeafThreads << ", ioConcurrency " << ioConcurrency << ", memoryBudgetMB " << memoryBudgetMB << ".\n";
+				PCL_INFO(ss.str().c_str(), "Converter");
 			}
-			for (int64_t queryID = 0; queryID < querys.size(); ++queryID)
-			{
-				pcl::PointCloud<PointPCD>::Ptr outPointCloud(new pcl::PointCloud<PointPCD>);
 
-				//
-				std::future<int> query = std::async(ExportToPCD_Query, &oct, &querys, queryID+1, &rawE57CloudBuffer, !p);
-				std::future<int> process = std::async(ExportToPCD_Process, &querys, queryID, &rawE57CloudBuffer, p, &scanInfo,  &outPointCloud);
+			// Merge or write in unit order, so the output does not depend on scheduling
+			auto commit = [&](const pcl::PointCloud<PointPCD>& outPointCloud)
+			{
+				if (writer != nullptr)
+					writer->Write(outPointCloud);
+				else
+					(*out) += outPointCloud;
 
-				int rQuery = query.get();
-				int rProcess = process.get();
-				if (rQuery != 0) throw pcl::PCLException("ExportToPCD_Query failed - " + std::to_string(rQuery));
-				if (rProcess != 0) throw pcl::PCLException("ExportToPCD_Process failed - " + std::to_string(rProcess));
+				std::stringstream ss;
+				ss << "[e57::%s::ExportToPCD] Final cloud size " << ((writer != nullptr) ? writer->NumPoints() : out->size()) << " points.\n";
+				PCL_INFO(ss.str().c_str(), "Converter");
+			};
+			ResourceBudget ioBudget(ioConcurrency);
+			ExportToPCD_CommitQueue<decltype(commit)> commitQueue((memoryBudgetMB > 0) ? (memoryBudgetMB << 20) : std::numeric_limits<std::size_t>::max(), querys.size(), cache.get(), commit);
 
-				// Merge
-				(*out) += (*outPointCloud);
+			TaskScheduler scheduler(_numWorkers);
+			for (int64_t queryID = 0; queryID < querys.size(); ++queryID)
+			{
+				scheduler.Submit([&, queryID]()
 				{
-					std::stringstream ss;
-					ss << "[e57::%s::ExportToPCD] Final cloud size " << out->size() << " points.\n";
-					PCL_INFO(ss.str().c_str(), "Converter");
-				}
-				p = !p;
+					try
+					{
+						commitQueue.Start(queryID, querys[queryID].numPoints * ExportToPCD_PointBytes);
+						std::vector<pcl::PointCloud<PointExchange>::Ptr> rawE57CloudBuffer(1);
+						{
+							ResourceBudgetLock ioLock(ioBudget, 1);
+							int rQuery = ExportToPCD_Query(&nodeIndex, cache.get(), &querys, queryID, &rawE57CloudBuffer, false);
+							if (rQuery != 0) throw pcl::PCLException("ExportToPCD_Query failed - " + std::to_string(rQuery));
+						}
+
+						pcl::PointCloud<PointPCD>::Ptr outPointCloud(new pcl::PointCloud<PointPCD>);
+						int rProcess = ExportToPCD_Process(&querys, queryID, &rawE57CloudBuffer, false, &scanInfo, numLeafThreads, &outPointCloud);
+						if (rProcess != 0) throw pcl::PCLException("ExportToPCD_Process failed - " + std::to_string(rProcess));
+						rawE57CloudBuffer.clear();
+						commitQueue.Finish(queryID, outPointCloud);
+					}
+					catch (...)
+					{
+						commitQueue.Fail();
+						throw;
+					}
+				});
 			}
+			scheduler.Run();
+
+			if (cache)
+			{
+				std::stringstream ss;
+				ss << "[e57::%s::ExportToPCD] Read " << cache->NumReads() << " leaves for " << querys.size() << " halo queries.\n";
+				PCL_INFO(ss.str().c_str(), "Converter");
+			}
+			success = true;
 		}
 		catch (std::exception& ex)
 		{
@@ -1015,9 +1793,10 @@ namespace e57
 		{
 			//ExportToPCD_ReconstructNDF(voxelUnit, searchRadiusNumVoxels, out, NDFs);
 		}
+		return success;
 	}
 
-	int ExportToPCD_ReconstructNDF_Process(const std::vector<OCTQuery>* querys, const int64_t queryID, std::vector<pcl::PointCloud<PointE57>::Ptr>* rawE57CloudBuffer, bool p, const pcl::PointCloud<PointPCD>::Ptr* cloud, const std::vector<ScanInfo>* scanInfos, std::vector<pcl::PointCloud<PointNDF>::Ptr>* NDFs)
+	int ExportToPCD_ReconstructNDF_Process(const std::vector<OCTQuery>* querys, const int64_t queryID, std::vector<pcl::PointCloud<PointExchange>::Ptr>* rawE57CloudBuffer, bool p, const pcl::PointCloud<PointPCD>::Ptr* cloud, const std::vector<ScanInfo>* scanInfos, const int numThreads, std::vector<pcl::PointCloud<PointNDF>::Ptr>* NDFs)
 	{
 		if (queryID >= querys->size())
 			return 0;
@@ -1027,14 +1806,9 @@ namespace e57
 			return 2;
 
 		//
-		pcl::PointCloud<PointExchange>::Ptr rawE57Cloud(new pcl::PointCloud<PointExchange>());
-		rawE57Cloud->resize((*rawE57CloudBuffer)[p]->size());
-		for (std::size_t pi = 0; pi < rawE57Cloud->size(); ++pi)
-			(*rawE57Cloud)[pi] = (*(*rawE57CloudBuffer)[p])[pi];
-		pcl::search::KdTree<PointExchange>::Ptr rawE57Cloud_tree(new pcl::search::KdTree<PointExchange>());
-
+		pcl::PointCloud<PointExchange>::Ptr rawE57Cloud = (*rawE57CloudBuffer)[p];
 		pcl::PointCloud<PointExchange>::Ptr e57Cloud(new pcl::PointCloud<PointExchange>);
-		pcl::search::KdTree<PointExchange>::Ptr e57Cloud_tree(new pcl::search::KdTree<PointExchange>());
+		GridSearch<PointExchange>::Ptr e57Cloud_index;
 
 		pcl::PointCloud<PointExchange>::Ptr e57Cloud_CB(new pcl::PointCloud<PointExchange>);
 
@@ -1080,21 +1854,22 @@ namespace e57
 
 		PCL_INFO("[e57::ExportToPCD_ReconstructNDF_Process] Upsampling Normal and segmentLabel ID.\n");
 		{
-			if (e57Cloud_tree->getInputCloud() != e57Cloud)
-				e57Cloud_tree->setInputCloud(e57Cloud);
+			e57Cloud_index = ExportToPCD_BuildIndex(e57Cloud, (*querys)[queryID].voxelUnit);
+
+			// One batched query in cell order for all points
+			std::vector<std::vector<int>> ki;
+			std::vector<std::vector<float>> kd;
+			e57Cloud_index->NearestKSearchBatch(*rawE57Cloud, std::vector<int>(), 1, ki, kd, numThreads);
 
 #ifdef _OPENMP
-#pragma omp parallel for num_threads(omp_get_num_procs())
+#pragma omp parallel for num_threads(numThreads)
 #endif
-			// Iterating over the entire index vector
 			for (int px = 0; px < static_cast<int> (rawE57Cloud->size()); ++px)
 			{
 				PointExchange& point = (*rawE57Cloud)[px];
-				std::vector<int> ki;
-				std::vector<float> kd;
-				if (e57Cloud_tree->nearestKSearch(point, 1, ki, kd) > 0)
+				if (!ki[px].empty())
 				{
-					PointExchange& kPoint = (*e57Cloud)[ki[0]];
+					PointExchange& kPoint = (*e57Cloud)[ki[px][0]];
 					point.normal_x = kPoint.normal_x;
 					point.normal_y = kPoint.normal_y;
 					point.normal_z = kPoint.normal_z;
@@ -1117,104 +1892,120 @@ namespace e57
 			double cutFalloff = 0.33;
 			Eigen::Vector3d tempVec(1.0, 1.0, 1.0);
 			tempVec /= tempVec.norm();
+			const ExportToPCD_ScannerTable scannerTable((*querys)[queryID], *scanInfos);
 
-/*#ifdef _OPENMP
-#pragma omp parallel for num_threads(omp_get_num_procs())
-#endif*/
-			for (int px = 0; px < static_cast<int> (rawE57Cloud->size()); ++px)
+			// Points are staged in fixed size blocks and merged in point order, so NDFs do not depend on the number of threads
+			const int blockSize = 4096;
+			int numBlocks = (static_cast<int> (rawE57Cloud->size()) + blockSize - 1) / blockSize;
+			std::vector<std::vector<uint32_t>> blockSegmentLabels(numBlocks);
+			std::vector<pcl::PointCloud<PointNDF>, Eigen::aligned_allocator<pcl::PointCloud<PointNDF>>> blockNDFs(numBlocks);
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic) num_threads(numThreads)
+#endif
+			for (int bi = 0; bi < numBlocks; ++bi)
 			{
-				bool success = false;
-				PointExchange& point = (*rawE57Cloud)[px];
-				pcl::PointCloud<PointNDF>::Ptr& NDF = (*NDFs)[point.segmentLabel];
-				ScannLaserInfo scannLaserInfo;
-				scannLaserInfo.hitNormal = Eigen::Vector3d(point.normal_x, point.normal_y, point.normal_z);
-				if (std::abs(scannLaserInfo.hitNormal.norm() - 1.0) > 0.05)
+				for (int px = bi * blockSize; px < std::min((bi + 1) * blockSize, static_cast<int> (rawE57Cloud->size())); ++px)
 				{
-					PCL_WARN("[e57::ExportToPCD_ReconstructNDF_Process] scannLaserInfo.hitNormal is not valid!!? Ignore.\n");
-				}
-				else
-				{
-					const ScanInfo& scanScanInfo = (*scanInfos)[point.label];
-					switch (scanScanInfo.scanner)
+					bool success = false;
+					PointExchange& point = (*rawE57Cloud)[px];
+					const int32_t scanSlot = scannerTable.Slot(point.label);
+					if ((point.hasSegmentLabel == -1) || (point.segmentLabel >= NDFs->size()) || (scanSlot < 0))
+					{
+						PCL_WARN("[e57::ExportToPCD_ReconstructNDF_Process] point has no valid segmentLabel or label!!? Ignore.\n");
+						continue;
+					}
+					ScannLaserInfo scannLaserInfo;
+					scannLaserInfo.hitPosition = Eigen::Vector3d(point.x, point.y, point.z);
+					scannLaserInfo.hitNormal = Eigen::Vector3d(point.normal_x, point.normal_y, point.normal_z);
+					if (std::abs(scannLaserInfo.hitNormal.norm() - 1.0) > 0.05)
 					{
-					case Scanner::BLK360:
+						PCL_WARN("[e57::ExportToPCD_ReconstructNDF_Process] scannLaserInfo.hitNormal is not valid!!? Ignore.\n");
+					}
+					else
 					{
-						scannLaserInfo.incidentDirection = scanScanInfo.position - scannLaserInfo.hitPosition;
-						scannLaserInfo.hitDistance = scannLaserInfo.incidentDirection.norm();
-						scannLaserInfo.incidentDirection /= scannLaserInfo.hitDistance;
-						if (scannLaserInfo.incidentDirection.dot(scannLaserInfo.hitNormal) < 0)
-							scannLaserInfo.incidentDirection *= -1.0;
-						scannLaserInfo.reflectedDirection = scannLaserInfo.incidentDirection; // BLK360 
-
-						// Ref - BLK 360 Spec - laser wavelength & Beam divergence : https://lasers.leica-geosystems.com/global/sites/lasers.leica-geosystems.com.global/files/leica_media/product_documents/blk/853811_leica_blk360_um_v2.0.0_en.pdf
-						// Ref - Gaussian beam : https://en.wikipedia.org/wiki/Gaussian_beam
-						// Ref - Beam divergence to Beam waist(w0) : http://www2.nsysu.edu.tw/optics/laser/angle.htm
-						double temp = scannLaserInfo.hitDistance / 26.2854504782;
-						scannLaserInfo.beamFalloff = 1.0f / (1 + temp * temp);
-						if ((scannLaserInfo.beamFalloff > cutFalloff))
+						switch (scannerTable.scanners[scanSlot])
 						{
-							scannLaserInfo.hitTangent = scannLaserInfo.hitNormal.cross(tempVec);
-							double hitTangentNorm = scannLaserInfo.hitTangent.norm();
-							if (hitTangentNorm > 0.0)
-							{
-								scannLaserInfo.hitTangent /= hitTangentNorm;
-								scannLaserInfo.hitBitangent = scannLaserInfo.hitNormal.cross(scannLaserInfo.hitTangent);
-								scannLaserInfo.hitBitangent /= scannLaserInfo.hitBitangent.norm();
-								scannLaserInfo.weight = 1.0;
-								scannLaserInfo.intensity = (double)point.intensity;
-								success = true;
-							}
-							else
+						case Scanner::BLK360:
+						{
+							scannLaserInfo.incidentDirection = scannerTable.positions[scanSlot] - scannLaserInfo.hitPosition;
+							scannLaserInfo.hitDistance = scannLaserInfo.incidentDirection.norm();
+							scannLaserInfo.incidentDirection /= scannLaserInfo.hitDistance;
+							if (scannLaserInfo.incidentDirection.dot(scannLaserInfo.hitNormal) < 0)
+								scannLaserInfo.incidentDirection *= -1.0;
+							scannLaserInfo.reflectedDirection = scannLaserInfo.incidentDirection; // BLK360 
+
+							scannLaserInfo.beamFalloff = BeamFalloff(scannLaserInfo.hitDistance);
+							if ((scannLaserInfo.beamFalloff > cutFalloff))
 							{
-								PCL_WARN("[e57::ExportToPCD_ReconstructNDF_Process] scannLaserInfo.hitTangent is not valid!!? Ignore.\n");
+								scannLaserInfo.hitTangent = scannLaserInfo.hitNormal.cross(tempVec);
+								double hitTangentNorm = scannLaserInfo.hitTangent.norm();
+								if (hitTangentNorm > 0.0)
+								{
+									scannLaserInfo.hitTangent /= hitTangentNorm;
+									scannLaserInfo.hitBitangent = scannLaserInfo.hitNormal.cross(scannLaserInfo.hitTangent);
+									scannLaserInfo.hitBitangent /= scannLaserInfo.hitBitangent.norm();
+									scannLaserInfo.weight = 1.0;
+									scannLaserInfo.intensity = (double)point.intensity;
+									success = true;
+								}
+								else
+								{
+									PCL_WARN("[e57::ExportToPCD_ReconstructNDF_Process] scannLaserInfo.hitTangent is not valid!!? Ignore.\n");
+								}
 							}
 						}
-					}
-					break;
-
-					default:
-						PCL_WARN("[e57::ExportToPCD_ReconstructNDF_Process] Scan data Scanner type is not support, ignore.\n");
 						break;
-					}
 
-					//
-					if (success)
-					{
-						// To tan space
-						Eigen::Matrix3d TBN;
-						TBN(0, 0) = scannLaserInfo.hitTangent.x();
-						TBN(0, 1) = scannLaserInfo.hitTangent.y();
-						TBN(0, 2) = scannLaserInfo.hitTangent.z();
-
-						TBN(1, 0) = scannLaserInfo.hitBitangent.x();
-						TBN(1, 1) = scannLaserInfo.hitBitangent.y();
-						TBN(1, 2) = scannLaserInfo.hitBitangent.z();
-
-						TBN(2, 0) = scannLaserInfo.hitNormal.x();
-						TBN(2, 1) = scannLaserInfo.hitNormal.y();
-						TBN(2, 2) = scannLaserInfo.hitNormal.z();
-
-						Eigen::Vector3d hitHalfway = scannLaserInfo.incidentDirection + scannLaserInfo.reflectedDirection;
-						double hitHalfwayNorm = hitHalfway.norm();
-						if (hitHalfwayNorm > 0.0)
-						{
-							hitHalfway /= hitHalfwayNorm;
-							hitHalfway = TBN * hitHalfway;
-
-							PointNDF dataNDF;
-							dataNDF.x = hitHalfway.x();
-							dataNDF.y = hitHalfway.y();
-							dataNDF.z = hitHalfway.z();
-							dataNDF.intensity = scannLaserInfo.intensity / scannLaserInfo.beamFalloff;
-							NDF->push_back(dataNDF);
+						default:
+							PCL_WARN("[e57::ExportToPCD_ReconstructNDF_Process] Scan data Scanner type is not support, ignore.\n");
+							break;
 						}
-						else
+
+						//
+						if (success)
 						{
-							PCL_WARN("[e57::ExportToPCD_ReconstructNDF_Process] hitHalfway is not valid!!? Ignore.\n");
+							// To tan space
+							Eigen::Matrix3d TBN;
+							TBN(0, 0) = scannLaserInfo.hitTangent.x();
+							TBN(0, 1) = scannLaserInfo.hitTangent.y();
+							TBN(0, 2) = scannLaserInfo.hitTangent.z();
+
+							TBN(1, 0) = scannLaserInfo.hitBitangent.x();
+							TBN(1, 1) = scannLaserInfo.hitBitangent.y();
+							TBN(1, 2) = scannLaserInfo.hitBitangent.z();
+
+							TBN(2, 0) = scannLaserInfo.hitNormal.x();
+							TBN(2, 1) = scannLaserInfo.hitNormal.y();
+							TBN(2, 2) = scannLaserInfo.hitNormal.z();
+
+							Eigen::Vector3d hitHalfway = scannLaserInfo.incidentDirection + scannLaserInfo.reflectedDirection;
+							double hitHalfwayNorm = hitHalfway.norm();
+							if (hitHalfwayNorm > 0.0)
+							{
+								hitHalfway /= hitHalfwayNorm;
+								hitHalfway = TBN * hitHalfway;
+
+								PointNDF dataNDF;
+								dataNDF.x = hitHalfway.x();
+								dataNDF.y = hitHalfway.y();
+								dataNDF.z = hitHalfway.z();
+								dataNDF.intensity = scannLaserInfo.intensity / scannLaserInfo.beamFalloff;
+								blockSegmentLabels[bi].push_back(point.segmentLabel);
+								blockNDFs[bi].push_back(dataNDF);
+							}
+							else
+							{
+								PCL_WARN("[e57::ExportToPCD_ReconstructNDF_Process] hitHalfway is not valid!!? Ignore.\n");
+							}
 						}
 					}
 				}
 			}
+
+			for (int bi = 0; bi < numBlocks; ++bi)
+				for (std::size_t i = 0; i < blockSegmentLabels[bi].size(); ++i)
+					(*NDFs)[blockSegmentLabels[bi][i]]->push_back(blockNDFs[bi][i]);
 		}
 
 		return 0;
@@ -1235,6 +2026,9 @@ namespace e57
 			if (!PCD_CAN_CONTAIN_NORMAL)
 				throw pcl::PCLException("You must compile the program with POINT_PCD_WITH_NORMAL definition to enable ExportToPCD_ReconstructNDF");
 
+			// Units are processed one at a time, so each gets all cores
+			const int numThreads = std::max(std::thread::hardware_concurrency(), 1u);
+
 			//
 			NDFs.clear();
 			
@@ -1275,26 +2069,34 @@ namespace e57
 			super.extract(clusters);
 			pcl::PointCloud<pcl::PointXYZL>::Ptr cloudXYZL = super.getLabeledCloud();
 			PCL_INFO(("[e57::%s::ExportToPCD_ReconstructNDF] Segment End. Segment " + std::to_string(clusters.size()) + ", Size " + std::to_string(cloudXYZL->size()) + ".\n").c_str(), "Converter");
-			pcl::search::KdTree<pcl::PointXYZL>::Ptr cloudXYZL_tree(new pcl::search::KdTree<pcl::PointXYZL>());
+			GridSearch<pcl::PointXYZL>::Ptr cloudXYZL_tree(new GridSearch<pcl::PointXYZL>(voxelUnit));
 			if (cloudXYZL_tree->getInputCloud() != cloudXYZL)
 				cloudXYZL_tree->setInputCloud(cloudXYZL);
 
 			PCL_INFO("[e57::%s::ExportToPCD_ReconstructNDF] Upsampling Segment ID.\n", "Converter");
 			{
+				pcl::PointCloud<pcl::PointXYZL> cloudQuerys;
+				cloudQuerys.resize(cloud->size());
+				for (std::size_t px = 0; px < cloud->size(); ++px)
+				{
+					cloudQuerys[px].x = (*cloud)[px].x;
+					cloudQuerys[px].y = (*cloud)[px].y;
+					cloudQuerys[px].z = (*cloud)[px].z;
+				}
+
+				// One batched query in cell order for all points
+				std::vector<std::vector<int>> ki;
+				std::vector<std::vector<float>> kd;
+				cloudXYZL_tree->NearestKSearchBatch(cloudQuerys, std::vector<int>(), 1, ki, kd, numThreads);
+
 #ifdef _OPENMP
-#pragma omp parallel for num_threads(omp_get_num_procs())
+#pragma omp parallel for num_threads(numThreads)
 #endif
 				for (int px = 0; px < static_cast<int> (cloud->size()); ++px)
 				{
 					PointPCD& point = (*cloud)[px];
-					std::vector<int> ki;
-					std::vector<float> kd;
-					pcl::PointXYZL c;
-					c.x = point.x;
-					c.y = point.y;
-					c.z = point.z;
-					if (cloudXYZL_tree->nearestKSearch(c, 1, ki, kd) > 0)
-						point.label = (*cloudXYZL)[ki[0]].label;
+					if (!ki[px].empty())
+						point.label = (*cloudXYZL)[ki[px][0]].label;
 					else
 						point.hasLabel = -1;
 				}
@@ -1307,37 +2109,27 @@ namespace e57
 				NDF->reserve(1000);
 				NDFs.push_back(NDF);
 			}
-			std::vector<OCTQuery> querys;
-			OCT::Iterator it(*oct);
-			while (*it != nullptr)
-			{
-				if ((*it)->getNodeType() == pcl::octree::LEAF_NODE)
-				{
-					OCTQuery query;
-					query.voxelUnit = voxelUnit;
-					query.meanK = -1;
-					query.polynomialOrder = -1;
-					query.reconstructAlbedo = false;
-					query.reconstructNDF = true;
-					(*it)->getBoundingBox(query.minBB, query.maxBB);
-					query.depth = (*it)->getDepth();
-					query.searchRadius = voxelUnit * searchRadiusNumVoxels;
-					querys.push_back(query);
-				}
-				it++;
-			}
+			OCTQuery query;
+			query.voxelUnit = voxelUnit;
+			query.meanK = -1;
+			query.polynomialOrder = -1;
+			query.reconstructAlbedo = false;
+			query.reconstructNDF = true;
+			query.searchRadius = voxelUnit * searchRadiusNumVoxels;
 			//
 			PCL_INFO("[e57::%s::ExportToPCD_ReconstructNDF] Reconstruct NDF.\n", "Converter");
+			std::vector<OCTQuery> querys;
+			std::shared_ptr<LeafHaloCache> cache = ExportToPCD_WorkUnits(&nodeIndex, query, 0, &querys);
 			bool p = false;
-			std::vector<pcl::PointCloud<PointE57>::Ptr> rawE57CloudBuffer(2);
+			std::vector<pcl::PointCloud<PointExchange>::Ptr> rawE57CloudBuffer(2);
 			{
-				int rQuery = ExportToPCD_Query(&oct, &querys, 0, &rawE57CloudBuffer, p);
+				int rQuery = ExportToPCD_Query(&nodeIndex, cache.get(), &querys, 0, &rawE57CloudBuffer, p);
 				if (rQuery != 0) throw pcl::PCLException("ExportToPCD_ReconstructNDF_Query failed - " + std::to_string(rQuery));
 			}
 			for (int64_t queryID = 0; queryID < querys.size(); ++queryID)
 			{
-				std::future<int> query = std::async(ExportToPCD_Query, &oct, &querys, queryID + 1, &rawE57CloudBuffer, !p);
-				std::future<int> process = std::async(ExportToPCD_ReconstructNDF_Process, &querys, queryID, &rawE57CloudBuffer, p, &cloud, &scanInfo, &NDFs);
+				std::future<int> query = std::async(ExportToPCD_Query, &nodeIndex, cache.get(), &querys, queryID + 1, &rawE57CloudBuffer, !p);
+				std::future<int> process = std::async(ExportToPCD_ReconstructNDF_Process, &querys, queryID, &rawE57CloudBuffer, p, &cloud, &scanInfo, numThreads, &NDFs);
 				int rQuery = query.get();
 				int rProcess = process.get();
 				if (rQuery != 0) throw pcl::PCLException("ExportToPCD_ReconstructNDF_Query failed - " + std::to_string(rQuery));
@@ -9,32 +9,55 @@
 
 #include "Common.h"
 #include "PointType.h"
+#include "E57LeafContainer.h"
+#include "E57NodeIndex.h"
 
 //
 namespace e57
 {
+	template <typename PointT>
+	class PCDStreamWriter;
+
 	class Converter
 	{
 	public:
-		using OCT = pcl::outofcore::OutofcoreOctreeBase<pcl::outofcore::OutofcoreOctreeDiskContainer<PointE57>, PointE57>;
+		using OCT = pcl::outofcore::OutofcoreOctreeBase<OutofcoreLeafContainer, PointE57>;
 
 	protected:
 		OCT::Ptr oct;
+		bool octLoadAll; // false if the OCT is opened from octIndex.bin and its nodes are loaded on demand
+		OCTNodeIndex nodeIndex;
 		boost::filesystem::path octPath;
 		std::vector<ScanInfo> scanInfo;
 
 		void LoadScanInfo(const boost::filesystem::path& octPath);
 		void DumpScanInfo(const boost::filesystem::path& octPath);		
+		void LoadLeafFormat(const boost::filesystem::path& octPath);
+		void DumpLeafFormat(const boost::filesystem::path& octPath);
+		void LoadOCT(const bool loadAll);
+		void UpdateNodeIndex();
 
 	public:
 		// This constructor will create a new OCT (need input a not exist folder)
-		Converter(const boost::filesystem::path& octPath, const Eigen::Vector3d& min, const Eigen::Vector3d& max, const double resolution, const std::string& coordSys);
+		// leafFormat: Format of the node files, see LeafFormat. It is kept in the OCT folder, so loaded OCTs are written in the same format.
+		Converter(const boost::filesystem::path& octPath, const Eigen::Vector3d& min, const Eigen::Vector3d& max, const double resolution, const std::string& coordSys, const LeafFormat& leafFormat = LeafFormat());
 
 		// This constructor will load exist OCT
+		// If octIndex.bin exists, only the root node is opened and node metadata is taken from the index, nodes are loaded when the OCT is changed.
 		Converter(const boost::filesystem::path& octPath);
 
 		// minRGB: Mean a point will be kept only if one of R, G, B is larger than minRGB, This parameters is to filter out the black noise which is generated by some scanner (such as BLK360).
-		void LoadE57(const boost::filesystem::path& e57Path, const double LODSamplePercent, const uint8_t minRGB, const Scanner& scanner);
+		// blockSize: If larger than zero, each scan is streamed into the OCT in blocks of blockSize points instead of being loaded at once, so memory is bounded by blockSize instead of scan size.
+		// numDecoders, numFilters: Number of scan decoding and point filtering workers of the ingest pipeline, 0 means 2 (at most the number of cores). The OCT is written by the calling thread.
+		// queueDepth: Max number of scans (or blocks) waiting between two pipeline stages. Each worker holds one more, so at most numDecoders + numFilters + 2 * queueDepth + 1 scans (or blocks) are in memory.
+		// bulkRunSize: If larger than zero, points are spilled to runs of bulkRunSize points sorted by Morton code of OCT leaves, then merged so each leaf file is written once and sequentially.
+		// filter: Scans and points to load, points outside the OCT are always rejected.
+		// append: Add the scans to an OCT opened by the loading constructor, new scans get IDs after the existing ones.
+		void LoadE57(const boost::filesystem::path& e57Path, const double LODSamplePercent, const uint8_t minRGB, const Scanner& scanner, const std::size_t blockSize, const unsigned int numDecoders, const unsigned int numFilters, const std::size_t queueDepth, const std::size_t bulkRunSize, const IngestFilter& filter = IngestFilter(), const bool append = false);
+
+		// Estimate the OCT bounds from cartesianBounds (or sphericalBounds) of the accepted scans, scans without bounds are sampled instead.
+		// resolution: Leaf size of a depth where a leaf holds about pointsPerLeaf points, assuming points of scans lie on surfaces. Points rejected by the crop box and polygon of filter are not counted.
+		static bool EstimateBounds(const boost::filesystem::path& e57Path, const IngestFilter& filter, const std::size_t pointsPerLeaf, Eigen::Vector3d& min, Eigen::Vector3d& max, double& resolution);
 		
 		//raeMode only for CoodSys::RAE, fovy only for CoodSys::XYZ
 		void ReconstructScanImages(pcl::PointCloud<PointPCD>& cloud, const boost::filesystem::path& scanImagePath, const CoodSys coodSys, const RAEMode raeMode, const float fovy, const unsigned int width, const unsigned int height);
@@ -42,9 +65,18 @@ namespace e57
 		// 
 		void LoadScanHDRI(const boost::filesystem::path& filePath);
 
-		//
+		// Build LOD with OCTLODBuilder, only the branches above leaves changed since the last build are resampled.
+		// sample_percent_arg: Each branch node keeps this percent of its children points, as a stratified voxel sample.
 		void BuildLOD(const double sample_percent_arg);
-		void ExportToPCD(const double voxelUnit, const unsigned int searchRadiusNumVoxels, const int meanK, const int polynomialOrder, bool reconstructAlbedo, bool reconstructNDF, const pcl::PointCloud<PointPCD>::Ptr& out, std::vector<pcl::PointCloud<PointNDF>::Ptr>& NDFs);
+
+		// dedupScans: Keep only the points of the scan with the best range/incidence score in each voxel, before all other stages, so overlapped scans are not averaged.
+		// numWorkers: Number of OCT leaves processed concurrently, 0 means the number of cores.
+		// ioConcurrency: Max number of concurrent OCT leaf queries.
+		// memoryBudgetMB: Max estimated memory of the work units in process or waiting to be written, and of the leaves in the halo cache, 0 means no limit.
+		// unitPoints: If larger than zero, leaves are regrouped into work units of about unitPoints points: sparse sibling leaves are merged and dense leaves are split into octants (see LeafHaloCache::PlanWorkUnits).
+		// writer: If given, processed leaves are written to it in leaf order and out is left empty, so memory is bounded by the leaves in process instead of the whole cloud.
+		// Return false if a work unit failed, out (or writer) then holds only the units committed before the failure.
+		bool ExportToPCD(const double voxelUnit, const unsigned int searchRadiusNumVoxels, const int meanK, const int polynomialOrder, bool reconstructAlbedo, bool reconstructNDF, const bool dedupScans, const pcl::PointCloud<PointPCD>::Ptr& out, std::vector<pcl::PointCloud<PointNDF>::Ptr>& NDFs, const unsigned int numWorkers, const unsigned int ioConcurrency, const std::size_t memoryBudgetMB, const std::size_t unitPoints = 0, PCDStreamWriter<PointPCD>* writer = nullptr);
 		void ExportToPCD_ReconstructNDF(const double voxelUnit, const unsigned int searchRadiusNumVoxels, float spatialImportance, float normalImportance, const pcl::PointCloud<PointPCD>::Ptr& cloud, std::vector<pcl::PointCloud<PointNDF>::Ptr>& NDFs);
 	};
 }
\ No newline at end of file
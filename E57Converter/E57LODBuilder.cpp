@@ -0,0 +1,211 @@
+#include <cmath>
+#include <fstream>
+#include <thread>
+#include <algorithm>
+#include <unordered_map>
+
+#include <pcl/outofcore/outofcore_impl.h>
+
+#include "nlohmann/json.hpp"
+
+#include "TaskScheduler.h"
+#include "E57LeafReader.h"
+#include "E57LODBuilder.h"
+
+namespace e57
+{
+	OCTLODBuilder::OCTLODBuilder(Converter::OCT& oct, const boost::filesystem::path& octPath) : octPath(octPath), maxDepth(0)
+	{
+		Eigen::Vector3d octMin, octMax;
+		oct.getBoundingBox(octMin, octMax);
+
+		// Nodes are linked by their grid cell at their depth, a parent cell is the child cell divided by 2
+		std::map<std::array<int64_t, 4>, std::size_t> cellNodes;
+		std::vector<std::array<int64_t, 4>> cells;
+		Converter::OCT::Iterator it(oct);
+		while (*it != nullptr)
+		{
+			Node node;
+			(*it)->getBoundingBox(node.minBB, node.maxBB);
+			node.pcdPath = (*it)->getPCDFilename();
+			node.depth = (*it)->getDepth();
+			node.leaf = ((*it)->getNodeType() == pcl::octree::LEAF_NODE);
+			node.numPoints = (*it)->getDataSize();
+			node.parent = -1;
+			node.dirty = false;
+
+			Eigen::Vector3d nodeSize = (octMax - octMin) / std::pow(2.0, (double)node.depth);
+			Eigen::Vector3d cell = ((node.minBB + node.maxBB) * 0.5 - octMin).cwiseQuotient(nodeSize).array().floor();
+			std::array<int64_t, 4> key = { (int64_t)node.depth, (int64_t)cell.x(), (int64_t)cell.y(), (int64_t)cell.z() };
+			cellNodes[key] = nodes.size();
+			cells.push_back(key);
+			maxDepth = std::max(maxDepth, node.depth);
+			nodes.push_back(node);
+			it++;
+		}
+
+		for (std::size_t i = 0; i < nodes.size(); ++i)
+		{
+			if (cells[i][0] == 0)
+				continue;
+			std::array<int64_t, 4> parentKey = { cells[i][0] - 1, cells[i][1] >> 1, cells[i][2] >> 1, cells[i][3] >> 1 };
+			std::map<std::array<int64_t, 4>, std::size_t>::const_iterator parent = cellNodes.find(parentKey);
+			if (parent == cellNodes.end())
+				throw pcl::PCLException("Parent of OCT node " + nodes[i].pcdPath.string() + " is not found.");
+			nodes[i].parent = parent->second;
+			nodes[parent->second].children.push_back(i);
+		}
+	}
+
+	void OCTLODBuilder::SetAllDirty()
+	{
+		for (std::size_t i = 0; i < nodes.size(); ++i)
+			nodes[i].dirty = true;
+	}
+
+	void OCTLODBuilder::LoadState(const double samplePercent, const unsigned int gridSize)
+	{
+		std::ifstream file((octPath / boost::filesystem::path("lodState.txt")).string(), std::ios_base::in);
+		if (!file)
+		{
+			SetAllDirty();
+			return;
+		}
+		nlohmann::json state;
+		file >> state;
+		file.close();
+
+		// LOD built with other parameters is rebuilt
+		if ((state["samplePercent"] != samplePercent) || (state["gridSize"] != gridSize))
+		{
+			SetAllDirty();
+			return;
+		}
+
+		const nlohmann::json& leaves = state["leaves"];
+		for (std::size_t i = 0; i < nodes.size(); ++i)
+		{
+			if (!nodes[i].leaf)
+				continue;
+			nlohmann::json::const_iterator leaf = leaves.find(nodes[i].pcdPath.filename().string());
+			if ((leaf == leaves.end()) || (leaf->get<uint64_t>() != nodes[i].numPoints))
+				nodes[i].dirty = true;
+		}
+	}
+
+	void OCTLODBuilder::DumpState(const double samplePercent, const unsigned int gridSize) const
+	{
+		nlohmann::json state;
+		state["samplePercent"] = samplePercent;
+		state["gridSize"] = gridSize;
+		state["leaves"] = nlohmann::json::object();
+		for (std::size_t i = 0; i < nodes.size(); ++i)
+			if (nodes[i].leaf)
+				state["leaves"][nodes[i].pcdPath.filename().string()] = nodes[i].numPoints;
+
+		std::ofstream file((octPath / boost::filesystem::path("lodState.txt")).string(), std::ios_base::out);
+		if (!file)
+			throw pcl::PCLException("Create file " + (octPath / boost::filesystem::path("lodState.txt")).string() + " failed.");
+		file << state;
+		file.close();
+	}
+
+	void OCTLODBuilder::Sample(const std::size_t nodeID, const double samplePercent, const unsigned int gridSize)
+	{
+		Node& node = nodes[nodeID];
+		const Eigen::Vector3d cellSize = (node.maxBB - node.minBB).cwiseMax(Eigen::Vector3d(1e-9, 1e-9, 1e-9)) / (double)gridSize;
+
+		// Keep the point nearest to the cell centre, children are read one by one to bound memory usage by the LOD size
+		std::unordered_map<uint64_t, std::size_t> cellSlots;
+		std::vector<std::pair<uint64_t, float>> slotCells;
+		pcl::PointCloud<PointE57> slots;
+		uint64_t numChildPoints = 0;
+		for (std::size_t ci = 0; ci < node.children.size(); ++ci)
+		{
+			const Node& child = nodes[node.children[ci]];
+			if ((child.numPoints == 0) || !boost::filesystem::exists(child.pcdPath))
+				continue;
+
+			pcl::PointCloud<PointE57> childCloud;
+			LeafReader(child.pcdPath).Read(childCloud);
+			numChildPoints += childCloud.size();
+
+			for (std::size_t pi = 0; pi < childCloud.size(); ++pi)
+			{
+				const PointE57& p = childCloud[pi];
+				if (!std::isfinite(p.x) || !std::isfinite(p.y) || !std::isfinite(p.z))
+					continue;
+
+				Eigen::Vector3d rel = (Eigen::Vector3d(p.x, p.y, p.z) - node.minBB).cwiseQuotient(cellSize);
+				Eigen::Vector3d cell = rel.array().floor().cwiseMax(0.0).cwiseMin((double)(gridSize - 1));
+				float dist = (float)(rel - cell - Eigen::Vector3d(0.5, 0.5, 0.5)).squaredNorm();
+				uint64_t key = MortonEncode((uint64_t)cell.x(), (uint64_t)cell.y(), (uint64_t)cell.z());
+
+				std::unordered_map<uint64_t, std::size_t>::iterator slot = cellSlots.find(key);
+				if (slot == cellSlots.end())
+				{
+					cellSlots[key] = slots.size();
+					slotCells.push_back(std::pair<uint64_t, float>(key, dist));
+					slots.push_back(p);
+				}
+				else if (dist < slotCells[slot->second].second)
+				{
+					slotCells[slot->second].second = dist;
+					slots[slot->second] = p;
+				}
+			}
+		}
+
+		// Thin the cells evenly along the Morton curve down to samplePercent of the children points
+		std::vector<std::pair<uint64_t, std::size_t>> order(slots.size());
+		for (std::size_t si = 0; si < slots.size(); ++si)
+			order[si] = std::pair<uint64_t, std::size_t>(slotCells[si].first, si);
+		std::sort(order.begin(), order.end());
+
+		std::size_t budget = std::max((std::size_t)std::ceil(samplePercent * (double)numChildPoints), (std::size_t)1);
+		std::size_t numSamples = std::min(budget, order.size());
+		pcl::PointCloud<PointE57> lod;
+		lod.reserve(numSamples);
+		for (std::size_t i = 0; i < numSamples; ++i)
+			lod.push_back(slots[order[(i * order.size()) / numSamples].second]);
+
+		WriteLeaf(node.pcdPath, lod, OutofcoreLeafContainer::Format());
+		node.numPoints = lod.size();
+	}
+
+	std::size_t OCTLODBuilder::Build(const double samplePercent, const unsigned int numThreads, const unsigned int gridSize)
+	{
+		const unsigned int _gridSize = std::min(std::max(gridSize, 1u), 1u << 21);
+		LoadState(samplePercent, _gridSize);
+
+		// Branches above changed leaves are changed
+		for (std::size_t i = 0; i < nodes.size(); ++i)
+			if (nodes[i].leaf && nodes[i].dirty)
+				for (int64_t p = nodes[i].parent; (p >= 0) && !nodes[p].dirty; p = nodes[p].parent)
+					nodes[p].dirty = true;
+
+		unsigned int _numThreads = (numThreads > 0) ? numThreads : std::max(std::thread::hardware_concurrency(), 1u);
+		std::size_t numSampled = 0;
+		for (int64_t depth = (int64_t)maxDepth - 1; depth >= 0; --depth)
+		{
+			TaskScheduler scheduler(_numThreads);
+			std::size_t numLevelSampled = 0;
+			for (std::size_t i = 0; i < nodes.size(); ++i)
+			{
+				if (((int64_t)nodes[i].depth != depth) || nodes[i].leaf || !nodes[i].dirty)
+					continue;
+				scheduler.Submit([this, i, samplePercent, _gridSize]() { Sample(i, samplePercent, _gridSize); });
+				numLevelSampled++;
+			}
+			scheduler.Run();
+			numSampled += numLevelSampled;
+
+			std::stringstream ss;
+			ss << "[e57::%s::Build] Depth " << depth << " - resampled nodes " << numLevelSampled << ".\n";
+			PCL_INFO(ss.str().c_str(), "OCTLODBuilder");
+		}
+
+		DumpState(samplePercent, _gridSize);
+		return numSampled;
+	}
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <map>
+#include <array>
+#include <vector>
+
+#include <pcl/point_cloud.h>
+
+#include "E57Utils.h"
+#include "E57Converter.h"
+
+namespace e57
+{
+	// Parallel and incremental LOD builder of OCT, used instead of OCT::buildLOD.
+	// The LOD of a branch node is a stratified sample of its children: the point nearest to the centre of each cell of a gridSize^3 grid over the node AABB, evenly thinned along the Morton order of the cells to samplePercent of the children points. So coarse levels are spatially even instead of randomly sampled.
+	// Leaf sizes of the last build are saved in the OCT folder, only the ancestors of leaves changed since then are resampled. Nodes of the same depth are independent, they are built in parallel level by level from the leaves to the root.
+	// The node files are written directly, so the OCT must be released before Build and reloaded after it.
+	class OCTLODBuilder
+	{
+	protected:
+		struct Node
+		{
+			boost::filesystem::path pcdPath;
+			Eigen::Vector3d minBB;
+			Eigen::Vector3d maxBB;
+			std::size_t depth;
+			bool leaf;
+			uint64_t numPoints;
+			int64_t parent;
+			std::vector<std::size_t> children;
+			bool dirty;
+		};
+
+		boost::filesystem::path octPath;
+		std::vector<Node> nodes;
+		std::size_t maxDepth;
+
+		void LoadState(const double samplePercent, const unsigned int gridSize);
+		void DumpState(const double samplePercent, const unsigned int gridSize) const;
+		void Sample(const std::size_t nodeID, const double samplePercent, const unsigned int gridSize);
+
+	public:
+		// Take the node tree of oct, which is not accessed anymore.
+		OCTLODBuilder(Converter::OCT& oct, const boost::filesystem::path& octPath);
+
+		// Mark all nodes as changed, so the whole LOD is rebuilt
+		void SetAllDirty();
+
+		// numThreads: Number of nodes sampled concurrently, 0 means the number of cores.
+		// gridSize: Number of LOD cells along each axis of a node, at most 2^21.
+		// Return the number of resampled nodes.
+		std::size_t Build(const double samplePercent, const unsigned int numThreads, const unsigned int gridSize = 128);
+	};
+}
@@ -0,0 +1,343 @@
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include <unordered_map>
+
+#include <pcl/conversions.h>
+
+#include "E57LeafCache.h"
+#include "E57LeafReader.h"
+
+namespace e57
+{
+	// Grid cell of each leaf, leaves with the same depth have the same size
+	void LeafHaloCache_LeafCells(const std::vector<const LeafHaloCache::Node*>& nodes, std::vector<Eigen::Vector3i>& cells, Eigen::Vector3d& gridMin, Eigen::Vector3d& leafSize)
+	{
+		cells.resize(nodes.size());
+		gridMin = Eigen::Vector3d::Zero();
+		leafSize = Eigen::Vector3d(1.0, 1.0, 1.0);
+		if (nodes.empty())
+			return;
+
+		gridMin = Eigen::Vector3d(std::numeric_limits<double>::max(), std::numeric_limits<double>::max(), std::numeric_limits<double>::max());
+		for (std::size_t i = 0; i < nodes.size(); ++i)
+		{
+			gridMin = gridMin.cwiseMin(nodes[i]->minBB);
+			leafSize = nodes[i]->maxBB - nodes[i]->minBB;
+		}
+		leafSize = leafSize.cwiseMax(Eigen::Vector3d(1e-9, 1e-9, 1e-9));
+
+		for (std::size_t i = 0; i < nodes.size(); ++i)
+			cells[i] = ((nodes[i]->minBB - gridMin).cwiseQuotient(leafSize).array() + 0.5).floor().cast<int>();
+	}
+
+	std::vector<std::size_t> LeafHaloCache::MortonOrder(const std::vector<const Node*>& nodes)
+	{
+		std::vector<Eigen::Vector3i> cells;
+		Eigen::Vector3d gridMin, leafSize;
+		LeafHaloCache_LeafCells(nodes, cells, gridMin, leafSize);
+
+		std::vector<std::pair<uint64_t, std::size_t>> keys(nodes.size());
+		for (std::size_t i = 0; i < nodes.size(); ++i)
+			keys[i] = std::pair<uint64_t, std::size_t>(MortonEncode(cells[i].x(), cells[i].y(), cells[i].z()), i);
+		std::sort(keys.begin(), keys.end());
+
+		std::vector<std::size_t> order(nodes.size());
+		for (std::size_t i = 0; i < keys.size(); ++i)
+			order[i] = keys[i].second;
+		return order;
+	}
+
+	bool LeafHaloCache::IsUniform(const std::vector<const Node*>& nodes)
+	{
+		for (std::size_t i = 1; i < nodes.size(); ++i)
+			if (nodes[i]->depth != nodes[0]->depth)
+				return false;
+		return true;
+	}
+
+	// Split a leaf into 8^level octant boxes in Morton order, inner faces are computed the same way on both sides so the boxes tile the leaf exactly
+	void LeafHaloCache_SplitLeaf(const LeafHaloCache::Node& node, const unsigned int level, std::vector<WorkUnit>& workUnits)
+	{
+		const int64_t n = ((int64_t)1) << level;
+		auto face = [&node, n](const int axis, const int64_t i)
+		{
+			if (i == 0)
+				return node.minBB[axis];
+			if (i == n)
+				return node.maxBB[axis];
+			return node.minBB[axis] + (node.maxBB[axis] - node.minBB[axis]) * (double)i / (double)n;
+		};
+
+		std::vector<std::pair<uint64_t, Eigen::Vector3i>> octants;
+		for (int64_t z = 0; z < n; ++z)
+			for (int64_t y = 0; y < n; ++y)
+				for (int64_t x = 0; x < n; ++x)
+					octants.push_back(std::pair<uint64_t, Eigen::Vector3i>(MortonEncode(x, y, z), Eigen::Vector3i((int)x, (int)y, (int)z)));
+		std::sort(octants.begin(), octants.end(), [](const std::pair<uint64_t, Eigen::Vector3i>& a, const std::pair<uint64_t, Eigen::Vector3i>& b) { return a.first < b.first; });
+
+		for (std::size_t oi = 0; oi < octants.size(); ++oi)
+		{
+			const Eigen::Vector3i& o = octants[oi].second;
+			WorkUnit unit;
+			unit.minBB = Eigen::Vector3d(face(0, o.x()), face(1, o.y()), face(2, o.z()));
+			unit.maxBB = Eigen::Vector3d(face(0, o.x() + 1), face(1, o.y() + 1), face(2, o.z() + 1));
+			unit.ownedBBs.push_back(std::pair<Eigen::Vector3d, Eigen::Vector3d>(unit.minBB, unit.maxBB));
+			unit.numPoints = (node.numPoints + octants.size() - 1) / octants.size();
+			workUnits.push_back(unit);
+		}
+	}
+
+	std::vector<WorkUnit> LeafHaloCache::PlanWorkUnits(const std::vector<const Node*>& nodes, const uint64_t unitPoints, const double searchRadius)
+	{
+		std::vector<Eigen::Vector3i> cells;
+		Eigen::Vector3d gridMin, leafSize;
+		LeafHaloCache_LeafCells(nodes, cells, gridMin, leafSize);
+
+		// Groups of leaves in Morton order, siblings are contiguous along the Morton curve
+		struct Group
+		{
+			uint64_t key;
+			unsigned int level; // a group of level holds leaves of one cell of 2^level leaves
+			uint64_t numPoints;
+			std::vector<std::size_t> leaves;
+		};
+		std::vector<std::size_t> order = MortonOrder(nodes);
+		std::vector<Group> groups(order.size());
+		for (std::size_t i = 0; i < order.size(); ++i)
+		{
+			const Eigen::Vector3i& cell = cells[order[i]];
+			groups[i].key = MortonEncode(cell.x(), cell.y(), cell.z());
+			groups[i].level = 0;
+			groups[i].numPoints = nodes[order[i]]->numPoints;
+			groups[i].leaves.push_back(order[i]);
+		}
+
+		// Merge sibling groups bottom-up, a group which is not merged stops its parent from merging
+		for (unsigned int level = 1; (unitPoints > 0) && (level <= 21); ++level)
+		{
+			bool changed = false;
+			std::vector<Group> parents;
+			for (std::size_t begin = 0; begin < groups.size();)
+			{
+				std::size_t end = begin;
+				uint64_t numPoints = 0;
+				bool complete = true;
+				for (; (end < groups.size()) && ((groups[end].key >> (3 * level)) == (groups[begin].key >> (3 * level))); ++end)
+				{
+					numPoints += groups[end].numPoints;
+					complete = complete && (groups[end].level == level - 1);
+				}
+
+				if (complete && (numPoints <= unitPoints) && (end - begin > 1))
+				{
+					Group parent;
+					parent.key = groups[begin].key;
+					parent.level = level;
+					parent.numPoints = numPoints;
+					for (std::size_t gi = begin; gi < end; ++gi)
+						parent.leaves.insert(parent.leaves.end(), groups[gi].leaves.begin(), groups[gi].leaves.end());
+					parents.push_back(parent);
+					changed = true;
+				}
+				else
+				{
+					for (std::size_t gi = begin; gi < end; ++gi)
+					{
+						// A single sibling keeps climbing, it is the whole cell
+						if (complete && (end - begin == 1) && (groups[gi].numPoints <= unitPoints))
+						{
+							groups[gi].level = level;
+							changed = true;
+						}
+						parents.push_back(groups[gi]);
+					}
+				}
+				begin = end;
+			}
+			groups.swap(parents);
+			if (!changed)
+				break;
+		}
+
+		std::vector<WorkUnit> workUnits;
+		for (std::size_t gi = 0; gi < groups.size(); ++gi)
+		{
+			const Group& group = groups[gi];
+
+			// Split a dense leaf into octants, while octants are larger than 2 * searchRadius
+			if ((unitPoints > 0) && (group.leaves.size() == 1) && (group.numPoints > unitPoints))
+			{
+				const Node& node = *nodes[group.leaves[0]];
+				unsigned int level = (unsigned int)std::ceil(std::log((double)group.numPoints / (double)unitPoints) / std::log(8.0));
+				while ((level > 0) && ((node.maxBB - node.minBB).minCoeff() / (double)(((int64_t)1) << level) < 2.0 * searchRadius))
+					level--;
+				level = std::min(level, 3u);
+				if (level > 0)
+				{
+					LeafHaloCache_SplitLeaf(node, level, workUnits);
+					continue;
+				}
+			}
+
+			WorkUnit unit;
+			unit.minBB = nodes[group.leaves[0]]->minBB;
+			unit.maxBB = nodes[group.leaves[0]]->maxBB;
+			unit.numPoints = group.numPoints;
+			for (std::size_t li = 0; li < group.leaves.size(); ++li)
+			{
+				const Node& node = *nodes[group.leaves[li]];
+				unit.minBB = unit.minBB.cwiseMin(node.minBB);
+				unit.maxBB = unit.maxBB.cwiseMax(node.maxBB);
+				unit.ownedBBs.push_back(std::pair<Eigen::Vector3d, Eigen::Vector3d>(node.minBB, node.maxBB));
+			}
+			workUnits.push_back(unit);
+		}
+		return workUnits;
+	}
+
+	LeafHaloCache::LeafHaloCache(const std::vector<const Node*>& nodes, const std::vector<WorkUnit>& workUnits, const double searchRadius) : searchRadius(searchRadius), numReads(0), numResidentPoints(0)
+	{
+		std::vector<Eigen::Vector3i> cells;
+		Eigen::Vector3d gridMin, leafSize;
+		LeafHaloCache_LeafCells(nodes, cells, gridMin, leafSize);
+
+		std::unordered_map<uint64_t, std::size_t> cellLeaves;
+		leaves.resize(nodes.size());
+		for (std::size_t i = 0; i < nodes.size(); ++i)
+		{
+			leaves[i].node = nodes[i];
+			leaves[i].minBB = nodes[i]->minBB;
+			leaves[i].maxBB = nodes[i]->maxBB;
+			leaves[i].numRefs = 0;
+			cellLeaves[MortonEncode(cells[i].x(), cells[i].y(), cells[i].z())] = i;
+		}
+
+		// Find the leaves overlapping each halo, in Morton order
+		Eigen::Vector3d extXYZ(searchRadius, searchRadius, searchRadius);
+		units.resize(workUnits.size());
+		for (std::size_t i = 0; i < workUnits.size(); ++i)
+		{
+			units[i].minBB = workUnits[i].minBB;
+			units[i].maxBB = workUnits[i].maxBB;
+			Eigen::Vector3d extMinBB = units[i].minBB - extXYZ;
+			Eigen::Vector3d extMaxBB = units[i].maxBB + extXYZ;
+			Eigen::Vector3i cellMin = ((extMinBB - gridMin).cwiseQuotient(leafSize).array().floor()).cast<int>().cwiseMax(0);
+			Eigen::Vector3i cellMax = ((extMaxBB - gridMin).cwiseQuotient(leafSize).array().floor()).cast<int>();
+			std::vector<std::pair<uint64_t, std::size_t>> neighbors;
+			for (int z = cellMin.z(); z <= cellMax.z(); ++z)
+			{
+				for (int y = cellMin.y(); y <= cellMax.y(); ++y)
+				{
+					for (int x = cellMin.x(); x <= cellMax.x(); ++x)
+					{
+						uint64_t key = MortonEncode(x, y, z);
+						auto it = cellLeaves.find(key);
+						if (it == cellLeaves.end())
+							continue;
+						const Leaf& leaf = leaves[it->second];
+						if ((leaf.minBB.array() <= extMaxBB.array()).all() && (leaf.maxBB.array() >= extMinBB.array()).all())
+							neighbors.push_back(std::pair<uint64_t, std::size_t>(key, it->second));
+					}
+				}
+			}
+			std::sort(neighbors.begin(), neighbors.end());
+
+			units[i].neighbors.resize(neighbors.size());
+			for (std::size_t ni = 0; ni < neighbors.size(); ++ni)
+			{
+				units[i].neighbors[ni] = neighbors[ni].second;
+				leaves[neighbors[ni].second].numRefs++;
+			}
+		}
+	}
+
+	pcl::PointCloud<PointE57>::Ptr LeafHaloCache::Acquire(const std::size_t leafID)
+	{
+		Leaf& leaf = leaves[leafID];
+		std::promise<pcl::PointCloud<PointE57>::Ptr> promise;
+		std::shared_future<pcl::PointCloud<PointE57>::Ptr> cloud;
+		bool load = false;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (!leaf.cloud.valid())
+			{
+				leaf.cloud = promise.get_future().share();
+				load = true;
+				numResidentPoints += leaf.node->numPoints;
+			}
+			cloud = leaf.cloud;
+		}
+
+		// Leaves are decoded by the first query reaching them, the others wait for it
+		if (load)
+		{
+			try
+			{
+				pcl::PointCloud<PointE57>::Ptr leafCloud(new pcl::PointCloud<PointE57>);
+				if ((leaf.node->numPoints > 0) && boost::filesystem::exists(leaf.node->pcdPath))
+				{
+					LeafReader(leaf.node->pcdPath).Read(*leafCloud);
+					numReads++;
+				}
+				promise.set_value(leafCloud);
+			}
+			catch (...)
+			{
+				promise.set_exception(std::current_exception());
+			}
+		}
+		return cloud.get();
+	}
+
+	void LeafHaloCache::Release(const std::size_t leafID)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		Leaf& leaf = leaves[leafID];
+		if (leaf.numRefs > 0)
+			leaf.numRefs--;
+		if ((leaf.numRefs == 0) && leaf.cloud.valid())
+		{
+			leaf.cloud = std::shared_future<pcl::PointCloud<PointE57>::Ptr>();
+			numResidentPoints -= leaf.node->numPoints;
+		}
+	}
+
+	void LeafHaloCache::Query(const std::size_t unitID, pcl::PointCloud<PointExchange>& out)
+	{
+		out.clear();
+		Eigen::Vector3d extXYZ(searchRadius, searchRadius, searchRadius);
+		Eigen::Vector3d extMinBB = units[unitID].minBB - extXYZ;
+		Eigen::Vector3d extMaxBB = units[unitID].maxBB + extXYZ;
+		Eigen::Vector3f extMinBBf = extMinBB.cast<float>();
+		Eigen::Vector3f extMaxBBf = extMaxBB.cast<float>();
+
+		for (std::size_t ni = 0; ni < units[unitID].neighbors.size(); ++ni)
+		{
+			std::size_t neighborID = units[unitID].neighbors[ni];
+			const Leaf& neighbor = leaves[neighborID];
+			pcl::PointCloud<PointE57>::Ptr cloud = Acquire(neighborID);
+
+			// Keep the whole leaf if it is inside the halo, or keep the points inside the halo
+			if ((neighbor.minBB.array() >= extMinBB.array()).all() && (neighbor.maxBB.array() <= extMaxBB.array()).all())
+			{
+				out.reserve(out.size() + cloud->size());
+				for (std::size_t pi = 0; pi < cloud->size(); ++pi)
+					out.push_back((*cloud)[pi]);
+			}
+			else
+			{
+				for (std::size_t pi = 0; pi < cloud->size(); ++pi)
+				{
+					const PointE57& p = (*cloud)[pi];
+					if (p.x >= extMinBBf.x() && p.y >= extMinBBf.y() && p.z >= extMinBBf.z() &&
+						p.x <= extMaxBBf.x() && p.y <= extMaxBBf.y() && p.z <= extMaxBBf.z())
+						out.push_back(p);
+				}
+			}
+			Release(neighborID);
+		}
+		out.width = out.size();
+		out.height = 1;
+	}
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <future>
+
+#include <pcl/point_cloud.h>
+
+#include "E57Utils.h"
+#include "E57Converter.h"
+
+namespace e57
+{
+	// Box processed as one export work unit: a leaf, a part of a dense leaf, or a group of sparse sibling leaves.
+	struct WorkUnit
+	{
+		Eigen::Vector3d minBB; // AABB of ownedBBs
+		Eigen::Vector3d maxBB;
+		std::vector<std::pair<Eigen::Vector3d, Eigen::Vector3d>> ownedBBs; // half open boxes whose voxels are owned by this unit
+		uint64_t numPoints; // estimated from the leaf sizes
+	};
+
+	// Cache of decoded OCT leaves for halo queries, which gather the points of a work unit and of its neighbor leaves within searchRadius.
+	// Each leaf is read and decoded once, then kept until every work unit whose halo overlaps it has been queried. Visiting the units in Morton order keeps the number of resident leaves small.
+	// All leaves must have the same depth, Query gives the same points as OCT::queryBoundingBox on the extended unit AABB.
+	class LeafHaloCache
+	{
+	public:
+		using Node = OCTNodeIndex::Node;
+
+	protected:
+		struct Leaf
+		{
+			const Node* node;
+			Eigen::Vector3d minBB;
+			Eigen::Vector3d maxBB;
+			std::size_t numRefs; // number of halos not queried yet which overlap this leaf
+			std::shared_future<pcl::PointCloud<PointE57>::Ptr> cloud;
+		};
+
+		struct Unit
+		{
+			Eigen::Vector3d minBB;
+			Eigen::Vector3d maxBB;
+			std::vector<std::size_t> neighbors; // leaves overlapping the halo of this unit
+		};
+
+		std::vector<Leaf> leaves;
+		std::vector<Unit> units;
+		double searchRadius;
+		std::mutex mutex;
+		std::atomic<uint64_t> numReads;
+		std::atomic<uint64_t> numResidentPoints;
+
+		pcl::PointCloud<PointE57>::Ptr Acquire(const std::size_t leafID);
+		void Release(const std::size_t leafID);
+
+	public:
+		// nodes: OCT leaves with the same depth. workUnits: Boxes to query, usually from PlanWorkUnits.
+		LeafHaloCache(const std::vector<const Node*>& nodes, const std::vector<WorkUnit>& workUnits, const double searchRadius);
+
+		// Visit order of nodes along the Morton curve of the leaf grid
+		static std::vector<std::size_t> MortonOrder(const std::vector<const Node*>& nodes);
+
+		// Return true if all nodes have the same depth, which is required by LeafHaloCache
+		static bool IsUniform(const std::vector<const Node*>& nodes);
+
+		// Work units of nodes in Morton order, each holding about unitPoints points, or one unit per leaf if unitPoints is zero.
+		// Sibling leaves are merged while their total is not larger than unitPoints. Leaves larger than unitPoints are split into octants, down to an edge of 2 * searchRadius so halos stay small.
+		// Units are planned from point counts, so a split leaf gives equal boxes instead of equal point counts.
+		static std::vector<WorkUnit> PlanWorkUnits(const std::vector<const Node*>& nodes, const uint64_t unitPoints, const double searchRadius);
+
+		// Gather the points inside the AABB of unitID extended by searchRadius, converted to PointExchange while they are gathered. Each unitID must be queried once.
+		void Query(const std::size_t unitID, pcl::PointCloud<PointExchange>& out);
+
+		// Leaves overlapping the halo of unitID, as indices of the nodes given to the constructor
+		const std::vector<std::size_t>& Neighbors(const std::size_t unitID) const { return units[unitID].neighbors; }
+
+		// Number of leaf reads from disk
+		uint64_t NumReads() const { return numReads; }
+
+		// Points of the leaves kept in the cache, counted from the node sizes
+		uint64_t NumResidentPoints() const { return numResidentPoints; }
+	};
+}
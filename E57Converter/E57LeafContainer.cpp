@@ -0,0 +1,158 @@
+#include <random>
+#include <iterator>
+#include <fstream>
+#include <algorithm>
+
+#include <pcl/conversions.h>
+#include <pcl/exceptions.h>
+
+#include "E57LeafReader.h"
+#include "E57LeafContainer.h"
+
+namespace e57
+{
+	LeafFormat& OutofcoreLeafContainer::Format()
+	{
+		static LeafFormat format;
+		return format;
+	}
+
+	OutofcoreLeafContainer::OutofcoreLeafContainer() : numPoints(0)
+	{
+		std::string uuid;
+		getRandomUUIDString(uuid);
+		filePath = boost::filesystem::temp_directory_path() / boost::filesystem::path(uuid + ".pcd");
+	}
+
+	OutofcoreLeafContainer::OutofcoreLeafContainer(const boost::filesystem::path& path) : filePath(path), numPoints(0)
+	{
+		if (boost::filesystem::is_directory(filePath))
+		{
+			std::string uuid;
+			getRandomUUIDString(uuid);
+			filePath /= boost::filesystem::path(uuid + ".pcd");
+		}
+		if (boost::filesystem::exists(filePath))
+			numPoints = LeafReader(filePath).NumPoints();
+	}
+
+	void OutofcoreLeafContainer::Load(pcl::PointCloud<PointE57>& cloud) const
+	{
+		cloud.clear();
+		if ((numPoints > 0) && boost::filesystem::exists(filePath))
+			LeafReader(filePath).Read(cloud);
+	}
+
+	void OutofcoreLeafContainer::Append(const pcl::PointCloud<PointE57>& cloud)
+	{
+		if (cloud.empty())
+			return;
+		pcl::PointCloud<PointE57> nodeCloud;
+		Load(nodeCloud);
+		nodeCloud += cloud;
+		WriteLeaf(filePath, nodeCloud, Format());
+		numPoints = nodeCloud.size();
+	}
+
+	void OutofcoreLeafContainer::insertRange(const PointE57* start, const uint64_t count)
+	{
+		pcl::PointCloud<PointE57> cloud;
+		cloud.reserve(count);
+		for (uint64_t i = 0; i < count; ++i)
+			cloud.push_back(start[i]);
+		Append(cloud);
+	}
+
+	void OutofcoreLeafContainer::insertRange(const PointE57* const* start, const uint64_t count)
+	{
+		pcl::PointCloud<PointE57> cloud;
+		cloud.reserve(count);
+		for (uint64_t i = 0; i < count; ++i)
+			cloud.push_back(*start[i]);
+		Append(cloud);
+	}
+
+	void OutofcoreLeafContainer::insertRange(const AlignedPointTVector& src)
+	{
+		if (!src.empty())
+			insertRange(src.data(), src.size());
+	}
+
+	int OutofcoreLeafContainer::insertRange(const pcl::PCLPointCloud2::Ptr& inputCloud)
+	{
+		pcl::PointCloud<PointE57> cloud;
+		pcl::fromPCLPointCloud2(*inputCloud, cloud);
+		Append(cloud);
+		return 0;
+	}
+
+	void OutofcoreLeafContainer::readRange(const uint64_t start, const uint64_t count, AlignedPointTVector& dst)
+	{
+		if (start + count > numPoints)
+			throw pcl::PCLException("Read range is out of node file " + filePath.string() + ".");
+		pcl::PointCloud<PointE57> cloud;
+		Load(cloud);
+		dst.insert(dst.end(), cloud.begin() + start, cloud.begin() + start + count);
+	}
+
+	void OutofcoreLeafContainer::readRange(const uint64_t start, const uint64_t count, pcl::PCLPointCloud2::Ptr& dst)
+	{
+		AlignedPointTVector points;
+		readRange(start, count, points);
+		pcl::PointCloud<PointE57> cloud;
+		cloud.reserve(points.size());
+		for (std::size_t i = 0; i < points.size(); ++i)
+			cloud.push_back(points[i]);
+		pcl::toPCLPointCloud2(cloud, *dst);
+	}
+
+	int OutofcoreLeafContainer::read(pcl::PCLPointCloud2::Ptr& outputCloud)
+	{
+		pcl::PointCloud<PointE57> cloud;
+		Load(cloud);
+		pcl::toPCLPointCloud2(cloud, *outputCloud);
+		return 0;
+	}
+
+	void OutofcoreLeafContainer::readRangeSubSample(const uint64_t start, const uint64_t count, const double percent, AlignedPointTVector& dst)
+	{
+		AlignedPointTVector points;
+		readRange(start, count, points);
+		const std::size_t numSamples = std::min((std::size_t)(std::max(percent, 0.0) * (double)points.size()), points.size());
+		std::mt19937 rng((uint32_t)numPoints);
+		std::sample(points.begin(), points.end(), std::back_inserter(dst), numSamples, rng);
+	}
+
+	void OutofcoreLeafContainer::clear()
+	{
+		if (boost::filesystem::exists(filePath))
+			boost::filesystem::remove(filePath);
+		numPoints = 0;
+	}
+
+	void OutofcoreLeafContainer::convertToXYZ(const boost::filesystem::path& path)
+	{
+		pcl::PointCloud<PointE57> cloud;
+		Load(cloud);
+		std::ofstream file(path.string(), std::ios_base::out);
+		if (!file)
+			throw pcl::PCLException("Create file " + path.string() + " failed.");
+		for (std::size_t pi = 0; pi < cloud.size(); ++pi)
+			file << cloud[pi].x << " " << cloud[pi].y << " " << cloud[pi].z << "\n";
+		file.close();
+	}
+
+	PointE57 OutofcoreLeafContainer::operator[](uint64_t idx) const
+	{
+		if (idx >= numPoints)
+			throw pcl::PCLException("Point index is out of node file " + filePath.string() + ".");
+		pcl::PointCloud<PointE57> cloud;
+		Load(cloud);
+		return cloud[idx];
+	}
+
+	void OutofcoreLeafContainer::getRandomUUIDString(std::string& s)
+	{
+		pcl::outofcore::OutofcoreOctreeDiskContainer<PointE57>::getRandomUUIDString(s);
+	}
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <string>
+
+#include <boost/filesystem.hpp>
+#include <pcl/point_cloud.h>
+#include <pcl/PCLPointCloud2.h>
+#include <pcl/outofcore/outofcore.h>
+
+#include "PointType.h"
+#include "E57LeafFormat.h"
+
+namespace e57
+{
+	// Node container of OCT, replace pcl::outofcore::OutofcoreOctreeDiskContainer so node files are written in LeafFormat and read by LeafReader.
+	// Node files keep the .pcd names given by pcl::outofcore, a node file is either a PCD file or a compact leaf, LeafReader tells them apart by the magic.
+	// Inserting points rewrites the whole node file, the same as OutofcoreOctreeDiskContainer does.
+	class OutofcoreLeafContainer : public pcl::outofcore::OutofcoreAbstractNodeContainer<PointE57>
+	{
+	public:
+		using AlignedPointTVector = pcl::outofcore::OutofcoreAbstractNodeContainer<PointE57>::AlignedPointTVector;
+
+	protected:
+		boost::filesystem::path filePath;
+		uint64_t numPoints;
+
+		void Load(pcl::PointCloud<PointE57>& cloud) const;
+		void Append(const pcl::PointCloud<PointE57>& cloud);
+
+	public:
+		// Format of written node files, shared by all containers since pcl::outofcore creates containers from a path only
+		static LeafFormat& Format();
+
+		OutofcoreLeafContainer();
+
+		// path: Node file, or a directory where a node file with a random name is created
+		OutofcoreLeafContainer(const boost::filesystem::path& path);
+
+		void insertRange(const PointE57* start, const uint64_t count) override;
+		void insertRange(const PointE57* const* start, const uint64_t count) override;
+		void insertRange(const AlignedPointTVector& src);
+		int insertRange(const pcl::PCLPointCloud2::Ptr& inputCloud);
+
+		void readRange(const uint64_t start, const uint64_t count, AlignedPointTVector& dst) override;
+		void readRange(const uint64_t start, const uint64_t count, pcl::PCLPointCloud2::Ptr& dst);
+		int read(pcl::PCLPointCloud2::Ptr& outputCloud);
+
+		// Sampling is seeded by the node size, so the same node gives the same samples
+		void readRangeSubSample(const uint64_t start, const uint64_t count, const double percent, AlignedPointTVector& dst) override;
+
+		void push_back(const PointE57& p) { insertRange(&p, 1); }
+		void flush(const bool forceCacheDealloc) {}
+
+		bool empty() const override { return numPoints == 0; }
+		uint64_t size() const override { return numPoints; }
+		uint64_t getDataSize() const { return numPoints; }
+		void clear() override;
+		void convertToXYZ(const boost::filesystem::path& path) override;
+		PointE57 operator[](uint64_t idx) const override;
+
+		std::string path() const { return filePath.string(); }
+		const boost::filesystem::path& getFileName() const { return filePath; }
+
+		static void getRandomUUIDString(std::string& s);
+	};
+}
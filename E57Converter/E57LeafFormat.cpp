@@ -0,0 +1,174 @@
+#include <map>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+#include <pcl/common/io.h>
+#include <pcl/io/pcd_io.h>
+#include <pcl/io/lzf.h>
+#include <pcl/exceptions.h>
+
+#include "E57LeafFormat.h"
+
+namespace e57
+{
+	// Append a column and its block, the block is LZF compressed if it shrinks
+	void WriteLeaf_AddColumn(const std::string& name, const uint32_t elementBytes, std::vector<char>& block, const bool compress, std::vector<LeafColumn>& columns, std::vector<std::vector<char>>& blocks)
+	{
+		LeafColumn column;
+		std::memset(column.name, 0, sizeof(column.name));
+		std::strncpy(column.name, name.c_str(), sizeof(column.name) - 1);
+		column.elementBytes = elementBytes;
+		column.storedBytes = block.size();
+
+		if (compress && !block.empty())
+		{
+			std::vector<char> compressed(block.size());
+			unsigned int compressedBytes = pcl::lzfCompress(block.data(), (unsigned int)block.size(), compressed.data(), (unsigned int)compressed.size());
+			if ((compressedBytes > 0) && (compressedBytes < block.size()))
+			{
+				compressed.resize(compressedBytes);
+				block.swap(compressed);
+				column.storedBytes = compressedBytes;
+			}
+		}
+		columns.push_back(column);
+		blocks.push_back(std::vector<char>());
+		blocks.back().swap(block);
+	}
+
+	void WriteLeaf(const boost::filesystem::path& filePath, const pcl::PointCloud<PointE57>& cloud, const LeafFormat& format)
+	{
+		if (cloud.empty())
+		{
+			if (boost::filesystem::exists(filePath))
+				boost::filesystem::remove(filePath);
+			return;
+		}
+
+		if (!format.IsCompact())
+		{
+			pcl::PCDWriter writer;
+			if (writer.writeBinaryCompressed(filePath.string(), cloud) != 0)
+				throw pcl::PCLException("Create file " + filePath.string() + " failed.");
+			return;
+		}
+
+		// Quantize positions to the global grid of precision, so points keep their grid position when a node is rewritten
+		const std::size_t numPoints = cloud.size();
+		std::vector<int64_t> grid[3];
+		int64_t gridMin[3], gridMax[3];
+		for (int a = 0; a < 3; ++a)
+		{
+			grid[a].resize(numPoints);
+			gridMin[a] = std::numeric_limits<int64_t>::max();
+			gridMax[a] = std::numeric_limits<int64_t>::lowest();
+		}
+		for (std::size_t pi = 0; pi < numPoints; ++pi)
+		{
+			for (int a = 0; a < 3; ++a)
+			{
+				double v = cloud[pi].data[a];
+				if (!std::isfinite(v))
+					throw pcl::PCLException("Non finite point can not be written to " + filePath.string() + ".");
+				grid[a][pi] = std::llround(v / format.precision);
+				gridMin[a] = std::min(gridMin[a], grid[a][pi]);
+				gridMax[a] = std::max(gridMax[a], grid[a][pi]);
+			}
+		}
+		int64_t maxExtent = 0;
+		for (int a = 0; a < 3; ++a)
+			maxExtent = std::max(maxExtent, gridMax[a] - gridMin[a]);
+		if (maxExtent > (int64_t)std::numeric_limits<uint32_t>::max())
+			throw pcl::PCLException("Precision is too fine for the extent of " + filePath.string() + ".");
+
+		LeafHeader header;
+		std::memcpy(header.magic, compactLeafMagic, sizeof(header.magic));
+		header.version = compactLeafVersion;
+		header.numPoints = numPoints;
+		header.precision = format.precision;
+		for (int a = 0; a < 3; ++a)
+			header.origin[a] = gridMin[a];
+		header.positionBytes = (maxExtent <= (int64_t)std::numeric_limits<uint16_t>::max()) ? 2 : 4;
+		header.compressed = format.compress ? 1 : 0;
+
+		// Points per scan ID of the node
+		std::vector<uint32_t> scanIDs;
+		std::vector<uint64_t> scanCounts;
+#ifdef POINT_E57_WITH_LABEL
+		{
+			std::map<uint32_t, uint64_t> scanIDCounts;
+			for (std::size_t pi = 0; pi < numPoints; ++pi)
+				scanIDCounts[cloud[pi].label]++;
+			for (std::map<uint32_t, uint64_t>::const_iterator it = scanIDCounts.begin(); it != scanIDCounts.end(); ++it)
+			{
+				scanIDs.push_back(it->first);
+				scanCounts.push_back(it->second);
+			}
+		}
+#endif
+		header.numScanIDs = (uint32_t)scanIDs.size();
+
+		// Columns
+		std::vector<LeafColumn> columns;
+		std::vector<std::vector<char>> blocks;
+		const char* axisNames[3] = { "x", "y", "z" };
+		for (int a = 0; a < 3; ++a)
+		{
+			std::vector<char> block(numPoints * header.positionBytes);
+			for (std::size_t pi = 0; pi < numPoints; ++pi)
+			{
+				if (header.positionBytes == 2)
+				{
+					uint16_t v = (uint16_t)(grid[a][pi] - gridMin[a]);
+					std::memcpy(block.data() + pi * 2, &v, 2);
+				}
+				else
+				{
+					uint32_t v = (uint32_t)(grid[a][pi] - gridMin[a]);
+					std::memcpy(block.data() + pi * 4, &v, 4);
+				}
+			}
+			grid[a] = std::vector<int64_t>();
+			WriteLeaf_AddColumn(axisNames[a], header.positionBytes, block, format.compress, columns, blocks);
+		}
+
+		std::vector<pcl::PCLPointField> fields;
+		pcl::getFields<PointE57>(fields);
+		for (const auto& field : fields)
+		{
+			if ((field.name == "_") || (field.name == "x") || (field.name == "y") || (field.name == "z"))
+				continue;
+			const uint32_t elementBytes = pcl::getFieldSize(field.datatype) * field.count;
+			std::vector<char> block(numPoints * elementBytes);
+			for (std::size_t pi = 0; pi < numPoints; ++pi)
+				std::memcpy(block.data() + pi * elementBytes, reinterpret_cast<const char*>(&cloud[pi]) + field.offset, elementBytes);
+			WriteLeaf_AddColumn(field.name, elementBytes, block, format.compress, columns, blocks);
+		}
+		header.numColumns = (uint16_t)columns.size();
+
+		std::ofstream file(filePath.string(), std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+		if (!file)
+			throw pcl::PCLException("Create file " + filePath.string() + " failed.");
+		file.write(reinterpret_cast<const char*>(&header), sizeof(LeafHeader));
+		file.write(reinterpret_cast<const char*>(scanIDs.data()), scanIDs.size() * sizeof(uint32_t));
+		file.write(reinterpret_cast<const char*>(scanCounts.data()), scanCounts.size() * sizeof(uint64_t));
+		file.write(reinterpret_cast<const char*>(columns.data()), columns.size() * sizeof(LeafColumn));
+		for (std::size_t ci = 0; ci < blocks.size(); ++ci)
+			file.write(blocks[ci].data(), blocks[ci].size());
+		if (!file)
+			throw pcl::PCLException("Write file " + filePath.string() + " failed.");
+		file.close();
+	}
+
+	bool IsCompactLeaf(const boost::filesystem::path& filePath)
+	{
+		std::ifstream file(filePath.string(), std::ios_base::in | std::ios_base::binary);
+		char magic[4];
+		if (!file.read(magic, sizeof(magic)))
+			return false;
+		return std::memcmp(magic, compactLeafMagic, sizeof(magic)) == 0;
+	}
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <vector>
+#include <string>
+
+#include <boost/filesystem.hpp>
+#include <pcl/point_cloud.h>
+
+#include "PointType.h"
+
+namespace e57
+{
+	// Storage format of OCT node files.
+	// precision: If larger than zero, nodes are written in the compact leaf format: a small header with the point count and the points per scan ID, then one block per attribute (columnar).
+	//     Positions are quantized to a grid of precision meters relative to the node origin, and stored with 2 or 4 bytes per axis depending on the node extent.
+	//     If zero, nodes are written as binary_compressed PCD files, the same as pcl::outofcore::OutofcoreOctreeDiskContainer.
+	// compress: LZF compress each block of compact leaves, a block is kept raw if it does not shrink.
+	struct LeafFormat
+	{
+		double precision;
+		bool compress;
+
+		LeafFormat(const double precision = 0.0, const bool compress = false) : precision(precision), compress(compress) {}
+
+		bool IsCompact() const { return precision > 0.0; }
+	};
+
+	// Compact leaf file layout, all values little-endian:
+	//     LeafHeader, uint32_t scanIDs[numScanIDs], uint64_t scanCounts[numScanIDs] (since version 2), LeafColumn columns[numColumns], then the blocks of columns in order.
+	//     Columns "x", "y", "z" hold grid offsets from origin, the other columns hold the fields of PointE57 with the same name.
+	const char compactLeafMagic[4] = { 'E', '5', '7', 'L' };
+	const uint32_t compactLeafVersion = 2;
+
+#pragma pack(push, 1)
+	struct LeafHeader
+	{
+		char magic[4];
+		uint32_t version;
+		uint64_t numPoints;
+		double precision;
+		int64_t origin[3]; // in grid units of precision
+		uint8_t positionBytes; // 2 or 4
+		uint8_t compressed;
+		uint16_t numColumns;
+		uint32_t numScanIDs;
+	};
+
+	struct LeafColumn
+	{
+		char name[16];
+		uint32_t elementBytes;
+		uint64_t storedBytes; // equals numPoints * elementBytes if the block is raw
+	};
+#pragma pack(pop)
+
+	// Write points to a node file in format, the file is replaced
+	void WriteLeaf(const boost::filesystem::path& filePath, const pcl::PointCloud<PointE57>& cloud, const LeafFormat& format);
+
+	// Return true if filePath is a compact leaf file
+	bool IsCompactLeaf(const boost::filesystem::path& filePath);
+}
@@ -0,0 +1,327 @@
+#include <map>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <pcl/common/io.h>
+#include <pcl/io/pcd_io.h>
+#include <pcl/io/lzf.h>
+#include <pcl/exceptions.h>
+
+#include "E57LeafReader.h"
+
+namespace e57
+{
+	LeafReader::LeafReader(const boost::filesystem::path& pcdPath) : pcdPath(pcdPath), pointStep(0), numPoints(0), dataType(DataType::ASCII), dataOffset(0)
+	{
+		std::ifstream file(pcdPath.string(), std::ios_base::in | std::ios_base::binary);
+		if (!file)
+			throw pcl::PCLException("Load file " + pcdPath.string() + " failed.");
+
+		char magic[4] = { 0, 0, 0, 0 };
+		file.read(magic, sizeof(magic));
+		file.clear();
+		file.seekg(0);
+		if (std::memcmp(magic, compactLeafMagic, sizeof(magic)) == 0)
+		{
+			LoadCompactHeader(file);
+			return;
+		}
+
+		std::vector<std::string> names;
+		std::vector<std::size_t> sizes;
+		std::vector<std::size_t> counts;
+		uint64_t width = 0, height = 1;
+		bool hasPoints = false, hasData = false;
+		std::string line;
+		while (!hasData && std::getline(file, line))
+		{
+			if (!line.empty() && (line.back() == '\r'))
+				line.pop_back();
+			std::stringstream ss(line);
+			std::string key;
+			ss >> key;
+
+			if (key == "FIELDS")
+			{
+				std::string name;
+				while (ss >> name)
+					names.push_back(name);
+			}
+			else if (key == "SIZE")
+			{
+				std::size_t size;
+				while (ss >> size)
+					sizes.push_back(size);
+			}
+			else if (key == "COUNT")
+			{
+				std::size_t count;
+				while (ss >> count)
+					counts.push_back(count);
+			}
+			else if (key == "WIDTH")
+				ss >> width;
+			else if (key == "HEIGHT")
+				ss >> height;
+			else if (key == "POINTS")
+			{
+				ss >> numPoints;
+				hasPoints = true;
+			}
+			else if (key == "DATA")
+			{
+				std::string type;
+				ss >> type;
+				if (type == "binary")
+					dataType = DataType::BINARY;
+				else if (type == "binary_compressed")
+					dataType = DataType::BINARY_COMPRESSED;
+				else
+					dataType = DataType::ASCII;
+				dataOffset = (std::size_t)file.tellg();
+				hasData = true;
+			}
+		}
+		if (!hasData || names.empty() || (names.size() != sizes.size()) || (!counts.empty() && (counts.size() != names.size())))
+			throw pcl::PCLException("Parse PCD header of " + pcdPath.string() + " failed.");
+		if (!hasPoints)
+			numPoints = width * height;
+
+		fields.resize(names.size());
+		for (std::size_t fi = 0; fi < names.size(); ++fi)
+		{
+			fields[fi].name = names[fi];
+			fields[fi].size = sizes[fi] * (counts.empty() ? 1 : counts[fi]);
+			fields[fi].offset = pointStep;
+			fields[fi].storedBytes = 0;
+			pointStep += fields[fi].size;
+		}
+	}
+
+	void LeafReader::LoadCompactHeader(std::ifstream& file)
+	{
+		if (!file.read(reinterpret_cast<char*>(&compactHeader), sizeof(LeafHeader)) || (compactHeader.version < 1) || (compactHeader.version > compactLeafVersion) ||
+			((compactHeader.positionBytes != 2) && (compactHeader.positionBytes != 4)))
+			throw pcl::PCLException("Parse compact leaf header of " + pcdPath.string() + " failed.");
+		dataType = DataType::COMPACT;
+		numPoints = compactHeader.numPoints;
+
+		scanIDs.resize(compactHeader.numScanIDs);
+		std::vector<LeafColumn> columns(compactHeader.numColumns);
+		file.read(reinterpret_cast<char*>(scanIDs.data()), scanIDs.size() * sizeof(uint32_t));
+		if (compactHeader.version >= 2)
+		{
+			scanCounts.resize(compactHeader.numScanIDs);
+			file.read(reinterpret_cast<char*>(scanCounts.data()), scanCounts.size() * sizeof(uint64_t));
+		}
+		file.read(reinterpret_cast<char*>(columns.data()), columns.size() * sizeof(LeafColumn));
+		if (!file)
+			throw pcl::PCLException("Parse compact leaf header of " + pcdPath.string() + " failed.");
+		dataOffset = (std::size_t)file.tellg();
+
+		std::size_t blockOffset = 0;
+		fields.resize(columns.size());
+		for (std::size_t ci = 0; ci < columns.size(); ++ci)
+		{
+			fields[ci].name = std::string(columns[ci].name, strnlen(columns[ci].name, sizeof(columns[ci].name)));
+			fields[ci].size = columns[ci].elementBytes;
+			fields[ci].offset = blockOffset;
+			fields[ci].storedBytes = columns[ci].storedBytes;
+			blockOffset += columns[ci].storedBytes;
+			pointStep += columns[ci].elementBytes;
+		}
+	}
+
+	template <typename PointT>
+	uint64_t LeafReader::Read(pcl::PointCloud<PointT>& out, const Eigen::Vector3d* minBB, const Eigen::Vector3d* maxBB) const
+	{
+		const std::size_t outStart = out.size();
+		const bool crop = (minBB != nullptr) && (maxBB != nullptr);
+		const Eigen::Vector3f minBBf = crop ? Eigen::Vector3f(minBB->cast<float>()) : Eigen::Vector3f::Zero();
+		const Eigen::Vector3f maxBBf = crop ? Eigen::Vector3f(maxBB->cast<float>()) : Eigen::Vector3f::Zero();
+		auto inside = [crop, &minBBf, &maxBBf](const PointT& p)
+		{
+			return !crop || (p.x >= minBBf.x() && p.y >= minBBf.y() && p.z >= minBBf.z() &&
+				p.x <= maxBBf.x() && p.y <= maxBBf.y() && p.z <= maxBBf.z());
+		};
+
+		if (numPoints == 0)
+			return 0;
+
+		// ascii leaves are not written by OCT, read them through pcl
+		if (dataType == DataType::ASCII)
+		{
+			pcl::PointCloud<PointT> cloud;
+			if (pcl::io::loadPCDFile(pcdPath.string(), cloud) != 0)
+				throw pcl::PCLException("Load file " + pcdPath.string() + " failed.");
+			for (std::size_t pi = 0; pi < cloud.size(); ++pi)
+				if (inside(cloud[pi]))
+					out.push_back(cloud[pi]);
+			return out.size() - outStart;
+		}
+
+		boost::interprocess::file_mapping mapping(pcdPath.string().c_str(), boost::interprocess::read_only);
+		boost::interprocess::mapped_region region(mapping, boost::interprocess::read_only);
+		if (region.get_size() < dataOffset)
+			throw pcl::PCLException("Leaf file " + pcdPath.string() + " is truncated.");
+		const char* data = static_cast<const char*>(region.get_address()) + dataOffset;
+		const std::size_t dataSize = region.get_size() - dataOffset;
+
+		// Source of each field, binary is point-major and read in place, binary_compressed is field-major once decoded, compact is field-major per block
+		struct FieldSource
+		{
+			const char* src;
+			std::size_t stride;
+			std::size_t size; // bytes of the decoded element
+		};
+		std::vector<FieldSource> sources(fields.size());
+		std::vector<char> decoded;
+		std::vector<std::vector<char>> decodedColumns;
+		const char* base = data;
+		if (dataType == DataType::COMPACT)
+		{
+			decodedColumns.resize(fields.size());
+			for (std::size_t fi = 0; fi < fields.size(); ++fi)
+			{
+				const Field& field = fields[fi];
+				const std::size_t rawBytes = numPoints * field.size;
+				if (dataSize < field.offset + field.storedBytes)
+					throw pcl::PCLException("Compact leaf " + pcdPath.string() + " is truncated.");
+				const char* block = data + field.offset;
+				if (field.storedBytes != rawBytes)
+				{
+					decodedColumns[fi].resize(rawBytes);
+					if (pcl::lzfDecompress(block, (unsigned int)field.storedBytes, decodedColumns[fi].data(), (unsigned int)rawBytes) != rawBytes)
+						throw pcl::PCLException("Decompress compact leaf " + pcdPath.string() + " failed.");
+					block = decodedColumns[fi].data();
+				}
+
+				// Positions are dequantized to float
+				int axis = (field.name == "x") ? 0 : ((field.name == "y") ? 1 : ((field.name == "z") ? 2 : -1));
+				if (axis >= 0)
+				{
+					std::vector<char> position(numPoints * sizeof(float));
+					for (uint64_t pi = 0; pi < numPoints; ++pi)
+					{
+						uint32_t v = 0;
+						if (compactHeader.positionBytes == 2)
+						{
+							uint16_t v16;
+							std::memcpy(&v16, block + pi * 2, 2);
+							v = v16;
+						}
+						else
+							std::memcpy(&v, block + pi * 4, 4);
+						float p = (float)((double)(compactHeader.origin[axis] + (int64_t)v) * compactHeader.precision);
+						std::memcpy(position.data() + pi * sizeof(float), &p, sizeof(float));
+					}
+					decodedColumns[fi].swap(position);
+					sources[fi].src = decodedColumns[fi].data();
+					sources[fi].stride = sizeof(float);
+					sources[fi].size = sizeof(float);
+				}
+				else
+				{
+					sources[fi].src = block;
+					sources[fi].stride = field.size;
+					sources[fi].size = field.size;
+				}
+			}
+		}
+		else if (dataType == DataType::BINARY)
+		{
+			if (dataSize < numPoints * pointStep)
+				throw pcl::PCLException("PCD file " + pcdPath.string() + " is truncated.");
+		}
+		else
+		{
+			uint32_t compressedSize = 0, uncompressedSize = 0;
+			if (dataSize < 2 * sizeof(uint32_t))
+				throw pcl::PCLException("PCD file " + pcdPath.string() + " is truncated.");
+			std::memcpy(&compressedSize, data, sizeof(uint32_t));
+			std::memcpy(&uncompressedSize, data + sizeof(uint32_t), sizeof(uint32_t));
+			if ((dataSize < 2 * sizeof(uint32_t) + compressedSize) || (uncompressedSize != numPoints * pointStep))
+				throw pcl::PCLException("PCD file " + pcdPath.string() + " is truncated.");
+
+			decoded.resize(uncompressedSize);
+			if (pcl::lzfDecompress(data + 2 * sizeof(uint32_t), compressedSize, decoded.data(), uncompressedSize) != uncompressedSize)
+				throw pcl::PCLException("Decompress PCD file " + pcdPath.string() + " failed.");
+			base = decoded.data();
+		}
+		if (dataType != DataType::COMPACT)
+		{
+			for (std::size_t fi = 0; fi < fields.size(); ++fi)
+			{
+				sources[fi].src = (dataType == DataType::BINARY) ? (base + fields[fi].offset) : (base + fields[fi].offset * numPoints);
+				sources[fi].stride = (dataType == DataType::BINARY) ? pointStep : fields[fi].size;
+				sources[fi].size = fields[fi].size;
+			}
+		}
+
+		// Source and destination of each field kept by PointT
+		struct FieldCopy
+		{
+			const char* src;
+			std::size_t stride;
+			std::size_t dstOffset;
+			std::size_t size;
+		};
+		std::vector<FieldCopy> copies;
+		std::vector<pcl::PCLPointField> dstFields;
+		pcl::getFields<PointT>(dstFields);
+		for (std::size_t fi = 0; fi < fields.size(); ++fi)
+		{
+			for (std::size_t di = 0; di < dstFields.size(); ++di)
+			{
+				if ((dstFields[di].name != fields[fi].name) || (pcl::getFieldSize(dstFields[di].datatype) * dstFields[di].count != sources[fi].size))
+					continue;
+				FieldCopy copy;
+				copy.src = sources[fi].src;
+				copy.stride = sources[fi].stride;
+				copy.dstOffset = dstFields[di].offset;
+				copy.size = sources[fi].size;
+				copies.push_back(copy);
+				break;
+			}
+		}
+
+		if (!crop)
+			out.reserve(outStart + numPoints);
+		for (uint64_t pi = 0; pi < numPoints; ++pi)
+		{
+			PointT p;
+			for (std::size_t ci = 0; ci < copies.size(); ++ci)
+				std::memcpy(reinterpret_cast<char*>(&p) + copies[ci].dstOffset, copies[ci].src + pi * copies[ci].stride, copies[ci].size);
+			if (inside(p))
+				out.push_back(p);
+		}
+		out.width = out.size();
+		out.height = 1;
+		return out.size() - outStart;
+	}
+
+	void LeafReader::CountScans(std::vector<std::pair<uint32_t, uint64_t>>& counts) const
+	{
+		counts.clear();
+		if (!scanCounts.empty() || ((dataType == DataType::COMPACT) && scanIDs.empty()))
+		{
+			for (std::size_t si = 0; si < scanCounts.size(); ++si)
+				counts.push_back(std::pair<uint32_t, uint64_t>(scanIDs[si], scanCounts[si]));
+			return;
+		}
+#ifdef POINT_E57_WITH_LABEL
+		pcl::PointCloud<PointE57> cloud;
+		Read(cloud);
+		std::map<uint32_t, uint64_t> scanIDCounts;
+		for (std::size_t pi = 0; pi < cloud.size(); ++pi)
+			scanIDCounts[cloud[pi].label]++;
+		counts.assign(scanIDCounts.begin(), scanIDCounts.end());
+#endif
+	}
+
+	template uint64_t LeafReader::Read<PointE57>(pcl::PointCloud<PointE57>& out, const Eigen::Vector3d* minBB, const Eigen::Vector3d* maxBB) const;
+	template uint64_t LeafReader::Read<PointExchange>(pcl::PointCloud<PointExchange>& out, const Eigen::Vector3d* minBB, const Eigen::Vector3d* maxBB) const;
+}
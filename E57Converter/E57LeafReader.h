@@ -0,0 +1,62 @@
+#pragma once
+
+#include <vector>
+#include <string>
+
+#include <boost/filesystem.hpp>
+#include <pcl/point_cloud.h>
+
+#include "PointType.h"
+#include "E57LeafFormat.h"
+
+namespace e57
+{
+	// Typed reader of OCT leaf files, instead of reading them to pcl::PCLPointCloud2 and converting it with pcl::fromPCLPointCloud2.
+	// The file is memory-mapped. binary points are decoded in place from the mapping, binary_compressed points (written by OutofcoreOctreeDiskContainer) are LZF decoded once to a field-major buffer.
+	// Compact leaves (see LeafFormat) are read column by column, only compressed blocks and quantized positions are decoded to buffers.
+	// Fields are matched by name, so a leaf of PointE57 can be read straight into PointExchange. Fields missing in the file keep the default of PointT.
+	class LeafReader
+	{
+	protected:
+		enum class DataType { ASCII, BINARY, BINARY_COMPRESSED, COMPACT };
+
+		struct Field
+		{
+			std::string name;
+			std::size_t size; // bytes of all the elements of the field
+			std::size_t offset; // offset in the packed point, or offset of the block from dataOffset for compact leaves
+			std::size_t storedBytes; // bytes of the block of compact leaves
+		};
+
+		boost::filesystem::path pcdPath;
+		std::vector<Field> fields;
+		std::size_t pointStep; // bytes of a packed point
+		uint64_t numPoints;
+		DataType dataType;
+		std::size_t dataOffset; // offset of the point data in the file
+		LeafHeader compactHeader;
+		std::vector<uint32_t> scanIDs;
+		std::vector<uint64_t> scanCounts;
+
+		void LoadCompactHeader(std::ifstream& file);
+
+	public:
+		// Parse the header of a PCD or compact leaf file, throw pcl::PCLException if it is not valid
+		LeafReader(const boost::filesystem::path& pcdPath);
+
+		uint64_t NumPoints() const { return numPoints; }
+
+		// Scan-ID set of compact leaves, empty for PCD leaves
+		const std::vector<uint32_t>& ScanIDs() const { return scanIDs; }
+
+		// Points of each scan in ScanIDs, empty for PCD leaves and compact leaves of version 1
+		const std::vector<uint64_t>& ScanCounts() const { return scanCounts; }
+
+		// Points per scan ID (label) of the leaf, from the header of compact leaves or by reading the points of other leaves. Empty if the program is not compiled with POINT_E57_WITH_LABEL.
+		void CountScans(std::vector<std::pair<uint32_t, uint64_t>>& counts) const;
+
+		// Append the points inside [minBB, maxBB] to out, or all points if minBB or maxBB is nullptr. Return the number of appended points.
+		template <typename PointT>
+		uint64_t Read(pcl::PointCloud<PointT>& out, const Eigen::Vector3d* minBB = nullptr, const Eigen::Vector3d* maxBB = nullptr) const;
+	};
+}
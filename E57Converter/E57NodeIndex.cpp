@@ -0,0 +1,203 @@
+#include <bitset>
+#include <cstring>
+#include <algorithm>
+#include <fstream>
+
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <pcl/exceptions.h>
+
+#include "E57NodeIndex.h"
+
+namespace e57
+{
+	// octIndex.bin layout, all values little-endian:
+	//     OCTNodeIndex_Header, OCTNodeIndex_Record records[numNodes], the scan table, then the string table of node paths.
+	//     The scan table holds uint64_t scanBits[numScanWords] then uint64_t scanCounts[popcount of scanBits] of each node.
+	const char octNodeIndexMagic[4] = { 'E', '5', '7', 'N' };
+	const uint32_t octNodeIndexVersion = 2;
+
+#pragma pack(push, 1)
+	struct OCTNodeIndex_Header
+	{
+		char magic[4];
+		uint32_t version;
+		uint64_t numNodes;
+		uint64_t scanBytes;
+		uint64_t stringBytes;
+	};
+
+	struct OCTNodeIndex_Record
+	{
+		double minBB[3];
+		double maxBB[3];
+		uint32_t depth;
+		uint8_t leaf;
+		uint64_t numPoints;
+		uint64_t pathOffset; // offset of the node path in the string table
+		uint32_t pathBytes;
+		uint64_t scanOffset; // offset of the node scans in the scan table
+		uint32_t numScanWords;
+		uint32_t numScans;
+	};
+#pragma pack(pop)
+
+	void OCTNodeIndex::Node::SetScans(const std::vector<std::pair<uint32_t, uint64_t>>& counts)
+	{
+		scanBits.clear();
+		scanCounts.clear();
+		std::vector<std::pair<uint32_t, uint64_t>> sortedCounts = counts;
+		std::sort(sortedCounts.begin(), sortedCounts.end());
+		for (std::size_t si = 0; si < sortedCounts.size(); ++si)
+		{
+			const uint32_t scanID = sortedCounts[si].first;
+			if (scanBits.size() <= scanID / 64)
+				scanBits.resize(scanID / 64 + 1, 0);
+			scanBits[scanID / 64] |= ((uint64_t)1) << (scanID % 64);
+			scanCounts.push_back(sortedCounts[si].second);
+		}
+	}
+
+	void OCTNodeIndex::OrScanBits(const std::vector<uint64_t>& src, std::vector<uint64_t>& dst)
+	{
+		if (dst.size() < src.size())
+			dst.resize(src.size(), 0);
+		for (std::size_t wi = 0; wi < src.size(); ++wi)
+			dst[wi] |= src[wi];
+	}
+
+	std::size_t OCTNodeIndex::CountScanBits(const std::vector<uint64_t>& bits)
+	{
+		std::size_t numScans = 0;
+		for (std::size_t wi = 0; wi < bits.size(); ++wi)
+			numScans += std::bitset<64>(bits[wi]).count();
+		return numScans;
+	}
+
+	boost::filesystem::path OCTNodeIndex_FilePath(const boost::filesystem::path& octPath)
+	{
+		return octPath / boost::filesystem::path("octIndex.bin");
+	}
+
+	bool OCTNodeIndex::Load(const boost::filesystem::path& octPath)
+	{
+		nodes.clear();
+		const boost::filesystem::path filePath = OCTNodeIndex_FilePath(octPath);
+		if (!boost::filesystem::exists(filePath) || (boost::filesystem::file_size(filePath) < sizeof(OCTNodeIndex_Header)))
+			return false;
+
+		boost::interprocess::file_mapping mapping(filePath.string().c_str(), boost::interprocess::read_only);
+		boost::interprocess::mapped_region region(mapping, boost::interprocess::read_only);
+		const char* data = static_cast<const char*>(region.get_address());
+		const std::size_t dataSize = region.get_size();
+
+		OCTNodeIndex_Header header;
+		std::memcpy(&header, data, sizeof(OCTNodeIndex_Header));
+		if ((std::memcmp(header.magic, octNodeIndexMagic, sizeof(header.magic)) != 0) || (header.version != octNodeIndexVersion) ||
+			(dataSize != sizeof(OCTNodeIndex_Header) + header.numNodes * sizeof(OCTNodeIndex_Record) + header.scanBytes + header.stringBytes))
+			return false;
+
+		const char* records = data + sizeof(OCTNodeIndex_Header);
+		const char* scans = records + header.numNodes * sizeof(OCTNodeIndex_Record);
+		const char* strings = scans + header.scanBytes;
+		nodes.resize(header.numNodes);
+		for (uint64_t i = 0; i < header.numNodes; ++i)
+		{
+			OCTNodeIndex_Record record;
+			std::memcpy(&record, records + i * sizeof(OCTNodeIndex_Record), sizeof(OCTNodeIndex_Record));
+			if ((record.pathOffset + record.pathBytes > header.stringBytes) || (record.scanOffset + ((uint64_t)record.numScanWords + record.numScans) * sizeof(uint64_t) > header.scanBytes))
+			{
+				nodes.clear();
+				return false;
+			}
+
+			Node& node = nodes[i];
+			node.minBB = Eigen::Vector3d(record.minBB[0], record.minBB[1], record.minBB[2]);
+			node.maxBB = Eigen::Vector3d(record.maxBB[0], record.maxBB[1], record.maxBB[2]);
+			node.depth = record.depth;
+			node.leaf = (record.leaf != 0);
+			node.numPoints = record.numPoints;
+			node.pcdPath = octPath / boost::filesystem::path(std::string(strings + record.pathOffset, record.pathBytes));
+			node.scanBits.resize(record.numScanWords);
+			node.scanCounts.resize(record.numScans);
+			std::memcpy(node.scanBits.data(), scans + record.scanOffset, node.scanBits.size() * sizeof(uint64_t));
+			std::memcpy(node.scanCounts.data(), scans + record.scanOffset + node.scanBits.size() * sizeof(uint64_t), node.scanCounts.size() * sizeof(uint64_t));
+		}
+		return true;
+	}
+
+	void OCTNodeIndex::Dump(const boost::filesystem::path& octPath) const
+	{
+		const boost::filesystem::path filePath = OCTNodeIndex_FilePath(octPath);
+
+		std::string strings;
+		std::vector<uint64_t> scans;
+		std::vector<OCTNodeIndex_Record> records(nodes.size());
+		for (std::size_t i = 0; i < nodes.size(); ++i)
+		{
+			const Node& node = nodes[i];
+			OCTNodeIndex_Record& record = records[i];
+			for (int a = 0; a < 3; ++a)
+			{
+				record.minBB[a] = node.minBB[a];
+				record.maxBB[a] = node.maxBB[a];
+			}
+			record.depth = (uint32_t)node.depth;
+			record.leaf = node.leaf ? 1 : 0;
+			record.numPoints = node.numPoints;
+
+			std::string path = node.pcdPath.lexically_relative(octPath).generic_string();
+			if (path.empty())
+				path = node.pcdPath.generic_string();
+			record.pathOffset = strings.size();
+			record.pathBytes = (uint32_t)path.size();
+			strings += path;
+
+			record.scanOffset = scans.size() * sizeof(uint64_t);
+			record.numScanWords = (uint32_t)node.scanBits.size();
+			record.numScans = (uint32_t)node.scanCounts.size();
+			scans.insert(scans.end(), node.scanBits.begin(), node.scanBits.end());
+			scans.insert(scans.end(), node.scanCounts.begin(), node.scanCounts.end());
+		}
+
+		OCTNodeIndex_Header header;
+		std::memcpy(header.magic, octNodeIndexMagic, sizeof(header.magic));
+		header.version = octNodeIndexVersion;
+		header.numNodes = nodes.size();
+		header.scanBytes = scans.size() * sizeof(uint64_t);
+		header.stringBytes = strings.size();
+
+		// Written to a temporary file first, so a reader never maps a partial index
+		const boost::filesystem::path tmpPath = filePath.string() + ".tmp";
+		std::ofstream file(tmpPath.string(), std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+		if (!file)
+			throw pcl::PCLException("Create file " + tmpPath.string() + " failed.");
+		file.write(reinterpret_cast<const char*>(&header), sizeof(OCTNodeIndex_Header));
+		file.write(reinterpret_cast<const char*>(records.data()), records.size() * sizeof(OCTNodeIndex_Record));
+		file.write(reinterpret_cast<const char*>(scans.data()), scans.size() * sizeof(uint64_t));
+		file.write(strings.data(), strings.size());
+		if (!file)
+			throw pcl::PCLException("Write file " + tmpPath.string() + " failed.");
+		file.close();
+		boost::filesystem::rename(tmpPath, filePath);
+	}
+
+	void OCTNodeIndex::Remove(const boost::filesystem::path& octPath)
+	{
+		const boost::filesystem::path filePath = OCTNodeIndex_FilePath(octPath);
+		if (boost::filesystem::exists(filePath))
+			boost::filesystem::remove(filePath);
+	}
+
+	void OCTNodeIndex::QueryBBIntersects(const Eigen::Vector3d& minBB, const Eigen::Vector3d& maxBB, const std::size_t depth, std::vector<const Node*>& out) const
+	{
+		for (std::size_t i = 0; i < nodes.size(); ++i)
+		{
+			const Node& node = nodes[i];
+			if ((node.depth > depth) || ((node.depth < depth) && !node.leaf) || (node.numPoints == 0))
+				continue;
+			if ((node.minBB.array() <= maxBB.array()).all() && (node.maxBB.array() >= minBB.array()).all())
+				out.push_back(&node);
+		}
+	}
+}
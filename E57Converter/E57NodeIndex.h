@@ -0,0 +1,60 @@
+#pragma once
+
+#include <vector>
+#include <string>
+
+#include <boost/filesystem.hpp>
+#include <Eigen/Core>
+
+namespace e57
+{
+	// Consolidated index of OCT nodes, kept in octIndex.bin next to octRoot.oct_idx.
+	// Loading the OCT through pcl::outofcore reads the .oct_idx JSON of every node, the index holds the same node metadata in one file which is loaded with a single mapping.
+	// The index is written after the OCT is built or its LOD is updated, and removed before the OCT is changed, so a missing index means it has to be rebuilt from the OCT.
+	// Each leaf also records its contributing scans as a bitmap of scan IDs (point labels) with the points of each scan, so queries can select or group scans without reading points. Branch nodes have no scans.
+	class OCTNodeIndex
+	{
+	public:
+		struct Node
+		{
+			Eigen::Vector3d minBB;
+			Eigen::Vector3d maxBB;
+			std::size_t depth;
+			bool leaf;
+			uint64_t numPoints;
+			boost::filesystem::path pcdPath;
+			std::vector<uint64_t> scanBits; // bit i of word i / 64 is set if scan i has points in the leaf, empty for branch nodes
+			std::vector<uint64_t> scanCounts; // points of each set bit of scanBits, in ascending scan ID order
+
+			// Set scanBits and scanCounts from points per scan ID
+			void SetScans(const std::vector<std::pair<uint32_t, uint64_t>>& counts);
+
+			bool HasScan(const uint32_t scanID) const { return (scanID / 64 < scanBits.size()) && ((scanBits[scanID / 64] >> (scanID % 64)) & 1); }
+		};
+
+		// Union of scan bitmaps, dst grows to the size of src
+		static void OrScanBits(const std::vector<uint64_t>& src, std::vector<uint64_t>& dst);
+
+		// Number of scans set in a scan bitmap
+		static std::size_t CountScanBits(const std::vector<uint64_t>& bits);
+
+	protected:
+		std::vector<Node> nodes;
+
+	public:
+		const std::vector<Node>& Nodes() const { return nodes; }
+		std::vector<Node>& Nodes() { return nodes; }
+
+		// Load octIndex.bin of octPath, return false if it does not exist or is not valid
+		bool Load(const boost::filesystem::path& octPath);
+
+		// Write octIndex.bin of octPath, node paths are stored relative to octPath
+		void Dump(const boost::filesystem::path& octPath) const;
+
+		// Remove octIndex.bin of octPath, called before the OCT is changed
+		static void Remove(const boost::filesystem::path& octPath);
+
+		// Nodes with points intersecting [minBB, maxBB], at depth or leaves above it. The same nodes as OCT::queryBBIntersects.
+		void QueryBBIntersects(const Eigen::Vector3d& minBB, const Eigen::Vector3d& maxBB, const std::size_t depth, std::vector<const Node*>& out) const;
+	};
+}
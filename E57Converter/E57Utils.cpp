@@ -1,6 +1,11 @@
 #include <iostream>
 #include <iomanip>
+#include <sstream>
 #include <cmath>
+#include <limits>
+#include <algorithm>
+
+#include <Eigen/Dense>
 
 #include "E57Utils.h"
 
@@ -222,11 +227,89 @@ namespace e57
 		return scanInfo;
 	}
 
-	void Scan::Load(const e57::ImageFile& imf, const e57::VectorNode& data3D, int64_t scanID)
+	bool IngestFilter::AcceptScan(const int64_t scanID) const
+	{
+		if (scanRanges.empty())
+			return true;
+		for (const auto& scanRange : scanRanges)
+		{
+			if ((scanID >= scanRange.first) && (scanID <= scanRange.second))
+				return true;
+		}
+		return false;
+	}
+
+	bool IngestFilter::InPolygon(const double x, const double y) const
+	{
+		bool inside = false;
+		for (std::size_t i = 0, j = polygon.size() - 1; i < polygon.size(); j = i++)
+		{
+			const Eigen::Vector2d& a = polygon[i];
+			const Eigen::Vector2d& b = polygon[j];
+			if (((a.y() > y) != (b.y() > y)) && (x < (b.x() - a.x()) * (y - a.y()) / (b.y() - a.y()) + a.x()))
+				inside = !inside;
+		}
+		return inside;
+	}
+
+	// Parse a whole non-negative scan ID, trailing characters other than spaces are rejected
+	int64_t IngestFilter_ParseScanID(const std::string& str)
+	{
+		std::size_t end = 0;
+		int64_t scanID = std::stoll(str, &end);
+		if ((scanID < 0) || (str.find_first_not_of(" \t", end) != std::string::npos))
+			throw std::invalid_argument(str);
+		return scanID;
+	}
+
+	std::vector<std::pair<int64_t, int64_t>> IngestFilter::ParseScanRanges(const std::string& str)
+	{
+		std::vector<std::pair<int64_t, int64_t>> scanRanges;
+		std::stringstream ss(str);
+		std::string item;
+		while (std::getline(ss, item, ','))
+		{
+			if (item.find_first_not_of(" \t") == std::string::npos)
+				continue;
+			std::size_t dash = item.find('-', item.find_first_not_of(" \t") + 1);
+			std::pair<int64_t, int64_t> scanRange;
+			try
+			{
+				if (dash == std::string::npos)
+					scanRange = std::pair<int64_t, int64_t>(IngestFilter_ParseScanID(item), IngestFilter_ParseScanID(item));
+				else
+					scanRange = std::pair<int64_t, int64_t>(IngestFilter_ParseScanID(item.substr(0, dash)), IngestFilter_ParseScanID(item.substr(dash + 1)));
+			}
+			catch (std::exception&)
+			{
+				throw std::runtime_error("Invalid scan list item \"" + item + "\".");
+			}
+			if (scanRange.first > scanRange.second)
+				throw std::runtime_error("Scan range \"" + item + "\" is reversed.");
+			scanRanges.push_back(scanRange);
+		}
+		return scanRanges;
+	}
+
+	// Value of a numeric node, bounds are float nodes in most files but may be scaled integers
+	double NumberNodeValue(const e57::Node& node)
+	{
+		switch (node.type())
+		{
+		case e57::NodeType::E57_FLOAT: return e57::FloatNode(node).value();
+		case e57::NodeType::E57_SCALED_INTEGER: return e57::ScaledIntegerNode(node).scaledValue();
+		case e57::NodeType::E57_INTEGER: return (double)e57::IntegerNode(node).value();
+		default: throw std::runtime_error("Node " + node.elementName() + " is not a number.");
+		}
+	}
+
+	std::shared_ptr<e57::CompressedVectorNode> Scan::LoadHeader(const e57::VectorNode& data3D, int64_t scanID)
 	{
 		ID = scanID;
+		numValidPoints = 0;
+		numBufferPoints = 0;
+		bufferStart = 0;
 		e57::StructureNode scan(data3D.get(scanID));
-		std::vector<e57::SourceDestBuffer> sdBuffers;
 
 		// Parse pose
 		if (scan.isDefined("pose"))
@@ -268,169 +351,529 @@ namespace e57
 		else
 			PCL_WARN("[e57::%s::Load] Scan didnot define pose.\n", "Scan");
 
-		// Parse scale & offset
+		// Parse prototype
 		if (scan.isDefined("points"))
 		{
 			e57::Node scanPointsNode = scan.get("points");
 
 			if (scanPointsNode.type() == e57::NodeType::E57_COMPRESSED_VECTOR)
 			{
-				e57::CompressedVectorNode scanPoints(scanPointsNode);
-				e57::StructureNode proto(scanPoints.prototype());
-				std::shared_ptr<e57::Node> protoXNode;
-				std::shared_ptr<e57::Node> protoYNode;
-				std::shared_ptr<e57::Node> protoZNode;
-				std::shared_ptr<e57::Node> protoRNode;
-				std::shared_ptr<e57::Node> protoGNode;
-				std::shared_ptr<e57::Node> protoBNode;
-				std::shared_ptr<e57::Node> protoINode;
-				numPoints = scanPoints.childCount();
+				std::shared_ptr<e57::CompressedVectorNode> scanPoints(new e57::CompressedVectorNode(scanPointsNode));
+				e57::StructureNode proto(scanPoints->prototype());
+				numPoints = scanPoints->childCount();
 
 				if (proto.isDefined("cartesianX") && proto.isDefined("cartesianY") && proto.isDefined("cartesianZ"))
 				{
 					coodSys = CoodSys::XYZ;
 					hasPointXYZ = true;
-					protoXNode = std::shared_ptr<e57::Node>(new e57::Node(proto.get("cartesianX")));
-					protoYNode = std::shared_ptr<e57::Node>(new e57::Node(proto.get("cartesianY")));
-					protoZNode = std::shared_ptr<e57::Node>(new e57::Node(proto.get("cartesianZ")));
-					x = std::shared_ptr<float>(new float[numPoints]);
-					y = std::shared_ptr<float>(new float[numPoints]);
-					z = std::shared_ptr<float>(new float[numPoints]);
-					sdBuffers.push_back(e57::SourceDestBuffer(imf, "cartesianX", x.get(), numPoints, true, true));
-					sdBuffers.push_back(e57::SourceDestBuffer(imf, "cartesianY", y.get(), numPoints, true, true));
-					sdBuffers.push_back(e57::SourceDestBuffer(imf, "cartesianZ", z.get(), numPoints, true, true));
 				}
 				else if (proto.isDefined("sphericalRange") && proto.isDefined("sphericalAzimuth") && proto.isDefined("sphericalElevation"))
 				{
 					coodSys = CoodSys::RAE;
 					raeMode = RAEMode::E_X_Y; // E57 use this
 					hasPointXYZ = true;
-					protoXNode = std::shared_ptr<e57::Node>(new e57::Node(proto.get("sphericalRange")));
-					protoYNode = std::shared_ptr<e57::Node>(new e57::Node(proto.get("sphericalAzimuth")));
-					protoZNode = std::shared_ptr<e57::Node>(new e57::Node(proto.get("sphericalElevation")));
-					x = std::shared_ptr<float>(new float[numPoints]);
-					y = std::shared_ptr<float>(new float[numPoints]);
-					z = std::shared_ptr<float>(new float[numPoints]);
-					sdBuffers.push_back(e57::SourceDestBuffer(imf, "sphericalRange", x.get(), numPoints, true, true));
-					sdBuffers.push_back(e57::SourceDestBuffer(imf, "sphericalAzimuth", y.get(), numPoints, true, true));
-					sdBuffers.push_back(e57::SourceDestBuffer(imf, "sphericalElevation", z.get(), numPoints, true, true));
 				}
 
 				if (proto.isDefined("colorRed") && proto.isDefined("colorGreen") && proto.isDefined("colorBlue") && E57_CAN_CONTAIN_RGB)
-				{
 					hasPointRGB = true;
-					protoRNode = std::shared_ptr<e57::Node>(new e57::Node(proto.get("colorRed")));
-					protoGNode = std::shared_ptr<e57::Node>(new e57::Node(proto.get("colorGreen")));
-					protoBNode = std::shared_ptr<e57::Node>(new e57::Node(proto.get("colorBlue")));
-					r = std::shared_ptr<uint8_t>(new uint8_t[numPoints]);
-					g = std::shared_ptr<uint8_t>(new uint8_t[numPoints]);
-					b = std::shared_ptr<uint8_t>(new uint8_t[numPoints]);
-					sdBuffers.push_back(e57::SourceDestBuffer(imf, "colorRed", r.get(), numPoints, true, true));
-					sdBuffers.push_back(e57::SourceDestBuffer(imf, "colorGreen", g.get(), numPoints, true, true));
-					sdBuffers.push_back(e57::SourceDestBuffer(imf, "colorBlue", b.get(), numPoints, true, true));
-				}
 
 				if (proto.isDefined("intensity") && E57_CAN_CONTAIN_INTENSITY)
-				{
 					hasPointI = true;
-					protoINode = std::shared_ptr<e57::Node>(new e57::Node(proto.get("intensity")));
-					i = std::shared_ptr<float>(new float[numPoints]);
-					sdBuffers.push_back(e57::SourceDestBuffer(imf, "intensity", i.get(), numPoints, true, true));
-				}
 
-				//
-				if ((hasPointXYZ || hasPointRGB || hasPointI))
-				{
-					e57::CompressedVectorReader reader = scanPoints.reader(sdBuffers);
-					if (reader.read() <= 0)
-					{
-						PCL_WARN("[e57::%s::Load] Failed to read E57 points, ignore the scan.\n", "Scan");
-						hasPointXYZ = false;
-						hasPointRGB = false;
-						hasPointI = false;
-					}
-					reader.close();
-				}
+				if (proto.isDefined("rowIndex") && proto.isDefined("columnIndex") && hasPointXYZ && E57_CAN_CONTAIN_NORMAL)
+					hasPointGrid = true;
+
+				if ((hasPointXYZ || hasPointRGB || hasPointI) && (numPoints > 0))
+					return scanPoints;
 			}
 			else
 				PCL_WARN("[e57::%s::Load] Not supported scan points type.\n", "Scan");
 		}
 		else
 			PCL_WARN("[e57::%s::Load] Scan didnot define points.\n", "Scan");
+
+		return std::shared_ptr<e57::CompressedVectorNode>();
+	}
+
+	bool Scan::LoadBounds(const e57::VectorNode& data3D, int64_t scanID, const double maxRange, Eigen::Vector3d& min, Eigen::Vector3d& max)
+	{
+		if (!LoadHeader(data3D, scanID))
+			return false;
+		e57::StructureNode scan(data3D.get(scanID));
+
+		// Local AABB of the scan
+		Eigen::Vector3d localMin, localMax;
+		if (scan.isDefined("cartesianBounds"))
+		{
+			e57::StructureNode bounds(scan.get("cartesianBounds"));
+			localMin = Eigen::Vector3d(NumberNodeValue(bounds.get("xMinimum")), NumberNodeValue(bounds.get("yMinimum")), NumberNodeValue(bounds.get("zMinimum")));
+			localMax = Eigen::Vector3d(NumberNodeValue(bounds.get("xMaximum")), NumberNodeValue(bounds.get("yMaximum")), NumberNodeValue(bounds.get("zMaximum")));
+		}
+		else if (scan.isDefined("sphericalBounds") && e57::StructureNode(scan.get("sphericalBounds")).isDefined("rangeMaximum"))
+		{
+			double rangeMaximum = NumberNodeValue(e57::StructureNode(scan.get("sphericalBounds")).get("rangeMaximum"));
+			localMin = Eigen::Vector3d::Constant(-rangeMaximum);
+			localMax = Eigen::Vector3d::Constant(rangeMaximum);
+		}
+		else
+			return false;
+
+		if (maxRange > 0.0)
+		{
+			localMin = localMin.cwiseMax(Eigen::Vector3d::Constant(-maxRange));
+			localMax = localMax.cwiseMin(Eigen::Vector3d::Constant(maxRange));
+		}
+		if ((localMin.array() > localMax.array()).any() || !localMin.allFinite() || !localMax.allFinite())
+			return false;
+
+		// World AABB of the transformed corners
+		min = Eigen::Vector3d::Constant(std::numeric_limits<double>::max());
+		max = Eigen::Vector3d::Constant(std::numeric_limits<double>::lowest());
+		for (int c = 0; c < 8; ++c)
+		{
+			Eigen::Vector3d corner((c & 1) ? localMax.x() : localMin.x(), (c & 2) ? localMax.y() : localMin.y(), (c & 4) ? localMax.z() : localMin.z());
+			Eigen::Vector3d world = transform.block<3, 3>(0, 0) * corner + transform.block<3, 1>(0, 3);
+			min = min.cwiseMin(world);
+			max = max.cwiseMax(world);
+		}
+		return true;
+	}
+
+	void Scan::AllocateBuffers(const std::size_t size)
+	{
+		if (hasPointXYZ)
+		{
+			x = std::shared_ptr<float>(new float[size], std::default_delete<float[]>());
+			y = std::shared_ptr<float>(new float[size], std::default_delete<float[]>());
+			z = std::shared_ptr<float>(new float[size], std::default_delete<float[]>());
+		}
+
+		if (hasPointRGB)
+		{
+			r = std::shared_ptr<uint8_t>(new uint8_t[size], std::default_delete<uint8_t[]>());
+			g = std::shared_ptr<uint8_t>(new uint8_t[size], std::default_delete<uint8_t[]>());
+			b = std::shared_ptr<uint8_t>(new uint8_t[size], std::default_delete<uint8_t[]>());
+		}
+
+		if (hasPointI)
+			i = std::shared_ptr<float>(new float[size], std::default_delete<float[]>());
+
+		if (hasPointGrid)
+		{
+			row = std::shared_ptr<int32_t>(new int32_t[size], std::default_delete<int32_t[]>());
+			column = std::shared_ptr<int32_t>(new int32_t[size], std::default_delete<int32_t[]>());
+		}
 	}
 
-	void Scan::ExtractValidPointCloud(pcl::PointCloud<PointE57>& scanCloud, const uint8_t minRGB)
+	bool Scan::BuffersShared() const
 	{
-		if ((hasPointXYZ || hasPointRGB || hasPointI))
-		{
-			scanCloud.reserve(numPoints);
-			float* _x = x.get();
-			float* _y = y.get();
-			float* _z = z.get();
-			float* _i = i.get();
-			uint8_t * _r = r.get();
-			uint8_t * _g = g.get();
-			uint8_t * _b = b.get();
-
-			for (int64_t pi = 0; pi < numPoints; ++pi)
+		return (x.use_count() > 1) || (y.use_count() > 1) || (z.use_count() > 1) || (i.use_count() > 1) ||
+			(r.use_count() > 1) || (g.use_count() > 1) || (b.use_count() > 1) || (row.use_count() > 1) || (column.use_count() > 1);
+	}
+
+	std::vector<e57::SourceDestBuffer> Scan::CreateBuffers(const e57::ImageFile& imf, const std::size_t size)
+	{
+		std::vector<e57::SourceDestBuffer> sdBuffers;
+		if (hasPointXYZ)
+		{
+			switch (coodSys)
 			{
-				PointE57 sp;
+			case CoodSys::XYZ:
+				sdBuffers.push_back(e57::SourceDestBuffer(imf, "cartesianX", x.get(), size, true, true));
+				sdBuffers.push_back(e57::SourceDestBuffer(imf, "cartesianY", y.get(), size, true, true));
+				sdBuffers.push_back(e57::SourceDestBuffer(imf, "cartesianZ", z.get(), size, true, true));
+				break;
+
+			case CoodSys::RAE:
+				sdBuffers.push_back(e57::SourceDestBuffer(imf, "sphericalRange", x.get(), size, true, true));
+				sdBuffers.push_back(e57::SourceDestBuffer(imf, "sphericalAzimuth", y.get(), size, true, true));
+				sdBuffers.push_back(e57::SourceDestBuffer(imf, "sphericalElevation", z.get(), size, true, true));
+				break;
+
+			default:
+				throw std::runtime_error("Coordinate system invalid!!?");
+				break;
+			}
+		}
+
+		if (hasPointRGB)
+		{
+			sdBuffers.push_back(e57::SourceDestBuffer(imf, "colorRed", r.get(), size, true, true));
+			sdBuffers.push_back(e57::SourceDestBuffer(imf, "colorGreen", g.get(), size, true, true));
+			sdBuffers.push_back(e57::SourceDestBuffer(imf, "colorBlue", b.get(), size, true, true));
+		}
+
+		if (hasPointI)
+			sdBuffers.push_back(e57::SourceDestBuffer(imf, "intensity", i.get(), size, true, true));
+
+		if (hasPointGrid)
+		{
+			sdBuffers.push_back(e57::SourceDestBuffer(imf, "rowIndex", row.get(), size, true));
+			sdBuffers.push_back(e57::SourceDestBuffer(imf, "columnIndex", column.get(), size, true));
+		}
+
+		return sdBuffers;
+	}
+
+	void Scan::Load(const e57::ImageFile& imf, const e57::VectorNode& data3D, int64_t scanID)
+	{
+		std::shared_ptr<e57::CompressedVectorNode> scanPoints = LoadHeader(data3D, scanID);
+		if (!scanPoints)
+			return;
+
+		//
+		AllocateBuffers(numPoints);
+		std::vector<e57::SourceDestBuffer> sdBuffers = CreateBuffers(imf, numPoints);
+		e57::CompressedVectorReader reader = scanPoints->reader(sdBuffers);
+		numBufferPoints = reader.read();
+		if (numBufferPoints <= 0)
+		{
+			PCL_WARN("[e57::%s::Load] Failed to read E57 points, ignore the scan.\n", "Scan");
+			hasPointXYZ = false;
+			hasPointRGB = false;
+			hasPointI = false;
+			hasPointGrid = false;
+		}
+		reader.close();
+	}
+
+	void Scan::LoadBlocks(const e57::ImageFile& imf, const e57::VectorNode& data3D, int64_t scanID, const std::size_t blockSize, const std::function<void(Scan&)>& blockFunc)
+	{
+		std::shared_ptr<e57::CompressedVectorNode> scanPoints = LoadHeader(data3D, scanID);
+		if (!scanPoints)
+			return;
+
+		//
+		std::size_t bufferSize = ((blockSize > 0) && (blockSize < numPoints)) ? blockSize : numPoints;
+		AllocateBuffers(bufferSize);
+		std::vector<e57::SourceDestBuffer> sdBuffers = CreateBuffers(imf, bufferSize);
+		e57::CompressedVectorReader reader = scanPoints->reader(sdBuffers);
+
+		std::size_t numReadPoints = 0;
+		while (true)
+		{
+			unsigned int numBlockPoints;
+			if (BuffersShared())
+			{
+				// Previous block is still in use, do not overwrite it
+				AllocateBuffers(bufferSize);
+				sdBuffers = CreateBuffers(imf, bufferSize);
+				numBlockPoints = reader.read(sdBuffers);
+			}
+			else
+				numBlockPoints = reader.read();
+
+			if (numBlockPoints == 0)
+				break;
+
+			numBufferPoints = numBlockPoints;
+			bufferStart = numReadPoints;
+			numReadPoints += numBlockPoints;
+			blockFunc(*this);
+		}
+		reader.close();
+		numBufferPoints = 0;
+
+		if (numReadPoints == 0)
+		{
+			PCL_WARN("[e57::%s::LoadBlocks] Failed to read E57 points, ignore the scan.\n", "Scan");
+			hasPointXYZ = false;
+			hasPointRGB = false;
+			hasPointI = false;
+			hasPointGrid = false;
+		}
+	}
+
+	void Scan::ExtractValidPointCloud(pcl::PointCloud<PointE57>& scanCloud, const uint8_t minRGB, const unsigned int numThreads, const IngestFilter& filter)
+	{
+		if (!(hasPointXYZ || hasPointRGB || hasPointI) || (numBufferPoints == 0))
+			return;
+		if (hasPointXYZ && (coodSys != CoodSys::XYZ) && (coodSys != CoodSys::RAE))
+			throw std::runtime_error("Coordinate system invalid!!?");
+
+		const std::size_t start = scanCloud.size();
+		const std::size_t numPoints = numBufferPoints;
+		const float* _x = x.get();
+		const float* _y = y.get();
+		const float* _z = z.get();
+		const float* _i = i.get();
+		const uint8_t * _r = r.get();
+		const uint8_t * _g = g.get();
+		const uint8_t * _b = b.get();
+
+		// Convert spherical coordinates of the whole buffer at once
+		std::vector<float> rae_x;
+		std::vector<float> rae_y;
+		std::vector<float> rae_z;
+		if (hasPointXYZ && (coodSys == CoodSys::RAE))
+		{
+			rae_x.resize(numPoints);
+			rae_y.resize(numPoints);
+			rae_z.resize(numPoints);
+			RAEToXYZ(RAEBasis(raeMode), _x, _y, _z, rae_x.data(), rae_y.data(), rae_z.data(), numPoints);
+			_x = rae_x.data();
+			_y = rae_y.data();
+			_z = rae_z.data();
+		}
+
+		// Grid normals in scanner coordinates
+		std::vector<Eigen::Vector4f> gridNormals;
+		if (hasPointGrid)
+			EstimateGridNormals(_x, _y, _z, gridNormals, numThreads);
+
+		// Filter the chunks in parallel and keep the indices of their valid points
+		const Eigen::Matrix3d rotation = transform.block<3, 3>(0, 0);
+		const Eigen::Vector3d translation = transform.block<3, 1>(0, 3);
+		const std::size_t stride = std::max(filter.stride, (std::size_t)1);
+		const float maxRangeSqr = (filter.maxRange > 0.0) ? (float)(filter.maxRange * filter.maxRange) : std::numeric_limits<float>::max();
+		const bool hasPolygon = filter.polygon.size() >= 3;
+		const std::size_t numChunks = (numPoints >= 65536) ? std::max(numThreads, 1u) : 1;
+		const std::size_t chunkSize = (numPoints + numChunks - 1) / numChunks;
+		std::vector<std::vector<std::size_t>> chunkValidIndices(numChunks);
+
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(numChunks)
+#endif
+		for (int64_t c = 0; c < (int64_t)numChunks; ++c)
+		{
+			const std::size_t chunkStart = c * chunkSize;
+			const std::size_t chunkEnd = std::min(chunkStart + chunkSize, numPoints);
+			std::vector<std::size_t>& validIndices = chunkValidIndices[c];
+			validIndices.reserve((chunkEnd - chunkStart + stride - 1) / stride);
+
+			for (std::size_t pi = chunkStart; pi < chunkEnd; ++pi)
+			{
+				if ((bufferStart + pi) % stride != 0)
+					continue;
+
+				float px = 0.0f, py = 0.0f, pz = 0.0f;
 				if (hasPointXYZ)
 				{
-					switch (coodSys)
-					{
-					case CoodSys::XYZ:
-						sp.x = _x[pi];
-						sp.y = _y[pi];
-						sp.z = _z[pi];
-						break;
-
-					case CoodSys::RAE:
-					{
-						Eigen::Vector3d xyz = RAEToXYZ(raeMode, Eigen::Vector3d(_x[pi], _y[pi], _z[pi]));
-
-						sp.x = xyz.x();
-						sp.y = xyz.y();
-						sp.z = xyz.z();
-					}
-					break;
-
-					default:
-						throw std::runtime_error("Coordinate system invalid!!?");
-						break;
-					}
+					px = _x[pi];
+					py = _y[pi];
+					pz = _z[pi];
 				}
+				float pIntensity = hasPointI ? _i[pi] : 0.0f;
+				if (!(std::isfinite(px) && std::isfinite(py) && std::isfinite(pz) && std::isfinite(pIntensity)))
+					continue;
 
 #ifdef POINT_E57_WITH_RGB
-				if (hasPointRGB)
+				if (hasPointRGB && !(_r[pi] >= minRGB || _g[pi] >= minRGB || _b[pi] >= minRGB))
+					continue;
+#endif
+
+				if (px * px + py * py + pz * pz > maxRangeSqr)
+					continue;
+
+				Eigen::Vector3d xyz = rotation * Eigen::Vector3d(px, py, pz) + translation;
+				if ((xyz.array() < filter.cropMin.array()).any() || (xyz.array() > filter.cropMax.array()).any())
+					continue;
+				if (hasPolygon && !filter.InPolygon(xyz.x(), xyz.y()))
+					continue;
+
+				validIndices.push_back(pi);
+			}
+		}
+
+		// Exclusive prefix sum of the chunk counts gives each chunk's output offset, so the cloud is sized once and each chunk writes its points straight into their final slots
+		std::vector<std::size_t> chunkOffsets(numChunks, 0);
+		std::size_t numScanValidPoints = 0;
+		for (std::size_t c = 0; c < numChunks; ++c)
+		{
+			chunkOffsets[c] = numScanValidPoints;
+			numScanValidPoints += chunkValidIndices[c].size();
+		}
+		scanCloud.resize(start + numScanValidPoints);
+
+#ifdef POINT_E57_WITH_NORMAL
+		const Eigen::Matrix3f rotation_float = rotation.cast<float>();
+#endif
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(numChunks)
+#endif
+		for (int64_t c = 0; c < (int64_t)numChunks; ++c)
+		{
+			const std::vector<std::size_t>& validIndices = chunkValidIndices[c];
+			PointE57* out = scanCloud.points.data() + start + chunkOffsets[c];
+
+			for (std::size_t k = 0; k < validIndices.size(); ++k)
+			{
+				const std::size_t pi = validIndices[k];
+				Eigen::Vector3d xyz = translation;
+				if (hasPointXYZ)
+					xyz += rotation * Eigen::Vector3d(_x[pi], _y[pi], _z[pi]);
+
+				PointE57& sp = out[k];
+				sp.x = xyz.x();
+				sp.y = xyz.y();
+				sp.z = xyz.z();
+				sp.data[3] = 1.0f;
+#ifdef POINT_E57_WITH_NORMAL
+				if (!gridNormals.empty())
 				{
-					sp.r = _r[pi];
-					sp.g = _g[pi];
-					sp.b = _b[pi];
+					Eigen::Vector3f normal = rotation_float * gridNormals[pi].head<3>();
+					sp.normal_x = normal.x();
+					sp.normal_y = normal.y();
+					sp.normal_z = normal.z();
+					sp.curvature = gridNormals[pi].w();
 				}
 				else
-				{
-					sp.r = 255;
-					sp.g = 255;
-					sp.b = 255;
-				}
+					sp.normal_x = sp.normal_y = sp.normal_z = sp.curvature = 0.f;
+#endif
+#ifdef POINT_E57_WITH_HDR
+				sp.hdr_r = sp.hdr_g = sp.hdr_b = sp.hdr_a = 0.f;
+#endif
+#ifdef POINT_E57_WITH_RGB
+				sp.r = hasPointRGB ? _r[pi] : 255;
+				sp.g = hasPointRGB ? _g[pi] : 255;
+				sp.b = hasPointRGB ? _b[pi] : 255;
+				sp.a = 1;
 #endif
-
 #ifdef POINT_E57_WITH_INTENSITY
-				if (hasPointI)
-				{
-					sp.intensity = _i[pi];
-				}
+				sp.intensity = hasPointI ? _i[pi] : 0.0f;
 #endif
-
 #ifdef POINT_E57_WITH_LABEL
 				sp.label = (uint32_t)ID;
 #endif
-				if (sp.Valid() && (sp.r >= minRGB || sp.g >= minRGB || sp.b >= minRGB))
-					scanCloud.push_back(sp);
 			}
-			pcl::transformPointCloud(scanCloud, scanCloud, transform);
-			numValidPoints = scanCloud.size();
+		}
+		numValidPoints += numScanValidPoints;
+	}
+
+	void Scan::ExtendValidBounds(const IngestFilter& filter, Eigen::Vector3d& min, Eigen::Vector3d& max, std::size_t& numTested, std::size_t& numAccepted) const
+	{
+		if (!hasPointXYZ || (numBufferPoints == 0))
+			return;
+		if ((coodSys != CoodSys::XYZ) && (coodSys != CoodSys::RAE))
+			throw std::runtime_error("Coordinate system invalid!!?");
+
+		const Eigen::Matrix3d rotation = transform.block<3, 3>(0, 0);
+		const Eigen::Vector3d translation = transform.block<3, 1>(0, 3);
+		const std::size_t stride = std::max(filter.stride, (std::size_t)1);
+		const float maxRangeSqr = (filter.maxRange > 0.0) ? (float)(filter.maxRange * filter.maxRange) : std::numeric_limits<float>::max();
+		const bool hasPolygon = filter.polygon.size() >= 3;
+		const RAEBasis basis(raeMode);
+
+		// Only the points kept by the stride are visited
+		for (std::size_t pi = (stride - bufferStart % stride) % stride; pi < numBufferPoints; pi += stride)
+		{
+			float px = x.get()[pi];
+			float py = y.get()[pi];
+			float pz = z.get()[pi];
+			if (coodSys == CoodSys::RAE)
+			{
+				float rx, ry, rz;
+				RAEToXYZ(basis, &px, &py, &pz, &rx, &ry, &rz, 1);
+				px = rx;
+				py = ry;
+				pz = rz;
+			}
+			if (!(std::isfinite(px) && std::isfinite(py) && std::isfinite(pz)))
+				continue;
+			numTested++;
+
+			if (px * px + py * py + pz * pz > maxRangeSqr)
+				continue;
+			Eigen::Vector3d xyz = rotation * Eigen::Vector3d(px, py, pz) + translation;
+			if ((xyz.array() < filter.cropMin.array()).any() || (xyz.array() > filter.cropMax.array()).any())
+				continue;
+			if (hasPolygon && !filter.InPolygon(xyz.x(), xyz.y()))
+				continue;
+
+			min = min.cwiseMin(xyz);
+			max = max.cwiseMax(xyz);
+			numAccepted++;
+		}
+	}
+
+	void Scan::EstimateGridNormals(const float* _x, const float* _y, const float* _z, std::vector<Eigen::Vector4f>& normals, const unsigned int numThreads) const
+	{
+		const std::size_t numPoints = numBufferPoints;
+		normals.assign(numPoints, Eigen::Vector4f::Zero());
+		if (!hasPointGrid || (numPoints == 0))
+			return;
+		const int32_t* _row = row.get();
+		const int32_t* _column = column.get();
+
+		// Fit the range image to the grid indices of the valid points
+		int64_t minRow = std::numeric_limits<int64_t>::max(), maxRow = std::numeric_limits<int64_t>::lowest();
+		int64_t minColumn = std::numeric_limits<int64_t>::max(), maxColumn = std::numeric_limits<int64_t>::lowest();
+		for (std::size_t pi = 0; pi < numPoints; ++pi)
+		{
+			if (!(std::isfinite(_x[pi]) && std::isfinite(_y[pi]) && std::isfinite(_z[pi])))
+				continue;
+			minRow = std::min(minRow, (int64_t)_row[pi]);
+			maxRow = std::max(maxRow, (int64_t)_row[pi]);
+			minColumn = std::min(minColumn, (int64_t)_column[pi]);
+			maxColumn = std::max(maxColumn, (int64_t)_column[pi]);
+		}
+		if (minRow > maxRow)
+			return;
+		const int64_t numRows = maxRow - minRow + 1;
+		const int64_t numColumns = maxColumn - minColumn + 1;
+		if ((double)numRows * (double)numColumns > 4.0 * numPoints + 1024.0)
+		{
+			PCL_WARN("[e57::%s::EstimateGridNormals] Scan grid is too sparse, ignore grid normals.\n", "Scan");
+			return;
+		}
+
+		std::vector<int64_t> image(numRows * numColumns, -1);
+		for (std::size_t pi = 0; pi < numPoints; ++pi)
+		{
+			if (std::isfinite(_x[pi]) && std::isfinite(_y[pi]) && std::isfinite(_z[pi]))
+				image[(_row[pi] - minRow) * numColumns + (_column[pi] - minColumn)] = (int64_t)pi;
+		}
+
+		// PCA of the window around each pixel, skipping neighbours whose range differs by more than gridNormalMaxRangeJump of the centre range
+		const int64_t gridNormalWindow = 2;
+		const float gridNormalMaxRangeJump = 0.05f;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic, 4096) num_threads(std::max(numThreads, 1u))
+#endif
+		for (int64_t pi = 0; pi < (int64_t)numPoints; ++pi)
+		{
+			Eigen::Vector3f p(_x[pi], _y[pi], _z[pi]);
+			if (!p.allFinite())
+				continue;
+			const float range = p.norm();
+			const int64_t pr = _row[pi] - minRow;
+			const int64_t pc = _column[pi] - minColumn;
+
+			Eigen::Vector3d sum(0.0, 0.0, 0.0);
+			Eigen::Matrix3d sumSqr = Eigen::Matrix3d::Zero();
+			int numNeighbors = 0;
+			for (int64_t r = std::max(pr - gridNormalWindow, (int64_t)0); r <= std::min(pr + gridNormalWindow, numRows - 1); ++r)
+			{
+				for (int64_t c = std::max(pc - gridNormalWindow, (int64_t)0); c <= std::min(pc + gridNormalWindow, numColumns - 1); ++c)
+				{
+					int64_t qi = image[r * numColumns + c];
+					if (qi < 0)
+						continue;
+					Eigen::Vector3f q(_x[qi], _y[qi], _z[qi]);
+					if (std::abs(q.norm() - range) > gridNormalMaxRangeJump * range)
+						continue;
+					Eigen::Vector3d d = (q - p).cast<double>();
+					sum += d;
+					sumSqr += d * d.transpose();
+					numNeighbors++;
+				}
+			}
+			if (numNeighbors < 3)
+				continue;
+
+			Eigen::Vector3d mean = sum / numNeighbors;
+			Eigen::Matrix3d covariance = sumSqr / numNeighbors - mean * mean.transpose();
+			Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> solver;
+			solver.computeDirect(covariance);
+			const Eigen::Vector3d& eigenValues = solver.eigenvalues();
+			const double eigenSum = eigenValues.sum();
+			if (!(eigenValues(1) > 1e-6 * eigenValues(2)) || !(eigenSum > 0.0)) // collinear or degenerate neighbourhood
+				continue;
+
+			Eigen::Vector3f normal = solver.eigenvectors().col(0).cast<float>();
+			if (normal.dot(p) > 0.0f)
+				normal = -normal;
+			normals[pi] = Eigen::Vector4f(normal.x(), normal.y(), normal.z(), (float)(eigenValues(0) / eigenSum));
 		}
 	}
-}
\ No newline at end of file
+}
@@ -2,6 +2,8 @@
 
 
 #include <memory>
+#include <limits>
+#include <functional>
 #include <pcl/point_cloud.h>
 
 #include "E57Format.h"
@@ -66,6 +68,30 @@ namespace e57
 		static ScanInfo LoadFromJson(const nlohmann::json& j);
 	};
 
+	// Ingest filters, applied to each point by Scan::ExtractValidPointCloud before it is written to the OCT
+	class IngestFilter
+	{
+	public:
+		std::vector<std::pair<int64_t, int64_t>> scanRanges; // inclusive scan ID ranges to load, empty means all scans
+		Eigen::Vector3d cropMin; // world space crop box, points outside are rejected
+		Eigen::Vector3d cropMax;
+		std::vector<Eigen::Vector2d> polygon; // world space XY polygon, points outside are rejected, empty means no polygon
+		double maxRange; // max distance from the scanner, 0 means no limit
+		std::size_t stride; // keep every stride-th point of a scan, 1 means all points
+
+		IngestFilter() :
+			cropMin(Eigen::Vector3d::Constant(std::numeric_limits<double>::lowest())), cropMax(Eigen::Vector3d::Constant(std::numeric_limits<double>::max())),
+			maxRange(0.0), stride(1) {}
+
+		bool AcceptScan(const int64_t scanID) const;
+
+		// Even-odd rule, points on the border may go either way
+		bool InPolygon(const double x, const double y) const;
+
+		// Parse a list of scan IDs and ranges, for example "0-3,7,9". Throw std::runtime_error on an item which is not a non-negative ID or an ascending range.
+		static std::vector<std::pair<int64_t, int64_t>> ParseScanRanges(const std::string& str);
+	};
+
 	class Scan : public ScanInfo
 	{
 	public:
@@ -76,13 +102,44 @@ namespace e57
 		std::shared_ptr<uint8_t> r;
 		std::shared_ptr<uint8_t> g;
 		std::shared_ptr<uint8_t> b;
+		std::shared_ptr<int32_t> row;
+		std::shared_ptr<int32_t> column;
+		bool hasPointGrid; // rowIndex and columnIndex are read, only if the program is compiled with POINT_E57_WITH_NORMAL
+		std::size_t numBufferPoints; // number of points currently stored in x, y, z, i, r, g, b, row, column
+		std::size_t bufferStart; // index in the scan of the first point in the buffers
 
-		Scan(Scanner scanner = Scanner::Scaner_UNKNOWN) : ScanInfo(scanner) {}
+		Scan(Scanner scanner = Scanner::Scaner_UNKNOWN) : ScanInfo(scanner), hasPointGrid(false), numBufferPoints(0), bufferStart(0) {}
 
 		void Load(const e57::ImageFile& imf, const e57::VectorNode& data3D, int64_t scanID);
 
+		// Read the scan block by block, blockSize points at most per block. blockFunc is called after each block is read, with numBufferPoints set to the block size.
+		// The buffers are reused between blocks, unless blockFunc keeps a copy of the scan (which shares the buffers), then new buffers are allocated for the next block.
+		void LoadBlocks(const e57::ImageFile& imf, const e57::VectorNode& data3D, int64_t scanID, const std::size_t blockSize, const std::function<void(Scan&)>& blockFunc);
+
 		// minRGB: Mean a point will be kept only if one of R, G, B is larger than minRGB, This parameters is to filter out the black noise which is generated by some scanner (such as BLK360).
-		void ExtractValidPointCloud(pcl::PointCloud<PointE57>& scanCloud, const uint8_t minRGB);
+		// The valid points of the current buffers are transformed by the scan pose and appended to scanCloud, in a single pass split over numThreads.
+		// If the scan has a row/column grid, normals are estimated from it (see EstimateGridNormals), so the buffers must hold the whole scan.
+		// filter: Points rejected by the stride, max range, crop box or polygon of filter are skipped in the same pass.
+		void ExtractValidPointCloud(pcl::PointCloud<PointE57>& scanCloud, const uint8_t minRGB, const unsigned int numThreads = 1, const IngestFilter& filter = IngestFilter());
+
+		// Grow [min, max] by the points of the current buffers accepted by filter, with the same pose and filters as ExtractValidPointCloud but no normals or point copies, so any block of a scan can be used.
+		// numTested and numAccepted are increased by the points kept by the stride and by the points accepted by all filters.
+		void ExtendValidBounds(const IngestFilter& filter, Eigen::Vector3d& min, Eigen::Vector3d& max, std::size_t& numTested, std::size_t& numAccepted) const;
+
+		// Parse pose and points prototype, and the world space AABB of the scan from its cartesianBounds, or sphericalBounds if it has no cartesianBounds. Return false if it has neither.
+		// maxRange: If larger than zero, the AABB is clipped to maxRange around the scanner.
+		bool LoadBounds(const e57::VectorNode& data3D, int64_t scanID, const double maxRange, Eigen::Vector3d& min, Eigen::Vector3d& max);
+
+		// Estimate normals of the points in the buffers from their row/column grid neighbours, in scanner coordinates (x, y, z are cartesian, the scanner is at origin).
+		// Neighbours across range discontinuities are ignored, and normals are oriented toward the scanner. normals receives normal xyz and curvature of each point, it is zero if the point has too few neighbours.
+		void EstimateGridNormals(const float* x, const float* y, const float* z, std::vector<Eigen::Vector4f>& normals, const unsigned int numThreads = 1) const;
+
+	protected:
+		// Parse pose and points prototype, return the points node if the scan has readable points
+		std::shared_ptr<e57::CompressedVectorNode> LoadHeader(const e57::VectorNode& data3D, int64_t scanID);
+		void AllocateBuffers(const std::size_t size);
+		bool BuffersShared() const;
+		std::vector<e57::SourceDestBuffer> CreateBuffers(const e57::ImageFile& imf, const std::size_t size);
 
 		operator ScanInfo() const
 		{
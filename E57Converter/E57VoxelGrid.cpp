@@ -0,0 +1,362 @@
+#include <cmath>
+#include <limits>
+#include <memory>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+#include <tuple>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include <pcl/exceptions.h>
+
+#include "E57VoxelGrid.h"
+
+namespace e57
+{
+	const uint64_t voxelGridEmptyKey = std::numeric_limits<uint64_t>::max();
+	const int64_t voxelGridAxisBits = 21;
+
+	inline uint64_t VoxelGridHash(uint64_t key)
+	{
+		// splitmix64 finalizer
+		key ^= key >> 30;
+		key *= 0xbf58476d1ce4e5b9ull;
+		key ^= key >> 27;
+		key *= 0x94d049bb133111ebull;
+		key ^= key >> 31;
+		return key;
+	}
+
+	// Range and incidence score of a sample of a scan, higher is better. Scanners without a beam model use the one of BLK360, only the order of scores matters here
+	inline double ScanSampleScore(const ScanInfo& scanInfo, const PointExchange& p)
+	{
+		Eigen::Vector3d incidentDirection = scanInfo.position - Eigen::Vector3d(p.x, p.y, p.z);
+		double hitDistance = incidentDirection.norm();
+		if (!(hitDistance > 0.0))
+			return 0.0;
+
+		double score = BeamFalloff(hitDistance);
+#if defined(POINT_E57_WITH_NORMAL) && defined(POINT_PCD_WITH_NORMAL)
+		Eigen::Vector3d hitNormal(p.normal_x, p.normal_y, p.normal_z);
+		double hitNormalNorm = hitNormal.norm();
+		if (hitNormalNorm > 0.0)
+			score *= std::abs(hitNormal.dot(incidentDirection)) / (hitNormalNorm * hitDistance);
+#endif
+		return score;
+	}
+
+	// Points of each voxel, voxels are numbered in order of their first point. Points of voxel v are voxelPoints[voxelOffsets[v]] to voxelPoints[voxelOffsets[v + 1]], in point order
+	struct VoxelGridBuckets
+	{
+		std::vector<int> voxelFirstPoints;
+		std::vector<int> voxelOffsets;
+		std::vector<int> voxelPoints;
+
+		int NumVoxels() const { return static_cast<int>(voxelFirstPoints.size()); }
+	};
+
+	void VoxelGridBucket(const pcl::PointCloud<PointExchange>& cloud, const double voxelUnit, const int numThreads, VoxelGridBuckets& buckets)
+	{
+		buckets.voxelFirstPoints.clear();
+		buckets.voxelOffsets.assign(1, 0);
+		buckets.voxelPoints.clear();
+		const int numPoints = static_cast<int>(cloud.size());
+		if (numPoints == 0)
+			return;
+
+		// Voxel coordinates are global, keys pack them relative to the min voxel of the cloud
+		Eigen::Vector3d minXYZ(std::numeric_limits<double>::max(), std::numeric_limits<double>::max(), std::numeric_limits<double>::max());
+		Eigen::Vector3d maxXYZ(std::numeric_limits<double>::lowest(), std::numeric_limits<double>::lowest(), std::numeric_limits<double>::lowest());
+		for (int pi = 0; pi < numPoints; ++pi)
+		{
+			const PointExchange& p = cloud[pi];
+			if (!std::isfinite(p.x) || !std::isfinite(p.y) || !std::isfinite(p.z))
+				continue;
+			minXYZ = minXYZ.cwiseMin(Eigen::Vector3d(p.x, p.y, p.z));
+			maxXYZ = maxXYZ.cwiseMax(Eigen::Vector3d(p.x, p.y, p.z));
+		}
+		if (minXYZ.x() > maxXYZ.x())
+			return;
+
+		const double invVoxelUnit = 1.0 / voxelUnit;
+		Eigen::Array3d minVoxel = (minXYZ.array() * invVoxelUnit).floor();
+		Eigen::Array3d maxVoxel = (maxXYZ.array() * invVoxelUnit).floor();
+		if (((maxVoxel - minVoxel) >= (double)(int64_t(1) << voxelGridAxisBits)).any())
+			throw pcl::PCLException("VoxelGridDownsample - voxelUnit is too small for the cloud extent.");
+
+		// Insert voxel keys into an open addressing hash table
+		std::size_t capacity = 16;
+		while (capacity < 2 * (std::size_t)numPoints)
+			capacity <<= 1;
+		const uint64_t capacityMask = capacity - 1;
+		std::unique_ptr<std::atomic<uint64_t>[]> slotKeys(new std::atomic<uint64_t>[capacity]);
+		std::unique_ptr<std::atomic<int>[]> slotFirstPoints(new std::atomic<int>[capacity]);
+		std::vector<int64_t> pointSlots(numPoints);
+
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(numThreads)
+#endif
+		for (int64_t si = 0; si < (int64_t)capacity; ++si)
+		{
+			slotKeys[si].store(voxelGridEmptyKey, std::memory_order_relaxed);
+			slotFirstPoints[si].store(numPoints, std::memory_order_relaxed);
+		}
+
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(numThreads)
+#endif
+		for (int pi = 0; pi < numPoints; ++pi)
+		{
+			const PointExchange& p = cloud[pi];
+			if (!std::isfinite(p.x) || !std::isfinite(p.y) || !std::isfinite(p.z))
+			{
+				pointSlots[pi] = -1;
+				continue;
+			}
+
+			uint64_t ix = (uint64_t)(std::floor(p.x * invVoxelUnit) - minVoxel.x());
+			uint64_t iy = (uint64_t)(std::floor(p.y * invVoxelUnit) - minVoxel.y());
+			uint64_t iz = (uint64_t)(std::floor(p.z * invVoxelUnit) - minVoxel.z());
+			uint64_t key = ix | (iy << voxelGridAxisBits) | (iz << (2 * voxelGridAxisBits));
+
+			uint64_t slot = VoxelGridHash(key) & capacityMask;
+			while (true)
+			{
+				uint64_t slotKey = slotKeys[slot].load(std::memory_order_acquire);
+				if (slotKey == voxelGridEmptyKey)
+				{
+					if (slotKeys[slot].compare_exchange_strong(slotKey, key, std::memory_order_acq_rel))
+						break;
+				}
+				if (slotKey == key)
+					break;
+				slot = (slot + 1) & capacityMask;
+			}
+			pointSlots[pi] = (int64_t)slot;
+
+			int firstPoint = slotFirstPoints[slot].load(std::memory_order_relaxed);
+			while ((pi < firstPoint) && !slotFirstPoints[slot].compare_exchange_weak(firstPoint, pi, std::memory_order_relaxed));
+		}
+
+		// Number voxels in order of their first point
+		std::vector<int> slotVoxels(capacity, -1);
+		std::vector<int>& voxelFirstPoints = buckets.voxelFirstPoints;
+		for (int pi = 0; pi < numPoints; ++pi)
+		{
+			if ((pointSlots[pi] >= 0) && (slotFirstPoints[pointSlots[pi]].load(std::memory_order_relaxed) == pi))
+			{
+				slotVoxels[pointSlots[pi]] = static_cast<int>(voxelFirstPoints.size());
+				voxelFirstPoints.push_back(pi);
+			}
+		}
+		const int numVoxels = static_cast<int>(voxelFirstPoints.size());
+
+		// Bucket points by voxel, then sort each bucket so the points are in point order
+		std::unique_ptr<std::atomic<int>[]> voxelCounts(new std::atomic<int>[numVoxels]);
+		for (int vi = 0; vi < numVoxels; ++vi)
+			voxelCounts[vi].store(0, std::memory_order_relaxed);
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(numThreads)
+#endif
+		for (int pi = 0; pi < numPoints; ++pi)
+		{
+			if (pointSlots[pi] >= 0)
+				voxelCounts[slotVoxels[pointSlots[pi]]].fetch_add(1, std::memory_order_relaxed);
+		}
+
+		std::vector<int>& voxelOffsets = buckets.voxelOffsets;
+		voxelOffsets.assign(numVoxels + 1, 0);
+		for (int vi = 0; vi < numVoxels; ++vi)
+		{
+			voxelOffsets[vi + 1] = voxelOffsets[vi] + voxelCounts[vi].load(std::memory_order_relaxed);
+			voxelCounts[vi].store(voxelOffsets[vi], std::memory_order_relaxed);
+		}
+
+		std::vector<int>& voxelPoints = buckets.voxelPoints;
+		voxelPoints.resize(voxelOffsets[numVoxels]);
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(numThreads)
+#endif
+		for (int pi = 0; pi < numPoints; ++pi)
+		{
+			if (pointSlots[pi] >= 0)
+				voxelPoints[voxelCounts[slotVoxels[pointSlots[pi]]].fetch_add(1, std::memory_order_relaxed)] = pi;
+		}
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic, 1024) num_threads(numThreads)
+#endif
+		for (int vi = 0; vi < numVoxels; ++vi)
+			std::sort(voxelPoints.begin() + voxelOffsets[vi], voxelPoints.begin() + voxelOffsets[vi + 1]);
+	}
+
+	void VoxelGridDownsample(const pcl::PointCloud<PointExchange>& cloud, const double voxelUnit, pcl::PointCloud<PointExchange>& out, const int numThreads, std::vector<Eigen::Vector3d>* voxelCentres, std::vector<Eigen::Vector3d>* voxelMinPoints)
+	{
+		out.clear();
+		if (voxelCentres != nullptr)
+			voxelCentres->clear();
+		if (voxelMinPoints != nullptr)
+			voxelMinPoints->clear();
+
+		VoxelGridBuckets buckets;
+		VoxelGridBucket(cloud, voxelUnit, numThreads, buckets);
+		const std::vector<int>& voxelFirstPoints = buckets.voxelFirstPoints;
+		const std::vector<int>& voxelOffsets = buckets.voxelOffsets;
+		const std::vector<int>& voxelPoints = buckets.voxelPoints;
+		const int numVoxels = buckets.NumVoxels();
+		if (numVoxels == 0)
+			return;
+		const double invVoxelUnit = 1.0 / voxelUnit;
+
+		// Average each voxel
+		out.resize(numVoxels);
+		if (voxelCentres != nullptr)
+			voxelCentres->resize(numVoxels);
+		if (voxelMinPoints != nullptr)
+			voxelMinPoints->resize(numVoxels);
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic, 1024) num_threads(numThreads)
+#endif
+		for (int vi = 0; vi < numVoxels; ++vi)
+		{
+			Eigen::Vector3d xyz(0.0, 0.0, 0.0);
+			Eigen::Vector3d rgb(0.0, 0.0, 0.0);
+			Eigen::Vector3d minPoint(std::numeric_limits<double>::max(), std::numeric_limits<double>::max(), std::numeric_limits<double>::max());
+			double intensity = 0.0;
+#ifdef POINT_E57_WITH_HDR
+			Eigen::Vector4d hdr(0.0, 0.0, 0.0, 0.0);
+#endif
+#if defined(POINT_E57_WITH_NORMAL) && defined(POINT_PCD_WITH_NORMAL)
+			Eigen::Vector3d normal(0.0, 0.0, 0.0);
+			double curvature = 0.0;
+			int numNormals = 0;
+#endif
+			for (int vpi = voxelOffsets[vi]; vpi < voxelOffsets[vi + 1]; ++vpi)
+			{
+				const PointExchange& p = cloud[voxelPoints[vpi]];
+				xyz += Eigen::Vector3d(p.x, p.y, p.z);
+				if (std::make_tuple((double)p.x, (double)p.y, (double)p.z) < std::make_tuple(minPoint.x(), minPoint.y(), minPoint.z()))
+					minPoint = Eigen::Vector3d(p.x, p.y, p.z);
+				rgb += Eigen::Vector3d(p.r, p.g, p.b);
+				intensity += p.intensity;
+#ifdef POINT_E57_WITH_HDR
+				hdr += Eigen::Vector4d(p.hdr_r, p.hdr_g, p.hdr_b, p.hdr_a);
+#endif
+#if defined(POINT_E57_WITH_NORMAL) && defined(POINT_PCD_WITH_NORMAL)
+				if ((p.normal_x != 0.f) || (p.normal_y != 0.f) || (p.normal_z != 0.f))
+				{
+					normal += Eigen::Vector3d(p.normal_x, p.normal_y, p.normal_z);
+					curvature += p.curvature;
+					numNormals++;
+				}
+#endif
+			}
+
+			const double invCount = 1.0 / (voxelOffsets[vi + 1] - voxelOffsets[vi]);
+			PointExchange& point = out[vi];
+			point = cloud[voxelFirstPoints[vi]];
+			if (voxelCentres != nullptr)
+				(*voxelCentres)[vi] = ((Eigen::Vector3d(point.x, point.y, point.z).array() * invVoxelUnit).floor() + 0.5) * voxelUnit;
+			if (voxelMinPoints != nullptr)
+				(*voxelMinPoints)[vi] = minPoint;
+			xyz *= invCount;
+			point.x = xyz.x();
+			point.y = xyz.y();
+			point.z = xyz.z();
+			rgb *= invCount;
+			point.r = (uint8_t)std::min(std::max(std::round(rgb.x()), 0.0), 255.0);
+			point.g = (uint8_t)std::min(std::max(std::round(rgb.y()), 0.0), 255.0);
+			point.b = (uint8_t)std::min(std::max(std::round(rgb.z()), 0.0), 255.0);
+			point.intensity = intensity * invCount;
+#ifdef POINT_E57_WITH_HDR
+			hdr *= invCount;
+			point.hdr_r = hdr.x();
+			point.hdr_g = hdr.y();
+			point.hdr_b = hdr.z();
+			point.hdr_a = hdr.w();
+#endif
+#if defined(POINT_E57_WITH_NORMAL) && defined(POINT_PCD_WITH_NORMAL)
+			// Grid normals of the voxel, zero if none of its points has one
+			if ((numNormals > 0) && (normal.norm() > 0.0))
+			{
+				normal.normalize();
+				point.normal_x = normal.x();
+				point.normal_y = normal.y();
+				point.normal_z = normal.z();
+				point.curvature = curvature / numNormals;
+			}
+			else
+				point.normal_x = point.normal_y = point.normal_z = point.curvature = 0.f;
+#endif
+		}
+		out.width = out.size();
+		out.height = 1;
+		out.is_dense = true;
+	}
+
+	void VoxelGridBestScan(const pcl::PointCloud<PointExchange>& cloud, const double voxelUnit, const std::vector<ScanInfo>& scanInfos, pcl::PointCloud<PointExchange>& out, const int numThreads)
+	{
+		out.clear();
+#ifdef POINT_E57_WITH_LABEL
+		VoxelGridBuckets buckets;
+		VoxelGridBucket(cloud, voxelUnit, numThreads, buckets);
+		const int numVoxels = buckets.NumVoxels();
+
+		std::vector<uint8_t> keep(cloud.size(), 0);
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic, 1024) num_threads(numThreads)
+#endif
+		for (int vi = 0; vi < numVoxels; ++vi)
+		{
+			// Mean score of each scan in the voxel, most voxels have few scans so a small vector is enough
+			std::vector<std::pair<uint32_t, std::pair<double, int>>> scanScores;
+			for (int vpi = buckets.voxelOffsets[vi]; vpi < buckets.voxelOffsets[vi + 1]; ++vpi)
+			{
+				const PointExchange& p = cloud[buckets.voxelPoints[vpi]];
+				double score = 0.0;
+				if ((p.hasLabel != -1) && (p.label < scanInfos.size()))
+					score = ScanSampleScore(scanInfos[p.label], p);
+				uint32_t scanID = (p.hasLabel != -1) ? p.label : std::numeric_limits<uint32_t>::max();
+
+				std::size_t si = 0;
+				while ((si < scanScores.size()) && (scanScores[si].first != scanID))
+					++si;
+				if (si == scanScores.size())
+					scanScores.push_back(std::pair<uint32_t, std::pair<double, int>>(scanID, std::pair<double, int>(0.0, 0)));
+				scanScores[si].second.first += score;
+				scanScores[si].second.second++;
+			}
+
+			// Ties go to the scan of the first point
+			std::size_t bestScan = 0;
+			for (std::size_t si = 1; si < scanScores.size(); ++si)
+			{
+				if (scanScores[si].second.first / scanScores[si].second.second > scanScores[bestScan].second.first / scanScores[bestScan].second.second)
+					bestScan = si;
+			}
+
+			for (int vpi = buckets.voxelOffsets[vi]; vpi < buckets.voxelOffsets[vi + 1]; ++vpi)
+			{
+				const PointExchange& p = cloud[buckets.voxelPoints[vpi]];
+				uint32_t scanID = (p.hasLabel != -1) ? p.label : std::numeric_limits<uint32_t>::max();
+				keep[buckets.voxelPoints[vpi]] = (scanID == scanScores[bestScan].first);
+			}
+		}
+
+		out.reserve(buckets.voxelPoints.size());
+		for (std::size_t pi = 0; pi < cloud.size(); ++pi)
+		{
+			if (keep[pi])
+				out.push_back(cloud[pi]);
+		}
+#else
+		out = cloud;
+#endif
+		out.width = out.size();
+		out.height = 1;
+		out.is_dense = true;
+	}
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <vector>
+
+#include <pcl/point_cloud.h>
+
+#include "E57Utils.h"
+
+namespace e57
+{
+	// Downsample cloud to one point per voxel, a replacement of pcl::VoxelGrid for export.
+	// Voxels are cells of a grid anchored at the world origin, so adjacent leaves produce the same voxels on their shared border.
+	// Each output point averages position, RGB, intensity and HDR (and grid normals, if compiled with POINT_E57_WITH_NORMAL) of its voxel, other fields are taken from the first point of the voxel. Output points are ordered by the first point of their voxel, and do not depend on numThreads.
+	// voxelCentres: If given, receives the centre of the voxel of each output point. Unlike the averaged point, it does not depend on which points of the voxel are in cloud.
+	// voxelMinPoints: If given, receives the lexicographically smallest (x, then y, then z) point of the voxel of each output point, which does not depend on point order.
+	// Throw pcl::PCLException if the cloud spans more than 2^21 voxels on an axis.
+	void VoxelGridDownsample(const pcl::PointCloud<PointExchange>& cloud, const double voxelUnit, pcl::PointCloud<PointExchange>& out, const int numThreads, std::vector<Eigen::Vector3d>* voxelCentres = nullptr, std::vector<Eigen::Vector3d>* voxelMinPoints = nullptr);
+
+	// Keep, in each voxel of the same grid as VoxelGridDownsample, only the points of the scan with the best mean range/incidence score, so overlapped surfaces are not averaged over scans.
+	// The score is the beam falloff at the distance to ScanInfo::position, times the cosine of incidence if the points have grid normals (POINT_E57_WITH_NORMAL). Points keep their order.
+	// Points are not filtered if the program is not compiled with POINT_E57_WITH_LABEL.
+	void VoxelGridBestScan(const pcl::PointCloud<PointExchange>& cloud, const double voxelUnit, const std::vector<ScanInfo>& scanInfos, pcl::PointCloud<PointExchange>& out, const int numThreads);
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <vector>
+
+#include <pcl/point_cloud.h>
+#include <pcl/search/search.h>
+
+namespace e57
+{
+	// Uniform grid (cell list) search, for the fixed radius queries of export, which are all multiples of voxelUnit.
+	// Points are bucketed by cell with a counting sort into a compressed row layout, so the points of a cell are contiguous in memory. Queries only visit the cells overlapping the search sphere.
+	// Building is O(n), and all queries are const and thread safe. Setting the indexed cloud again keeps the index, so points of an indexed cloud must not be moved.
+	template <typename PointT>
+	class GridSearch : public pcl::search::Search<PointT>
+	{
+	public:
+		typedef boost::shared_ptr<GridSearch<PointT> > Ptr;
+		typedef boost::shared_ptr<const GridSearch<PointT> > ConstPtr;
+		typedef typename pcl::search::Search<PointT>::PointCloudConstPtr PointCloudConstPtr;
+		typedef typename pcl::search::Search<PointT>::IndicesConstPtr IndicesConstPtr;
+
+		using pcl::search::Search<PointT>::nearestKSearch;
+		using pcl::search::Search<PointT>::radiusSearch;
+
+	protected:
+		using pcl::search::Search<PointT>::input_;
+		using pcl::search::Search<PointT>::indices_;
+		using pcl::search::Search<PointT>::sorted_results_;
+
+		struct CellPoint
+		{
+			float x, y, z;
+			int index;
+		};
+
+		double preferredCellSize;
+		double cellSize;
+		double invCellSize;
+		Eigen::Vector3d gridMin;
+		Eigen::Array3i gridDims;
+		std::vector<int> cellStarts; // points of cell c are cellPoints[cellStarts[c]] to cellPoints[cellStarts[c + 1]]
+		std::vector<CellPoint> cellPoints;
+		std::size_t builtSize;
+
+		inline Eigen::Array3i CellOf(const PointT& p) const;
+		inline int CellID(const Eigen::Array3i& cell) const { return (cell.z() * gridDims.y() + cell.y()) * gridDims.x() + cell.x(); }
+
+		// Gather points of the cells in [minCell, maxCell] with squared distance <= sqrRadius
+		void GatherCells(const PointT& p, const Eigen::Array3i& minCell, const Eigen::Array3i& maxCell, const float sqrRadius, std::vector<int>& k_indices, std::vector<float>& k_sqr_distances) const;
+		void SortResults(std::vector<int>& k_indices, std::vector<float>& k_sqr_distances, const std::size_t maxSize) const;
+		// Query order of cloud[indices] sorted by cell
+		std::vector<int> BatchOrder(const pcl::PointCloud<PointT>& cloud, const std::vector<int>& indices) const;
+
+	public:
+		// cellSize: Preferred cell size, usually the search radius. It is enlarged if the grid would have much more cells than points.
+		GridSearch(const double cellSize, const bool sortedResults = false);
+		virtual ~GridSearch() {}
+
+		virtual void setInputCloud(const PointCloudConstPtr& cloud, const IndicesConstPtr& indices = IndicesConstPtr());
+
+		virtual int nearestKSearch(const PointT& point, int k, std::vector<int>& k_indices, std::vector<float>& k_sqr_distances) const;
+		virtual int radiusSearch(const PointT& point, double radius, std::vector<int>& k_indices, std::vector<float>& k_sqr_distances, unsigned int max_nn = 0) const;
+
+		// Batched queries of cloud[indices], or of the whole cloud if indices is empty. Queries are visited in cell order so consecutive queries share cells, and run on numThreads threads (0 means all cores).
+		void NearestKSearchBatch(const pcl::PointCloud<PointT>& cloud, const std::vector<int>& indices, int k, std::vector<std::vector<int> >& k_indices, std::vector<std::vector<float> >& k_sqr_distances, const int numThreads = 0) const;
+		void RadiusSearchBatch(const pcl::PointCloud<PointT>& cloud, const std::vector<int>& indices, double radius, std::vector<std::vector<int> >& k_indices, std::vector<std::vector<float> >& k_sqr_distances, unsigned int max_nn = 0, const int numThreads = 0) const;
+
+		virtual void nearestKSearch(const pcl::PointCloud<PointT>& cloud, const std::vector<int>& indices, int k, std::vector<std::vector<int> >& k_indices, std::vector<std::vector<float> >& k_sqr_distances) const
+		{
+			NearestKSearchBatch(cloud, indices, k, k_indices, k_sqr_distances);
+		}
+		virtual void radiusSearch(const pcl::PointCloud<PointT>& cloud, const std::vector<int>& indices, double radius, std::vector<std::vector<int> >& k_indices, std::vector<std::vector<float> >& k_sqr_distances, unsigned int max_nn = 0) const
+		{
+			RadiusSearchBatch(cloud, indices, radius, k_indices, k_sqr_distances, max_nn);
+		}
+
+		double CellSize() const { return cellSize; }
+	};
+}
+
+#include "GridSearch.hpp"
@@ -0,0 +1,265 @@
+#pragma once
+
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include <numeric>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "GridSearch.h"
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+template <typename PointT>
+e57::GridSearch<PointT>::GridSearch(const double cellSize, const bool sortedResults) :
+	pcl::search::Search<PointT>("GridSearch", sortedResults),
+	preferredCellSize(cellSize),
+	cellSize(cellSize),
+	invCellSize(1.0 / cellSize),
+	gridMin(0.0, 0.0, 0.0),
+	gridDims(0, 0, 0),
+	builtSize(0)
+{
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+template <typename PointT> inline Eigen::Array3i
+e57::GridSearch<PointT>::CellOf(const PointT& p) const
+{
+	Eigen::Array3d c = ((Eigen::Array3d(p.x, p.y, p.z) - gridMin.array()) * invCellSize).floor();
+	return c.max(-1.0).min(gridDims.cast<double>()).cast<int>();
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+template <typename PointT> void
+e57::GridSearch<PointT>::setInputCloud(const PointCloudConstPtr& cloud, const IndicesConstPtr& indices)
+{
+	// Stages sharing the index set the same cloud again, keep the index in this case
+	if (cloud && (cloud == input_) && (indices == indices_) && (cloud->size() == builtSize))
+		return;
+
+	input_ = cloud;
+	indices_ = indices;
+	builtSize = cloud ? cloud->size() : 0;
+	cellStarts.clear();
+	cellPoints.clear();
+	gridDims = Eigen::Array3i(0, 0, 0);
+	if (!cloud)
+		return;
+
+	std::vector<int> points;
+	if (indices)
+	{
+		points = *indices;
+	}
+	else
+	{
+		points.resize(cloud->size());
+		std::iota(points.begin(), points.end(), 0);
+	}
+	points.erase(std::remove_if(points.begin(), points.end(), [&cloud](int pi)
+	{
+		const PointT& p = (*cloud)[pi];
+		return !std::isfinite(p.x) || !std::isfinite(p.y) || !std::isfinite(p.z);
+	}), points.end());
+	if (points.empty())
+		return;
+
+	// Fit the grid to the points, and bound the number of cells by the number of points
+	Eigen::Vector3d minXYZ(std::numeric_limits<double>::max(), std::numeric_limits<double>::max(), std::numeric_limits<double>::max());
+	Eigen::Vector3d maxXYZ(std::numeric_limits<double>::lowest(), std::numeric_limits<double>::lowest(), std::numeric_limits<double>::lowest());
+	for (std::size_t i = 0; i < points.size(); ++i)
+	{
+		const PointT& p = (*cloud)[points[i]];
+		minXYZ = minXYZ.cwiseMin(Eigen::Vector3d(p.x, p.y, p.z));
+		maxXYZ = maxXYZ.cwiseMax(Eigen::Vector3d(p.x, p.y, p.z));
+	}
+	Eigen::Vector3d extent = maxXYZ - minXYZ;
+	cellSize = preferredCellSize;
+	invCellSize = 1.0 / cellSize;
+	double maxCells = 4.0 * points.size() + 1024.0;
+	while (((extent.array() * invCellSize).floor() + 1.0).prod() > maxCells)
+	{
+		cellSize *= 1.25;
+		invCellSize = 1.0 / cellSize;
+	}
+	gridMin = minXYZ;
+	gridDims = ((extent.array() * invCellSize).floor() + 1.0).cast<int>();
+
+	// Counting sort points by cell
+	std::vector<int> pointCells(points.size());
+	cellStarts.assign(gridDims.prod() + 1, 0);
+	for (std::size_t i = 0; i < points.size(); ++i)
+	{
+		pointCells[i] = CellID(CellOf((*cloud)[points[i]]).min(gridDims - 1));
+		cellStarts[pointCells[i] + 1]++;
+	}
+	for (std::size_t c = 1; c < cellStarts.size(); ++c)
+		cellStarts[c] += cellStarts[c - 1];
+
+	std::vector<int> cursors(cellStarts.begin(), cellStarts.end() - 1);
+	cellPoints.resize(points.size());
+	for (std::size_t i = 0; i < points.size(); ++i)
+	{
+		const PointT& p = (*cloud)[points[i]];
+		CellPoint& cp = cellPoints[cursors[pointCells[i]]++];
+		cp.x = p.x;
+		cp.y = p.y;
+		cp.z = p.z;
+		cp.index = points[i];
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+template <typename PointT> void
+e57::GridSearch<PointT>::GatherCells(const PointT& p, const Eigen::Array3i& minCell, const Eigen::Array3i& maxCell, const float sqrRadius, std::vector<int>& k_indices, std::vector<float>& k_sqr_distances) const
+{
+	Eigen::Array3i lo = minCell.max(0);
+	Eigen::Array3i hi = maxCell.min(gridDims - 1);
+	for (int z = lo.z(); z <= hi.z(); ++z)
+	{
+		for (int y = lo.y(); y <= hi.y(); ++y)
+		{
+			// Cells of a row are contiguous
+			int rowStart = CellID(Eigen::Array3i(lo.x(), y, z));
+			int rowEnd = CellID(Eigen::Array3i(hi.x(), y, z)) + 1;
+			for (int ci = cellStarts[rowStart]; ci < cellStarts[rowEnd]; ++ci)
+			{
+				const CellPoint& cp = cellPoints[ci];
+				float dx = cp.x - p.x;
+				float dy = cp.y - p.y;
+				float dz = cp.z - p.z;
+				float d = dx * dx + dy * dy + dz * dz;
+				if (d <= sqrRadius)
+				{
+					k_indices.push_back(cp.index);
+					k_sqr_distances.push_back(d);
+				}
+			}
+		}
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+template <typename PointT> void
+e57::GridSearch<PointT>::SortResults(std::vector<int>& k_indices, std::vector<float>& k_sqr_distances, const std::size_t maxSize) const
+{
+	std::vector<std::pair<float, int>> results(k_indices.size());
+	for (std::size_t i = 0; i < k_indices.size(); ++i)
+		results[i] = std::pair<float, int>(k_sqr_distances[i], k_indices[i]);
+
+	std::size_t size = std::min(maxSize, results.size());
+	std::partial_sort(results.begin(), results.begin() + size, results.end());
+	k_indices.resize(size);
+	k_sqr_distances.resize(size);
+	for (std::size_t i = 0; i < size; ++i)
+	{
+		k_sqr_distances[i] = results[i].first;
+		k_indices[i] = results[i].second;
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+template <typename PointT> int
+e57::GridSearch<PointT>::radiusSearch(const PointT& point, double radius, std::vector<int>& k_indices, std::vector<float>& k_sqr_distances, unsigned int max_nn) const
+{
+	k_indices.clear();
+	k_sqr_distances.clear();
+	if (cellPoints.empty() || !std::isfinite(point.x) || !std::isfinite(point.y) || !std::isfinite(point.z))
+		return 0;
+
+	Eigen::Array3d p(point.x, point.y, point.z);
+	Eigen::Array3d minCell = ((p - radius - gridMin.array()) * invCellSize).floor().max(-1.0).min(gridDims.cast<double>());
+	Eigen::Array3d maxCell = ((p + radius - gridMin.array()) * invCellSize).floor().max(-1.0).min(gridDims.cast<double>());
+	GatherCells(point, minCell.cast<int>(), maxCell.cast<int>(), static_cast<float>(radius * radius), k_indices, k_sqr_distances);
+
+	if (sorted_results_ || ((max_nn > 0) && (k_indices.size() > max_nn)))
+		SortResults(k_indices, k_sqr_distances, (max_nn > 0) ? max_nn : k_indices.size());
+	return static_cast<int>(k_indices.size());
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+template <typename PointT> int
+e57::GridSearch<PointT>::nearestKSearch(const PointT& point, int k, std::vector<int>& k_indices, std::vector<float>& k_sqr_distances) const
+{
+	k_indices.clear();
+	k_sqr_distances.clear();
+	if (cellPoints.empty() || (k <= 0) || !std::isfinite(point.x) || !std::isfinite(point.y) || !std::isfinite(point.z))
+		return 0;
+
+	// Grow a cube of cells around the point, until the k nearest points are closer than any unvisited cell
+	Eigen::Array3i center = CellOf(point);
+	int maxShell = (center.max(gridDims - 1 - center).max(center.abs())).maxCoeff() + 1;
+	for (int shell = 0; shell <= maxShell; ++shell)
+	{
+		k_indices.clear();
+		k_sqr_distances.clear();
+		GatherCells(point, center - shell, center + shell, std::numeric_limits<float>::max(), k_indices, k_sqr_distances);
+		if (k_indices.size() >= static_cast<std::size_t>(k))
+		{
+			SortResults(k_indices, k_sqr_distances, k);
+			double safeRadius = shell * cellSize;
+			if ((k_sqr_distances.back() <= safeRadius * safeRadius) || (shell == maxShell))
+				return static_cast<int>(k_indices.size());
+		}
+	}
+	SortResults(k_indices, k_sqr_distances, k);
+	return static_cast<int>(k_indices.size());
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+template <typename PointT> std::vector<int>
+e57::GridSearch<PointT>::BatchOrder(const pcl::PointCloud<PointT>& cloud, const std::vector<int>& indices) const
+{
+	std::vector<std::pair<int, int>> cellQuerys(indices.empty() ? cloud.size() : indices.size());
+	for (std::size_t qi = 0; qi < cellQuerys.size(); ++qi)
+	{
+		const PointT& p = cloud[indices.empty() ? qi : indices[qi]];
+		bool valid = std::isfinite(p.x) && std::isfinite(p.y) && std::isfinite(p.z) && (gridDims > 0).all();
+		cellQuerys[qi] = std::pair<int, int>(valid ? CellID(CellOf(p).max(0).min(gridDims - 1)) : -1, static_cast<int>(qi));
+	}
+	std::sort(cellQuerys.begin(), cellQuerys.end());
+
+	std::vector<int> order(cellQuerys.size());
+	for (std::size_t i = 0; i < cellQuerys.size(); ++i)
+		order[i] = cellQuerys[i].second;
+	return order;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+template <typename PointT> void
+e57::GridSearch<PointT>::NearestKSearchBatch(const pcl::PointCloud<PointT>& cloud, const std::vector<int>& indices, int k, std::vector<std::vector<int> >& k_indices, std::vector<std::vector<float> >& k_sqr_distances, const int numThreads) const
+{
+	std::vector<int> order = BatchOrder(cloud, indices);
+	k_indices.resize(order.size());
+	k_sqr_distances.resize(order.size());
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic, 256) num_threads((numThreads > 0) ? numThreads : omp_get_num_procs())
+#endif
+	for (int i = 0; i < static_cast<int>(order.size()); ++i)
+	{
+		int qi = order[i];
+		nearestKSearch(cloud[indices.empty() ? qi : indices[qi]], k, k_indices[qi], k_sqr_distances[qi]);
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+template <typename PointT> void
+e57::GridSearch<PointT>::RadiusSearchBatch(const pcl::PointCloud<PointT>& cloud, const std::vector<int>& indices, double radius, std::vector<std::vector<int> >& k_indices, std::vector<std::vector<float> >& k_sqr_distances, unsigned int max_nn, const int numThreads) const
+{
+	std::vector<int> order = BatchOrder(cloud, indices);
+	k_indices.resize(order.size());
+	k_sqr_distances.resize(order.size());
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic, 256) num_threads((numThreads > 0) ? numThreads : omp_get_num_procs())
+#endif
+	for (int i = 0; i < static_cast<int>(order.size()); ++i)
+	{
+		int qi = order[i];
+		radiusSearch(cloud[indices.empty() ? qi : indices[qi]], radius, k_indices[qi], k_sqr_distances[qi], max_nn);
+	}
+}
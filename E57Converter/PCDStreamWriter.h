@@ -0,0 +1,133 @@
+#pragma once
+
+#include <limits>
+#include <vector>
+#include <string>
+#include <sstream>
+#include <iomanip>
+#include <fstream>
+#include <cstring>
+
+#include <boost/filesystem.hpp>
+#include <pcl/point_cloud.h>
+#include <pcl/common/io.h>
+#include <pcl/exceptions.h>
+
+namespace e57
+{
+	// Write a binary PCD file block by block, so the whole cloud never has to be held in memory.
+	// The header is written first with a fixed width placeholder of WIDTH and POINTS, which are patched by Close once the number of points is known.
+	template <typename PointT>
+	class PCDStreamWriter
+	{
+	protected:
+		static const int numDigits = 10;
+
+		std::ofstream file;
+		std::vector<pcl::PCLPointField> fields;
+		std::size_t pointSize;
+		std::streampos widthPos;
+		std::streampos pointsPos;
+		uint64_t numPoints;
+
+		void WriteCount(const std::streampos pos)
+		{
+			file.seekp(pos);
+			file << std::setw(numDigits) << std::setfill('0') << numPoints;
+		}
+
+	public:
+		PCDStreamWriter(const boost::filesystem::path& filePath) : pointSize(0), numPoints(0)
+		{
+			file.open(filePath.string(), std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+			if (!file)
+				throw pcl::PCLException("Create file " + filePath.string() + " failed.");
+
+			// Padding fields are not written, same as pcl::PCDWriter::writeBinary
+			std::vector<pcl::PCLPointField> allFields;
+			pcl::getFields<PointT>(allFields);
+			for (const auto& field : allFields)
+			{
+				if (field.name == "_")
+					continue;
+				fields.push_back(field);
+				pointSize += pcl::getFieldSize(field.datatype) * field.count;
+			}
+
+			std::stringstream fieldNames, fieldSizes, fieldTypes, fieldCounts;
+			for (const auto& field : fields)
+			{
+				fieldNames << " " << field.name;
+				fieldSizes << " " << pcl::getFieldSize(field.datatype);
+				fieldTypes << " " << pcl::getFieldType(field.datatype);
+				fieldCounts << " " << field.count;
+			}
+
+			file << "# .PCD v0.7 - Point Cloud Data file format\n";
+			file << "VERSION 0.7\n";
+			file << "FIELDS" << fieldNames.str() << "\n";
+			file << "SIZE" << fieldSizes.str() << "\n";
+			file << "TYPE" << fieldTypes.str() << "\n";
+			file << "COUNT" << fieldCounts.str() << "\n";
+			file << "WIDTH ";
+			widthPos = file.tellp();
+			WriteCount(widthPos);
+			file << "\nHEIGHT 1\n";
+			file << "VIEWPOINT 0 0 0 1 0 0 0\n";
+			file << "POINTS ";
+			pointsPos = file.tellp();
+			WriteCount(pointsPos);
+			file << "\nDATA binary\n";
+		}
+
+		~PCDStreamWriter()
+		{
+			try
+			{
+				Close();
+			}
+			catch (...)
+			{
+			}
+		}
+
+		uint64_t NumPoints() const { return numPoints; }
+
+		void Write(const pcl::PointCloud<PointT>& cloud)
+		{
+			if (!file.is_open())
+				throw pcl::PCLException("PCDStreamWriter is closed.");
+			if (numPoints + cloud.size() > (uint64_t)std::numeric_limits<int>::max())
+				throw pcl::PCLException("PCD file can not contain more than " + std::to_string(std::numeric_limits<int>::max()) + " points.");
+
+			std::vector<char> block(cloud.size() * pointSize);
+			char* dst = block.data();
+			for (std::size_t pi = 0; pi < cloud.size(); ++pi)
+			{
+				const char* src = reinterpret_cast<const char*>(&cloud[pi]);
+				for (const auto& field : fields)
+				{
+					std::size_t size = pcl::getFieldSize(field.datatype) * field.count;
+					std::memcpy(dst, src + field.offset, size);
+					dst += size;
+				}
+			}
+			file.write(block.data(), block.size());
+			if (!file)
+				throw pcl::PCLException("Write PCD block failed.");
+			numPoints += cloud.size();
+		}
+
+		// Patch the header with the number of written points and close the file
+		void Close()
+		{
+			if (!file.is_open())
+				return;
+			WriteCount(widthPos);
+			WriteCount(pointsPos);
+			file.close();
+			if (!file)
+				throw pcl::PCLException("Close PCD file failed.");
+		}
+	};
+}
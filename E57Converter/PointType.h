@@ -26,6 +26,12 @@
 #define E57_CAN_CONTAIN_HDR false
 #endif
 
+#ifdef POINT_E57_WITH_NORMAL
+#define E57_CAN_CONTAIN_NORMAL true
+#else
+#define E57_CAN_CONTAIN_NORMAL false
+#endif
+
 #ifdef POINT_PCD_WITH_RGB
 #define PCD_CAN_CONTAIN_RGB true
 #else
@@ -87,6 +93,10 @@ struct EIGEN_ALIGN16 _PointE57
 {
 	PCL_ADD_POINT4D;
 
+#ifdef POINT_E57_WITH_NORMAL
+	union EIGEN_ALIGN16 { float data_n[4]; float normal[3]; struct { float normal_x; float normal_y; float normal_z; float curvature; }; };
+#endif
+
 #ifdef POINT_E57_WITH_HDR
 	union EIGEN_ALIGN16 { float data_hdr[4]; struct { float hdr_r; float hdr_g; float hdr_b; float hdr_a; }; };
 #endif
@@ -180,6 +190,9 @@ struct PointE57 : public _PointE57
 	inline PointE57(const PointE57& p)
 	{
 		x = p.x; y = p.y; z = p.z; data[3] = 1.0f;
+#ifdef POINT_E57_WITH_NORMAL
+		normal_x = p.normal_x; normal_y = p.normal_y; normal_z = p.normal_z; curvature = p.curvature;
+#endif
 #ifdef POINT_E57_WITH_HDR
 		hdr_r = p.hdr_r; hdr_g = p.hdr_g; hdr_b = p.hdr_b; hdr_a = p.hdr_a;
 #endif
@@ -206,6 +219,9 @@ struct PointE57 : public _PointE57
 	inline void Clear()
 	{
 		x = y = z = 0.0f; data[3] = 1.f;
+#ifdef POINT_E57_WITH_NORMAL
+		normal_x = normal_y = normal_z = curvature = 0.f;
+#endif
 #ifdef POINT_E57_WITH_HDR
 		hdr_r = hdr_g = hdr_b = hdr_a = 0.f;
 #endif
@@ -270,7 +286,11 @@ struct PointExchange : public _PointExchange
 	{
 		x = p.x; y = p.y; z = p.z; data[3] = 1.0f;
 #ifdef POINT_PCD_WITH_NORMAL
+#	ifdef POINT_E57_WITH_NORMAL
+		normal_x = p.normal_x; normal_y = p.normal_y; normal_z = p.normal_z; data_n[3] = 0.f; curvature = p.curvature;
+#	else
 		normal_x = normal_y = normal_z = data_n[3] = curvature = 0.f;
+#	endif
 #endif
 #ifdef POINT_E57_WITH_HDR
 		hdr_r = p.hdr_r; hdr_g = p.hdr_g; hdr_b = p.hdr_b; hdr_a = p.hdr_a;
@@ -373,7 +393,11 @@ struct PointPCD : public _PointPCD
 	{
 		x = p.x; y = p.y; z = p.z; data[3] = 1.0f;
 #ifdef POINT_PCD_WITH_NORMAL
+#	ifdef POINT_E57_WITH_NORMAL
+		normal_x = p.normal_x; normal_y = p.normal_y; normal_z = p.normal_z; data_n[3] = 0.f; curvature = p.curvature;
+#	else
 		normal_x = normal_y = normal_z = data_n[3] = curvature = 0.f;
+#	endif
 #endif
 #ifdef POINT_PCD_WITH_RGB
 #	ifdef POINT_E57_WITH_RGB
@@ -490,6 +514,9 @@ struct PointNDF : public _PointNDF
 inline PointE57::PointE57(const PointExchange& p)
 {
 	x = p.x; y = p.y; z = p.z; data[3] = 1.0f;
+#ifdef POINT_E57_WITH_NORMAL
+	normal_x = p.normal_x; normal_y = p.normal_y; normal_z = p.normal_z; curvature = p.curvature;
+#endif
 #ifdef POINT_E57_WITH_HDR
 	hdr_r = p.hdr_r; hdr_g = p.hdr_g; hdr_b = p.hdr_b; hdr_a = p.hdr_a;
 #endif
@@ -507,6 +534,13 @@ inline PointE57::PointE57(const PointExchange& p)
 inline PointE57::PointE57(const PointPCD& p)
 {
 	x = p.x; y = p.y; z = p.z; data[3] = 1.0f;
+#ifdef POINT_E57_WITH_NORMAL
+#	ifdef POINT_PCD_WITH_NORMAL
+	normal_x = p.normal_x; normal_y = p.normal_y; normal_z = p.normal_z; curvature = p.curvature;
+#	else
+	normal_x = normal_y = normal_z = curvature = 0.f;
+#	endif
+#endif
 #ifdef POINT_E57_WITH_HDR
 	hdr_r = hdr_g = hdr_b = hdr_a = 0.f;
 #endif
@@ -562,6 +596,11 @@ inline PointExchange::PointExchange(const PointPCD& p)
 
 //
 #define REGISTER_E57_XYZ (float, x, x) (float, y, y) (float, z, z)
+#ifdef POINT_E57_WITH_NORMAL
+#define REGISTER_E57_NORMAL (float, normal_x, normal_x) (float, normal_y, normal_y) (float, normal_z, normal_z) (float, curvature, curvature)
+#else
+#define REGISTER_E57_NORMAL
+#endif
 #ifdef POINT_E57_WITH_HDR
 #define REGISTER_E57_HDR (float, hdr_r, hdr_r) (float, hdr_g, hdr_g) (float, hdr_b, hdr_b) (float, hdr_a, hdr_a)
 #else
@@ -612,6 +651,7 @@ inline PointExchange::PointExchange(const PointPCD& p)
 
 POINT_CLOUD_REGISTER_POINT_STRUCT(PointE57,
 	REGISTER_E57_XYZ
+	REGISTER_E57_NORMAL
 	REGISTER_E57_HDR
 	REGISTER_E57_RGB
 	REGISTER_E57_INTENSITY
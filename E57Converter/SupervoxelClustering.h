@@ -15,6 +15,8 @@
 //DEBUG TODO REMOVE
 #include <pcl/common/time.h>
 
+#include "GridSearch.h"
+
 
 namespace e57
 {
@@ -173,7 +175,7 @@ namespace e57
 
 		void transformFunction(PointT &p);
 
-		typename pcl::search::KdTree<PointT>::Ptr voxel_kdtree_;
+		typename GridSearch<PointT>::Ptr voxel_kdtree_;
 
 		typename OctreeAdjacencyT::Ptr adjacency_octree_;
 
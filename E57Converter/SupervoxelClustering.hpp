@@ -345,7 +345,8 @@ e57::SupervoxelClustering<PointT>::selectInitialSupervoxelSeeds(std::vector<int>
 	distance.resize(1, 0);
 	if (voxel_kdtree_ == 0)
 	{
-		voxel_kdtree_.reset(new pcl::search::KdTree<PointT>);
+		// Seeds are filtered with radius 0.5 * seed_resolution_, which sets the cell size
+		voxel_kdtree_.reset(new GridSearch<PointT>(0.5 * seed_resolution_));
 		voxel_kdtree_->setInputCloud(voxel_centroid_cloud_);
 	}
 
@@ -355,16 +356,18 @@ e57::SupervoxelClustering<PointT>::selectInitialSupervoxelSeeds(std::vector<int>
 		seed_indices_orig[i] = closest_index[0];
 	}
 
-	std::vector<int> neighbors;
-	std::vector<float> sqr_distances;
+	std::vector<std::vector<int> > neighbors;
+	std::vector<std::vector<float> > sqr_distances;
 	seed_indices.reserve(seed_indices_orig.size());
 	float search_radius = 0.5f*seed_resolution_;
 	// This is 1/20th of the number of voxels which fit in a planar slice through search volume
 	// Area of planar slice / area of voxel side. (Note: This is smaller than the value mentioned in the original paper)
 	float min_points = 0.05f * (search_radius)*(search_radius) * 3.1415926536f / (resolution_*resolution_);
+	if (!seed_indices_orig.empty())
+		voxel_kdtree_->RadiusSearchBatch(*voxel_centroid_cloud_, seed_indices_orig, search_radius, neighbors, sqr_distances);
 	for (size_t i = 0; i < seed_indices_orig.size(); ++i)
 	{
-		int num = voxel_kdtree_->radiusSearch(seed_indices_orig[i], search_radius, neighbors, sqr_distances);
+		int num = static_cast<int>(neighbors[i].size());
 		int min_index = seed_indices_orig[i];
 		if (num > min_points)
 		{
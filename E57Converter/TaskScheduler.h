@@ -0,0 +1,174 @@
+#pragma once
+
+#include <deque>
+#include <algorithm>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <future>
+#include <exception>
+#include <functional>
+#include <condition_variable>
+
+namespace e57
+{
+	// Counting budget shared by concurrent tasks, for example number of concurrent I/O or bytes of memory.
+	// A request larger than the whole budget is clamped to it, so a single large task can still run alone.
+	class ResourceBudget
+	{
+	protected:
+		std::size_t capacity;
+		std::size_t used;
+		std::mutex mutex;
+		std::condition_variable released;
+
+	public:
+		ResourceBudget(const std::size_t capacity) : capacity((capacity > 0) ? capacity : 1), used(0) {}
+
+		// Return the acquired amount, which must be given back to Release
+		std::size_t Acquire(const std::size_t amount)
+		{
+			std::size_t _amount = std::min(amount, capacity);
+			std::unique_lock<std::mutex> lock(mutex);
+			released.wait(lock, [this, _amount]() { return (used + _amount) <= capacity; });
+			used += _amount;
+			return _amount;
+		}
+
+		void Release(const std::size_t amount)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			used -= amount;
+			released.notify_all();
+		}
+	};
+
+	// Hold an amount of a ResourceBudget during its scope
+	class ResourceBudgetLock
+	{
+	protected:
+		ResourceBudget& budget;
+		std::size_t amount;
+
+	public:
+		ResourceBudgetLock(ResourceBudget& budget, const std::size_t amount) : budget(budget), amount(budget.Acquire(amount)) {}
+		~ResourceBudgetLock() { Unlock(); }
+
+		void Unlock()
+		{
+			if (amount > 0)
+				budget.Release(amount);
+			amount = 0;
+		}
+	};
+
+	// Run a batch of independent tasks on a fixed number of workers with work stealing.
+	// Tasks are dealt round-robin to the workers, each worker pops tasks from the front of its own deque, and steals from the front of the others' deques once its own is empty.
+	// So tasks start about in submission order, and a task never starts before an earlier task of the same deque.
+	class TaskScheduler
+	{
+	public:
+		using Task = std::function<void()>;
+
+	protected:
+		struct Worker
+		{
+			std::deque<Task> tasks;
+			std::mutex mutex;
+		};
+
+		std::vector<std::shared_ptr<Worker>> workers;
+		std::size_t nextWorker;
+		std::atomic<bool> canceled;
+
+		bool Pop(const std::size_t w, Task& task)
+		{
+			Worker& worker = *workers[w];
+			std::lock_guard<std::mutex> lock(worker.mutex);
+			if (worker.tasks.empty())
+				return false;
+			task = std::move(worker.tasks.front());
+			worker.tasks.pop_front();
+			return true;
+		}
+
+		bool Steal(const std::size_t w, Task& task)
+		{
+			for (std::size_t i = 1; i < workers.size(); ++i)
+			{
+				Worker& victim = *workers[(w + i) % workers.size()];
+				std::lock_guard<std::mutex> lock(victim.mutex);
+				if (!victim.tasks.empty())
+				{
+					task = std::move(victim.tasks.front());
+					victim.tasks.pop_front();
+					return true;
+				}
+			}
+			return false;
+		}
+
+		int RunWorker(const std::size_t w)
+		{
+			try
+			{
+				Task task;
+				while (!canceled && (Pop(w, task) || Steal(w, task)))
+					task();
+				return 0;
+			}
+			catch (...)
+			{
+				// Stop the other workers, only the first error is reported
+				if (!canceled.exchange(true))
+					throw;
+				return 1;
+			}
+		}
+
+	public:
+		TaskScheduler(const unsigned int numWorkers) : nextWorker(0), canceled(false)
+		{
+			for (unsigned int w = 0; w < std::max(numWorkers, 1u); ++w)
+				workers.push_back(std::shared_ptr<Worker>(new Worker));
+		}
+
+		std::size_t NumWorkers() const { return workers.size(); }
+
+		void Submit(Task task)
+		{
+			Worker& worker = *workers[nextWorker];
+			nextWorker = (nextWorker + 1) % workers.size();
+			std::lock_guard<std::mutex> lock(worker.mutex);
+			worker.tasks.push_back(std::move(task));
+		}
+
+		// Run all submitted tasks and wait for them, the first exception thrown by a task is rethrown here
+		void Run()
+		{
+			canceled = false;
+			std::vector<std::future<int>> runs;
+			for (std::size_t w = 0; w < workers.size(); ++w)
+				runs.push_back(std::async(std::launch::async, &TaskScheduler::RunWorker, this, w));
+
+			std::exception_ptr error;
+			for (std::size_t w = 0; w < runs.size(); ++w)
+			{
+				try
+				{
+					runs[w].get();
+				}
+				catch (...)
+				{
+					error = std::current_exception();
+				}
+			}
+
+			for (std::size_t w = 0; w < workers.size(); ++w)
+				workers[w]->tasks.clear();
+			if (error)
+				std::rethrow_exception(error);
+		}
+	};
+}
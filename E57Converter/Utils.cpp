@@ -9,6 +9,7 @@
 
 #include "E57Utils.h"
 #include "E57Converter.h"
+#include "PCDStreamWriter.h"
 #include "Utils.h"
 
 //
@@ -64,9 +65,25 @@ void PrintHelp(int argc, char **argv)
 		PRINT_HELP("\t"	, "res"						, "float 4"							, "Gird unit size of OutOfCoreOctree in meters.");
 		PRINT_HELP("\t"	, "min"						, "XYZ_string \"-100 -100 -100\""	, "Min AABB corner of OutOfCoreOctree in meters. For example: -min \"-100 -100 -100\".");
 		PRINT_HELP("\t"	, "max"						, "XYZ_string \"100 100 100\""		, "Max AABB corner of OutOfCoreOctree in meters. For example: -max \"100 100 100\".");
-		PRINT_HELP("\t"	, "samplePercent"			, "float 0.125"						, "Sample percent for building OutOfCoreOctree LOD.");
+		PRINT_HELP("\t"	, "samplePercent"			, "float 0.125"						, "Sample percent for building OutOfCoreOctree LOD, each LOD node keeps this percent of its children points as a stratified voxel sample.");
 		PRINT_HELP("\t"	, "minRGB"					, "int 6"							, "Mean a point will be kept only if one of R, G, B is larger than minRGB. This parameters is used to filter out the black noise which is generated by some scanner (such as BLK360).");
 		PRINT_HELP("\t"	, "scanner"					, "sting \"UNKNOWN\""				, "(Optional, leave it keeping UNKNOWN if you are not goint to load HDRI or reconstruct scene albedo) Specify scanner type.");
+		PRINT_HELP("\t"	, "blockSize"				, "int 0"							, "(Optional, set to 0 to close it) Stream each scan into OutOfCoreOctree in blocks of blockSize points (for example 1000000), to bound memory usage by block size instead of scan size.");
+		PRINT_HELP("\t"	, "numDecoders"				, "int 0"							, "(Optional, set to 0 to use 2) Number of workers decoding scans in parallel, each worker opens its own e57 file handle and holds a whole scan (or block).");
+		PRINT_HELP("\t"	, "numFilters"				, "int 0"							, "(Optional, set to 0 to use 2) Number of workers transforming and filtering decoded points in parallel, the cores are shared by the workers.");
+		PRINT_HELP("\t"	, "queueDepth"				, "int 4"							, "Max number of scans (or blocks if blockSize is given) waiting between two stages of the ingest pipeline. At most numDecoders + numFilters + 2 * queueDepth + 1 scans (or blocks) are in memory, use blockSize to bound their size.");
+		PRINT_HELP("\t"	, "bulkRunSize"				, "int 0"							, "(Optional, set to 0 to close it) Bulk load OutOfCoreOctree: spill points to sorted runs of bulkRunSize points (for example 50000000) and merge them, so each leaf file is written once and sequentially. Needs free disk space of the point cloud size in dst folder.");
+		PRINT_HELP("\t"	, "scans"					, "sting \"\""						, "(Optional, leave it empty to load all scans) Scan IDs to load, a list of IDs and ranges. For example: -scans \"0-3,7,9\".");
+		PRINT_HELP("\t"	, "cropMin"					, "XYZ_string \"\""					, "(Optional) Min corner of a world space crop box, points outside it are not loaded. Points outside -min -max are never loaded. For example: -cropMin \"-10 -10 -2\".");
+		PRINT_HELP("\t"	, "cropMax"					, "XYZ_string \"\""					, "(Optional) Max corner of a world space crop box. For example: -cropMax \"10 10 5\".");
+		PRINT_HELP("\t"	, "polygon"					, "XY_string \"\""					, "(Optional) World space XY polygon, points outside it are not loaded. For example: -polygon \"0 0 10 0 10 10 0 10\".");
+		PRINT_HELP("\t"	, "maxRange"				, "float 0"							, "(Optional, set to 0 to close it) Max distance of a point from its scanner in meters.");
+		PRINT_HELP("\t"	, "stride"					, "int 1"							, "Keep every stride-th point of each scan, to decimate the scans.");
+		PRINT_HELP("\t"	, "autoBounds"				, "bool false"						, "(Optional) Estimate -min -max -res from the bounds of the loaded scans (scans without bounds are sampled), instead of given values.");
+		PRINT_HELP("\t"	, "pointsPerLeaf"			, "int 1000000"						, "Target number of points per OutOfCoreOctree leaf, used to choose -res if -autoBounds is given.");
+		PRINT_HELP("\t"	, "append"					, "bool false"						, "(Optional) Append the scans to the existing OutOfCoreOctree in dst folder. New scans are numbered after the existing ones, only LOD of the nodes touched by new points is updated, -res -min -max -autoBounds are ignored.");
+		PRINT_HELP("\t"	, "leafPrecision"			, "float 0"							, "(Optional, set to 0 to write PCD leaves) Write OutOfCoreOctree nodes in the compact leaf format, positions are quantized to leafPrecision meters (for example 0.001). Ignored with -append, the existing format is kept.");
+		PRINT_HELP("\t"	, "leafCompress"			, "bool false"						, "(Optional, only used when -leafPrecision is given) LZF compress each attribute block of compact leaves.");
 	}
 	
 	std::cout << "Parmameters of -convert -src \"*/\"  -dst \"*.pcd\":==========================================================================================================" << std::endl << std::endl;
@@ -79,6 +96,11 @@ void PrintHelp(int argc, char **argv)
 		PRINT_HELP("\t"	, "polynomialOrder"			, "int -1"							, "(Optional, set to negative to close it)Parameter for MovingLeastSquares to esitmate surface. If closed, use NormalEstimation instead, or it will use MovingLeastSquares to filter and estimate normal of surface.");
 		PRINT_HELP("\t"	, "reconstructAlbedo"		, ""								, "(Optional) Enable scene albedo reconstruction.");
 		PRINT_HELP("\t"	, "reconstructNDF"			, ""								, "(Optional, if true, it will set reconstructAlbedo altomatically) Enable scene micro-facet normal distribution reconstruction.");
+		PRINT_HELP("\t"	, "dedupScans"				, ""								, "(Optional) Keep only the points of the scan with the best range and incidence in each voxel, so overlapped scans are not averaged. This reduces points of heavily overlapped projects before the other stages.");
+		PRINT_HELP("\t"	, "numWorkers"				, "int 0"							, "(Optional, set to 0 to use the number of cores) Number of OutOfCoreOctree leaves processed concurrently.");
+		PRINT_HELP("\t"	, "ioConcurrency"			, "int 1"							, "Max number of OutOfCoreOctree leaves being read from disk at the same time.");
+		PRINT_HELP("\t"	, "memoryBudget"			, "int 0"							, "(Optional, set to 0 to close it) Max estimated memory in MB of the work units in process or waiting to be written, and of the cached leaves.");
+		PRINT_HELP("\t"	, "unitPoints"				, "int 0"							, "(Optional, set to 0 to process each leaf as a work unit) Balance work units to about unitPoints points (for example 2000000): sparse sibling leaves are merged and dense leaves are split.");
 	}
 
 	std::cout << "Parmameters of -convert -src \"*.pcd\"  -dst \"*.ply\":=======================================================================================================" << std::endl << std::endl;
@@ -132,7 +154,7 @@ void PrintHelp(int argc, char **argv)
 	std::cout << "Parmameters of -buildLOD:=================================================================================================================================" << std::endl << std::endl;
 	{
 		PRINT_HELP("\t"	, "src"						, "sting \"\""						, "Input OutOfCoreOctree file.");
-		PRINT_HELP("\t"	, "samplePercent"			, "float 0.125"						, "Sample percent for building OutOfCoreOctree LOD.");
+		PRINT_HELP("\t"	, "samplePercent"			, "float 0.125"						, "Sample percent for building OutOfCoreOctree LOD, each LOD node keeps this percent of its children points as a stratified voxel sample.");
 	}
 	std::cout << "==========================================================================================================================================================" << std::endl << std::endl;
 }
@@ -423,8 +445,116 @@ void Convert_E57_OCT(const boost::filesystem::path& srcFilePath, const boost::fi
 	Scanner scanner = StrToScanner(scannerStr);
 	std::cout << "Parmameters -scanner: " << ScannerToStr(scanner) << std::endl;
 
-	std::shared_ptr < e57::Converter > e57Converter = std::shared_ptr < e57::Converter >(new e57::Converter(dstFilePath, min, max, res, "ECEF"));
-	e57Converter->LoadE57(srcFilePath, samplePercent, minRGB, scanner);
+	unsigned int blockSize = 0;
+	pcl::console::parse_argument(argc, argv, "-blockSize", blockSize);
+	std::cout << "Parmameters -blockSize: " << blockSize << std::endl;
+
+	unsigned int numDecoders = 0;
+	unsigned int numFilters = 0;
+	unsigned int queueDepth = 4;
+	pcl::console::parse_argument(argc, argv, "-numDecoders", numDecoders);
+	pcl::console::parse_argument(argc, argv, "-numFilters", numFilters);
+	pcl::console::parse_argument(argc, argv, "-queueDepth", queueDepth);
+	std::cout << "Parmameters -numDecoders: " << numDecoders << std::endl;
+	std::cout << "Parmameters -numFilters: " << numFilters << std::endl;
+	std::cout << "Parmameters -queueDepth: " << queueDepth << std::endl;
+
+	unsigned int bulkRunSize = 0;
+	pcl::console::parse_argument(argc, argv, "-bulkRunSize", bulkRunSize);
+	std::cout << "Parmameters -bulkRunSize: " << bulkRunSize << std::endl;
+
+	e57::IngestFilter filter;
+	std::string scansStr = "";
+	pcl::console::parse_argument(argc, argv, "-scans", scansStr);
+	try
+	{
+		filter.scanRanges = e57::IngestFilter::ParseScanRanges(scansStr);
+	}
+	catch (std::exception& ex)
+	{
+		std::cerr << "-scans " << ex.what() << std::endl;
+		exit(EXIT_FAILURE);
+	}
+	std::cout << "Parmameters -scans: " << scansStr << std::endl;
+
+	std::string _cropMinStr = "";
+	std::string _cropMaxStr = "";
+	pcl::console::parse_argument(argc, argv, "-cropMin", _cropMinStr);
+	pcl::console::parse_argument(argc, argv, "-cropMax", _cropMaxStr);
+	if (!_cropMinStr.empty())
+	{
+		std::stringstream cropMinStr(_cropMinStr);
+		cropMinStr >> filter.cropMin.x() >> filter.cropMin.y() >> filter.cropMin.z();
+		std::cout << "Parmameters -cropMin: " << filter.cropMin << std::endl;
+	}
+	if (!_cropMaxStr.empty())
+	{
+		std::stringstream cropMaxStr(_cropMaxStr);
+		cropMaxStr >> filter.cropMax.x() >> filter.cropMax.y() >> filter.cropMax.z();
+		std::cout << "Parmameters -cropMax: " << filter.cropMax << std::endl;
+	}
+
+	std::string _polygonStr = "";
+	pcl::console::parse_argument(argc, argv, "-polygon", _polygonStr);
+	{
+		std::stringstream polygonStr(_polygonStr);
+		double px, py;
+		while (polygonStr >> px >> py)
+			filter.polygon.push_back(Eigen::Vector2d(px, py));
+		if (!filter.polygon.empty() && (filter.polygon.size() < 3))
+		{
+			std::cerr << "-polygon needs at least 3 points." << std::endl;
+			exit(EXIT_FAILURE);
+		}
+		std::cout << "Parmameters -polygon: " << filter.polygon.size() << " points" << std::endl;
+	}
+
+	unsigned int stride = 1;
+	pcl::console::parse_argument(argc, argv, "-maxRange", filter.maxRange);
+	pcl::console::parse_argument(argc, argv, "-stride", stride);
+	filter.stride = stride;
+	std::cout << "Parmameters -maxRange: " << filter.maxRange << std::endl;
+	std::cout << "Parmameters -stride: " << filter.stride << std::endl;
+
+	bool autoBounds = pcl::console::find_switch(argc, argv, "-autoBounds");
+	unsigned int pointsPerLeaf = 1000000;
+	pcl::console::parse_argument(argc, argv, "-pointsPerLeaf", pointsPerLeaf);
+	std::cout << "Parmameters -autoBounds: " << autoBounds << std::endl;
+	std::cout << "Parmameters -pointsPerLeaf: " << pointsPerLeaf << std::endl;
+	bool append = pcl::console::find_switch(argc, argv, "-append");
+	std::cout << "Parmameters -append: " << append << std::endl;
+
+	e57::LeafFormat leafFormat;
+	pcl::console::parse_argument(argc, argv, "-leafPrecision", leafFormat.precision);
+	leafFormat.compress = pcl::console::find_switch(argc, argv, "-leafCompress");
+	std::cout << "Parmameters -leafPrecision: " << leafFormat.precision << std::endl;
+	std::cout << "Parmameters -leafCompress: " << leafFormat.compress << std::endl;
+	if (append)
+	{
+		if (!boost::filesystem::exists(dstFilePath / boost::filesystem::path("octRoot.oct_idx")))
+		{
+			std::cerr << "No OutOfCoreOctree to append in " << dstFilePath << "." << std::endl;
+			exit(EXIT_FAILURE);
+		}
+		std::shared_ptr < e57::Converter > e57Converter = std::shared_ptr < e57::Converter >(new e57::Converter(dstFilePath));
+		e57Converter->LoadE57(srcFilePath, samplePercent, minRGB, scanner, blockSize, numDecoders, numFilters, queueDepth, bulkRunSize, filter, true);
+		return;
+	}
+
+	if (autoBounds)
+	{
+		if (!e57::Converter::EstimateBounds(srcFilePath, filter, pointsPerLeaf, min, max, res))
+		{
+			std::cerr << "Failed to estimate bounds of " << srcFilePath << "." << std::endl;
+			exit(EXIT_FAILURE);
+		}
+		std::cout << "Estimated -min: " << min << std::endl;
+		std::cout << "Estimated -max: " << max << std::endl;
+		std::cout << "Estimated -res: " << res << std::endl;
+	}
+
+	std::shared_ptr < e57::Converter > e57Converter = std::shared_ptr < e57::Converter >(new e57::Converter(dstFilePath, min, max, res, "ECEF", leafFormat));
+	e57Converter->LoadE57(srcFilePath, samplePercent, minRGB, scanner, blockSize, numDecoders, numFilters, queueDepth, bulkRunSize, filter);
 }
 
 void Convert_E57_PLY(const boost::filesystem::path& srcFilePath, const boost::filesystem::path& dstFilePath, int argc, char** argv)
@@ -530,12 +660,37 @@ void Convert_OCT_PCD(const boost::filesystem::path& srcFilePath, const boost::fi
 		reconstructAlbedo = true;
 	std::cout << "Parmameters -reconstructAlbedo: " << reconstructAlbedo << std::endl;
 	std::cout << "Parmameters -reconstructNDF: " << reconstructNDF << std::endl;
+
+	bool dedupScans = pcl::console::find_switch(argc, argv, "-dedupScans");
+	std::cout << "Parmameters -dedupScans: " << dedupScans << std::endl;
+
+	unsigned int numWorkers = 0; // number of cores for default
+	unsigned int ioConcurrency = 1;
+	unsigned int memoryBudgetMB = 0; // no limit for default
+	pcl::console::parse_argument(argc, argv, "-numWorkers", numWorkers);
+	pcl::console::parse_argument(argc, argv, "-ioConcurrency", ioConcurrency);
+	pcl::console::parse_argument(argc, argv, "-memoryBudget", memoryBudgetMB);
+	std::cout << "Parmameters -numWorkers: " << numWorkers << std::endl;
+	std::cout << "Parmameters -ioConcurrency: " << ioConcurrency << std::endl;
+	std::cout << "Parmameters -memoryBudget: " << memoryBudgetMB << std::endl;
+
+	unsigned int unitPoints = 0; // one work unit per leaf for default
+	pcl::console::parse_argument(argc, argv, "-unitPoints", unitPoints);
+	std::cout << "Parmameters -unitPoints: " << unitPoints << std::endl;
 	
 	pcl::PointCloud<PointPCD>::Ptr cloud(new pcl::PointCloud<PointPCD>);
 	std::vector<pcl::PointCloud<PointNDF>::Ptr> NDFs;
 	std::shared_ptr < e57::Converter > e57Converter = std::shared_ptr < e57::Converter >(new e57::Converter(srcFilePath));
-	e57Converter->ExportToPCD(voxelUnit, searchRadiusNumVoxels, meanK, polynomialOrder, reconstructAlbedo, reconstructNDF, cloud, NDFs);
-	pcl::io::savePCDFile(dstFilePath.string(), *cloud, true);
+	e57::PCDStreamWriter<PointPCD> writer(dstFilePath);
+	bool exported = e57Converter->ExportToPCD(voxelUnit, searchRadiusNumVoxels, meanK, polynomialOrder, reconstructAlbedo, reconstructNDF, dedupScans, cloud, NDFs, numWorkers, ioConcurrency, (std::size_t)memoryBudgetMB, (std::size_t)unitPoints, &writer);
+	writer.Close();
+	if (!exported)
+	{
+		// The streamed file is a valid PCD of the units written so far, remove it so it is not taken for a complete export
+		std::cout << "ExportToPCD failed, remove incomplete " << dstFilePath << "." << std::endl;
+		boost::filesystem::remove(dstFilePath);
+		exit(EXIT_FAILURE);
+	}
 }
 
 void Convert_OCT_OCT(const boost::filesystem::path& srcFilePath, const boost::filesystem::path& dstFilePath, int argc, char** argv)